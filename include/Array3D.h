@@ -17,6 +17,7 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 //#include <assert.h>
 #include <vector>
 #include <limits.h>
+#include <algorithm>
 //#include <fstream>
 
 //why can't min and max just be there when you need them?
@@ -50,12 +51,15 @@ An array template with a user-definable default value that is returned for any 3
 
 There are three dimensions of indices, referred to i, j, and k. In many uses these will be synonomous with x, y, and z. 
 
-Memory allocation is managed internally and totally abstracted from the user. Whenever addvalue is called the internal array is smartly resized if the index falls outside of the currently allocated area. If the dimensions are known in advance, resize() may be called once to reduce costly memory reallocations.
+Memory allocation is managed internally and totally abstracted from the user. Whenever addvalue is called the internal array is smartly resized if the index falls outside of the currently allocated area. If the bounds are known in advance, reserve() (or resize()) may be called once to avoid repeated memory reallocations.
 
 The value of an element can be accesed with [], (), or at(). Empty elements (or elements outside the allocated area) are synonomous with the element being defaultValue.
 
+The minimum and maximum indices of all elements (minIndices() and maxIndices()) are kept up to date by addValue() and removeValue() with a count of the elements in each i, j, and k slab, so removing elements never requires a scan of the whole array. Values written directly through the reference returned by [], (), or at() are not counted until the next resize() or setDefaultValue().
+
+By default (BrickBits = 0) the allocated area is one dense block of memory, which is fastest for compact data. For sparse or widely spread data a paged storage mode is selected with a nonzero BrickBits template parameter: the allocated area is then divided into cubic bricks of 2^BrickBits elements per side (for example CArray3D<int, 3> uses 8x8x8 bricks) and only bricks that contain elements are allocated. A brick is allocated by addValue() and released again when removeValue() empties it. Lookups remain constant time through a directory of one int per brick of the allocated area, so memory scales with the number of occupied bricks rather than the volume of the bounding box. In paged mode the allocated area always spans whole bricks, and writing through a reference (rather than with addValue()) only reaches elements of bricks that are already allocated.
 */
-template <typename T = float>
+template <typename T = float, int BrickBits = 0>
 class CArray3D
 {
 public:
@@ -82,6 +86,11 @@ public:
 		aOff = rArray.aOff;
 		cMin = rArray.cMin;
 		cMax = rArray.cMax;
+		for (int i=0; i<3; i++) slabCount[i] = rArray.slabCount[i];
+		bSize = rArray.bSize;
+		bricks = rArray.bricks;
+		brickElements = rArray.brickElements;
+		freeBricks = rArray.freeBricks;
 		return *this;
 	}
 
@@ -97,6 +106,11 @@ public:
 		cMin = Index3D(INT_MAX, INT_MAX, INT_MAX);
 		cMax = Index3D(INT_MIN, INT_MIN, INT_MIN);
 		data.clear();
+		for (int i=0; i<3; i++) slabCount[i].clear();
+		bSize = Index3D(0,0,0);
+		bricks.clear();
+		brickElements.clear();
+		freeBricks.clear();
 	}
 
 	//!Sets the value to which all new allocations default to. @param[in] newDefaultValue the value returned from any index that has not been set otherwise.
@@ -104,10 +118,12 @@ public:
 		int linSize = data.size();
 		for (int i=0; i<linSize; i++) if (data[i]==defaultValue) data[i] = newDefaultValue; //replace all old defaults with new default
 		defaultValue = newDefaultValue; //remember new default
+		UpdateMinMax(); //values that equal the new default are no longer elements
 	}
 
 	Index3D minIndices() const {return cMin;} //!< Returns the minimum i, j, and k indices utilized by any element in the array
 	Index3D maxIndices() const {return cMax;} //!< Returns the maximum i, j, and k indices utilized by any element in the array
+	size_t memoryUsage() const {return data.capacity()*sizeof(T) + bricks.capacity()*sizeof(int) + brickElements.capacity()*sizeof(int) + freeBricks.capacity()*sizeof(int);} //!< Returns the approximate number of bytes allocated to store the elements of this array.
 
 	//! Returns the value at the specified 3d index or the default value otherwise. Const version. @param[in] i3D the 3D index (i,j,k) in question.
 	const T& at(const Index3D& i3D) const { 
@@ -127,6 +143,7 @@ public:
 	//! Resize the internal data allocation to new specified size and offset. Any data ouside the new range is discarded. The range of allocated values in a given dimension spans from newOffset to newOffset+newsize. @param[in] newSize the number of elements in i, j, and k to allocate @param[in] newOffset the offset in i, j, and k of the allocated elements.
 	bool resize(const Index3D& newSize, const Index3D& newOffset=Index3D(0,0,0)){
 		if (newSize==aSize && newOffset==aOff) return true;
+		if (BrickBits > 0) return resizeBricks(newSize, newOffset);
 		int newLinearSize = newSize.x*newSize.y*newSize.z;
 		if (newLinearSize == 0){clear(); return true;}
 
@@ -134,35 +151,40 @@ public:
 		try {newData.resize(newLinearSize, defaultValue);} //new data
 		catch (std::bad_alloc&){return false;} //couldn't get the memory
 
-		//iterate through overlapping region
+		//copy the overlapping region one contiguous i row at a time
 		Index3D oldMin = aOff, oldMax=aOff+aSize, newMin=newOffset, newMax=newOffset+newSize; //for readability: old and new min and max indices
 		Index3D minOverlap(LOCALMAX(oldMin.x, newMin.x), LOCALMAX(oldMin.y, newMin.y), LOCALMAX(oldMin.z, newMin.z)); //minimum of overlapping range
 		Index3D maxOverlap(LOCALMIN(oldMax.x, newMax.x), LOCALMIN(oldMax.y, newMax.y), LOCALMIN(oldMax.z, newMax.z)); //maximum of overlapping range
-		for (int k=minOverlap.z; k<maxOverlap.z; k++){
-			for (int j=minOverlap.y; j<maxOverlap.y; j++){
-				for (int i=minOverlap.x; i<maxOverlap.x; i++){ //optimize out this loop with memcpy if it's too slow
-					newData[(i-newOffset.x)+newSize.x*(j-newOffset.y) + newSize.x*newSize.y*(k-newOffset.z)]=data[getIndexFast(i,j,k)];
+		int rowLength = maxOverlap.x-minOverlap.x;
+		if (rowLength > 0){
+			for (int k=minOverlap.z; k<maxOverlap.z; k++){
+				for (int j=minOverlap.y; j<maxOverlap.y; j++){
+					typename std::vector<T>::const_iterator row = data.begin() + getIndexFast(minOverlap.x, j, k);
+					std::copy(row, row+rowLength, newData.begin() + (minOverlap.x-newOffset.x)+newSize.x*(j-newOffset.y) + newSize.x*newSize.y*(k-newOffset.z));
 				}
 			}
 		}
-		try {data=newData;} //new data
-		catch (std::bad_alloc&){return false;} //couldn't get the memory
+		data.swap(newData); //take the new storage without a second copy. The old is freed with newData.
 
 		aSize = newSize;
 		aOff = newOffset;
 
-		//update min/max
-		if (cMin.x < aOff.x) cMin.x = aOff.x;
-		if (cMax.x > aSize.x + aOff.x) cMax.x = aSize.x + aOff.x;
-		if (cMin.y < aOff.y) cMin.y = aOff.y;
-		if (cMax.y > aSize.y + aOff.y) cMax.y = aSize.y + aOff.y;
-		if (cMin.z < aOff.z) cMin.z = aOff.z;
-		if (cMax.z > aSize.z + aOff.z) cMax.z = aSize.z + aOff.z;
-
+		UpdateMinMax(); //some elements may have been discarded
 		return true;
 	}
 	bool resize(int iSize, int jSize, int kSize, int iOffset=0, int jOffset=0, int kOffset=0){return resize(Index3D(iSize, jSize, kSize), Index3D(iOffset, jOffset, kOffset));} //!< Resize the internal data allocation to new specified sizes and offsets in i j and k. Any data ouside the new range is discarded. The range of allocated values in a given dimension spans from iOffset to iOffset+iSize (and the same for j and k. @param[in] iSize the number of elements in i. @param[in] jSize the number of elements in j. @param[in] kSize the number of elements in k. @param[in] iOffset the offset of allocated i elements. @param[in] jOffset the offset of allocated j elements. @param[in] kOffset the offset of allocated k elements.
 
+	//! Grows the allocated area in a single reallocation to include every index from minIndex to maxIndex (inclusive). Existing elements are kept and the area never shrinks. Calling this before adding many values with known bounds avoids the repeated reallocations of growing one addValue() at a time. @param[in] minIndex the minimum i, j, and k indices to allocate. @param[in] maxIndex the maximum i, j, and k indices to allocate. @return false if the memory could not be allocated.
+	bool reserve(const Index3D& minIndex, const Index3D& maxIndex){
+		if (minIndex.x > maxIndex.x || minIndex.y > maxIndex.y || minIndex.z > maxIndex.z) return true; //nothing to reserve
+		Index3D newMin = minIndex, newMax = maxIndex+Index3D(1,1,1);
+		if (aSize.x > 0){ //keep everything currently allocated
+			newMin = Index3D(LOCALMIN(newMin.x, aOff.x), LOCALMIN(newMin.y, aOff.y), LOCALMIN(newMin.z, aOff.z));
+			newMax = Index3D(LOCALMAX(newMax.x, aOff.x+aSize.x), LOCALMAX(newMax.y, aOff.y+aSize.y), LOCALMAX(newMax.z, aOff.z+aSize.z));
+		}
+		return resize(newMax-newMin, newMin);
+	}
+
 	//! Deallocates as much memory as possible by reducing the allocated area to minimum span of existing elements.
 	bool shrink_to_fit(){
 		return resize(cMax-cMin+Index3D(1,1,1), cMin);
@@ -175,8 +197,12 @@ public:
 			return true;
 		}
 
-		int ThisIndex = getIndex(index);
-		if (ThisIndex != -1){data[ThisIndex] = value;}
+		int ThisIndex = getOrAllocateIndex(index);
+		bool newElement = true;
+		if (ThisIndex != -1){
+			newElement = (data[ThisIndex] == defaultValue);
+			data[ThisIndex] = value;
+		}
 		else { //reallocation required
 			int attempt=0;
 			bool success=false;
@@ -200,16 +226,16 @@ public:
 					aNewMax = index+Index3D(2,2,2);
 				}
 				else { //if there's some allocated space, double the size (or keep going if we added a point way out...)
-					while (index.x<=aNewMin.x) aNewMin.x -= aSize.x/scaleDivisor;
-					while (index.x>=aNewMax.x) aNewMax.x += aSize.x/scaleDivisor;
-					while (index.y<=aNewMin.y) aNewMin.y -= aSize.y/scaleDivisor;
-					while (index.y>=aNewMax.y) aNewMax.y += aSize.y/scaleDivisor;
-					while (index.z<=aNewMin.z) aNewMin.z -= aSize.z/scaleDivisor;
-					while (index.z>=aNewMax.z) aNewMax.z += aSize.z/scaleDivisor;
+					while (index.x<=aNewMin.x) aNewMin.x -= LOCALMAX(aSize.x/scaleDivisor, 1);
+					while (index.x>=aNewMax.x) aNewMax.x += LOCALMAX(aSize.x/scaleDivisor, 1);
+					while (index.y<=aNewMin.y) aNewMin.y -= LOCALMAX(aSize.y/scaleDivisor, 1);
+					while (index.y>=aNewMax.y) aNewMax.y += LOCALMAX(aSize.y/scaleDivisor, 1);
+					while (index.z<=aNewMin.z) aNewMin.z -= LOCALMAX(aSize.z/scaleDivisor, 1);
+					while (index.z>=aNewMax.z) aNewMax.z += LOCALMAX(aSize.z/scaleDivisor, 1);
 				}
 			
 				if (resize(aNewMax-aNewMin, aNewMin)){
-					ThisIndex = getIndex(index); //new index since we changed allocated size
+					ThisIndex = getOrAllocateIndex(index); //new index since we changed allocated size
 					if (ThisIndex == -1) return false; //this should never happen, but check to make sure!
 					data[ThisIndex] = value;
 					success=true;
@@ -217,7 +243,13 @@ public:
 			}
 		}
 
-		//keep track of min and max
+		//keep track of occupancy, min and max
+		if (newElement){
+			slabCount[0][index.x-aOff.x]++;
+			slabCount[1][index.y-aOff.y]++;
+			slabCount[2][index.z-aOff.z]++;
+			if (BrickBits > 0) brickElements[ThisIndex/BRICK_VOLUME]++;
+		}
 		if (index.x < cMin.x) cMin.x = index.x;
 		if (index.x > cMax.x) cMax.x = index.x;
 		if (index.y < cMin.y) cMin.y = index.y;
@@ -234,45 +266,187 @@ public:
 		int ThisIndex = getIndex(index);
 		if (ThisIndex == -1 || data[ThisIndex] == defaultValue) return; //already not there...
 		data[ThisIndex] = defaultValue;
-		UpdateMinMax();
+
+		int* pCount[3] = {&slabCount[0][index.x-aOff.x], &slabCount[1][index.y-aOff.y], &slabCount[2][index.z-aOff.z]};
+		if (*pCount[0] <= 0 || *pCount[1] <= 0 || *pCount[2] <= 0){UpdateMinMax(); return;} //this value was set through a reference instead of addValue(), so the counts are stale
+		bool slabEmptied = false;
+		for (int i=0; i<3; i++) if (--(*pCount[i]) == 0) slabEmptied = true;
+		if (slabEmptied) TightenMinMax(); //min and max can only change if a slab emptied
+
+		if (BrickBits > 0){ //release the brick once it is empty
+			int brick = ThisIndex/BRICK_VOLUME;
+			if (brickElements[brick] <= 0){UpdateMinMax(); return;}
+			if (--brickElements[brick] == 0) releaseBrick(brickDirectoryIndex(index));
+		}
 	}
 	void removeValue(int i, int j, int k){removeValue(Index3D(i,j,k));} //!< Removes any value at the specified index and returns its value to the default value. Never triggers a reallocation - use shrink_to_fit() to try to reduce the memory usage after removing element(s). Use removeValue to remove it. @param[in] i The i index to remove a value from if it exists. @param[in] j The j index to remove a value from if it exists. @param[in] k The k index to remove a value from if it exists.
 
 private:
 
+	enum {BRICK_SIZE = 1<<BrickBits, BRICK_MASK = BRICK_SIZE-1, BRICK_VOLUME = BRICK_SIZE*BRICK_SIZE*BRICK_SIZE};
+
+	int getOrAllocateIndex(const Index3D& i3D){ //like getIndex(), but in paged mode allocates the brick if the index is within the allocated area
+		int i = getIndex(i3D);
+		if (i == -1 && BrickBits > 0 && !(i3D.x<aOff.x || i3D.x >= aOff.x+aSize.x || i3D.y<aOff.y || i3D.y >= aOff.y+aSize.y || i3D.z<aOff.z || i3D.z >= aOff.z+aSize.z)){
+			if (allocateBrick(brickDirectoryIndex(i3D))) i = getIndex(i3D);
+		}
+		return i;
+	}
 	int getIndex(const Index3D& i3D) const { //returns the 1D index anywhere in allocated space or -1 if requested index is unallocated
 		if (i3D.x<aOff.x || i3D.x >= aOff.x+aSize.x || i3D.y<aOff.y || i3D.y >= aOff.y+aSize.y || i3D.z<aOff.z || i3D.z >= aOff.z+aSize.z) return -1; //if this XYZ is out of the area
-		else return (i3D.x-aOff.x) + aSize.x*(i3D.y-aOff.y) + aSize.x*aSize.y*(i3D.z-aOff.z);
+		if (BrickBits == 0) return (i3D.x-aOff.x) + aSize.x*(i3D.y-aOff.y) + aSize.x*aSize.y*(i3D.z-aOff.z);
+
+		int brick = bricks[brickDirectoryIndex(i3D)];
+		if (brick == -1) return -1;
+		int x = i3D.x-aOff.x, y = i3D.y-aOff.y, z = i3D.z-aOff.z;
+		return brick*BRICK_VOLUME + (x&BRICK_MASK) + BRICK_SIZE*((y&BRICK_MASK) + BRICK_SIZE*(z&BRICK_MASK));
+	}
+	int brickDirectoryIndex(const Index3D& i3D) const { //index into bricks of the brick containing this (allocated area) index
+		return ((i3D.x-aOff.x)>>BrickBits) + bSize.x*(((i3D.y-aOff.y)>>BrickBits) + bSize.y*((i3D.z-aOff.z)>>BrickBits));
 	}
 	int getIndexFast(int inX, int inY, int inZ) const { //returns the 1D index anywhere in allocated space (no safety checks!)
 		return (inX-aOff.x) + aSize.x*(inY-aOff.y) + aSize.x*aSize.y*(inZ-aOff.z);
 	}
 
-	void UpdateMinMax(){ //slow, but easy to start. optimized versions can come if needed.
-		cMin = Index3D(INT_MAX, INT_MAX, INT_MAX);
-		cMax = Index3D(INT_MIN, INT_MIN, INT_MIN);
-
-		for (int k=aOff.z; k<aSize.z+aOff.z; k++){
-			for (int j=aOff.y; j<aSize.y+aOff.y; j++){
-				for (int i=aOff.x; i<aSize.x+aOff.x; i++){
-					if (data[getIndexFast(i,j,k)] != defaultValue){ //if there's something here...
-						if (i<cMin.x) cMin.x=i; //account for offset at end
-						else if (i>cMax.x) cMax.x=i;
-						if (j<cMin.y) cMin.y=j;
-						else if (j>cMax.y) cMax.y=j;
-						if (k<cMin.z) cMin.z=k;
-						else if (k>cMax.z) cMax.z=k;
+	void UpdateMinMax(){ //recounts the elements in each slab of the allocated volume, then finds min and max from the counts
+		slabCount[0].assign(aSize.x, 0);
+		slabCount[1].assign(aSize.y, 0);
+		slabCount[2].assign(aSize.z, 0);
+		if (BrickBits == 0){
+			for (int k=0; k<aSize.z; k++){
+				for (int j=0; j<aSize.y; j++){
+					for (int i=0; i<aSize.x; i++){
+						if (data[i + aSize.x*(j + aSize.y*k)] != defaultValue){ //if there's something here...
+							slabCount[0][i]++;
+							slabCount[1][j]++;
+							slabCount[2][k]++;
+						}
+					}
+				}
+			}
+		}
+		else { //only the allocated bricks
+			for (int bk=0; bk<bSize.z; bk++){
+				for (int bj=0; bj<bSize.y; bj++){
+					for (int bi=0; bi<bSize.x; bi++){
+						int dirIndex = bi + bSize.x*(bj + bSize.y*bk), brick = bricks[dirIndex];
+						if (brick == -1) continue;
+						const T* pData = &data[brick*BRICK_VOLUME];
+						int count = 0;
+						for (int k=0; k<BRICK_SIZE; k++){
+							for (int j=0; j<BRICK_SIZE; j++){
+								for (int i=0; i<BRICK_SIZE; i++, pData++){
+									if (*pData != defaultValue){
+										slabCount[0][(bi<<BrickBits) + i]++;
+										slabCount[1][(bj<<BrickBits) + j]++;
+										slabCount[2][(bk<<BrickBits) + k]++;
+										count++;
+									}
+								}
+							}
+						}
+						brickElements[brick] = count;
+						if (count == 0) releaseBrick(dirIndex);
 					}
 				}
 			}
 		}
 
+		cMin = aOff;
+		cMax = aOff+aSize-Index3D(1,1,1);
+		TightenMinMax();
+	}
+
+	static int floorBrick(int index){return index - (((index % BRICK_SIZE) + BRICK_SIZE) % BRICK_SIZE);} //rounds down to a multiple of the brick size
+
+	bool resizeBricks(const Index3D& newSize, const Index3D& newOffset){ //paged version of resize(): only the brick directory is reallocated
+		if (newSize.x <= 0 || newSize.y <= 0 || newSize.z <= 0){clear(); return true;}
+		Index3D newMin(floorBrick(newOffset.x), floorBrick(newOffset.y), floorBrick(newOffset.z)); //align outwards to whole bricks
+		Index3D newMax(floorBrick(newOffset.x+newSize.x+BRICK_MASK), floorBrick(newOffset.y+newSize.y+BRICK_MASK), floorBrick(newOffset.z+newSize.z+BRICK_MASK));
+		if (newMin == aOff && newMax == aOff+aSize) return true;
+		Index3D newBSize((newMax.x-newMin.x)>>BrickBits, (newMax.y-newMin.y)>>BrickBits, (newMax.z-newMin.z)>>BrickBits);
+
+		std::vector<int> newBricks;
+		try {newBricks.resize(newBSize.x*newBSize.y*newBSize.z, -1);}
+		catch (std::bad_alloc&){return false;} //couldn't get the memory
+
+		//move the existing bricks to the new directory, releasing any outside the new area
+		for (int bk=0; bk<bSize.z; bk++){
+			for (int bj=0; bj<bSize.y; bj++){
+				for (int bi=0; bi<bSize.x; bi++){
+					int dirIndex = bi + bSize.x*(bj + bSize.y*bk);
+					if (bricks[dirIndex] == -1) continue;
+					int ni = bi + ((aOff.x-newMin.x)>>BrickBits), nj = bj + ((aOff.y-newMin.y)>>BrickBits), nk = bk + ((aOff.z-newMin.z)>>BrickBits);
+					if (ni < 0 || ni >= newBSize.x || nj < 0 || nj >= newBSize.y || nk < 0 || nk >= newBSize.z) releaseBrick(dirIndex);
+					else newBricks[ni + newBSize.x*(nj + newBSize.y*nk)] = bricks[dirIndex];
+				}
+			}
+		}
+
+		bricks.swap(newBricks);
+		bSize = newBSize;
+		aOff = newMin;
+		aSize = newMax-newMin;
+		UpdateMinMax(); //some elements may have been discarded
+		return true;
+	}
+
+	bool allocateBrick(int dirIndex){ //allocates (or reuses) storage for the brick at this directory index, filled with the default value
+		int brick;
+		if (!freeBricks.empty()){
+			brick = freeBricks.back();
+			freeBricks.pop_back();
+			std::fill(data.begin() + brick*BRICK_VOLUME, data.begin() + (brick+1)*BRICK_VOLUME, defaultValue);
+		}
+		else {
+			brick = (int)brickElements.size();
+			try {
+				data.resize(data.size() + BRICK_VOLUME, defaultValue);
+				brickElements.push_back(0);
+			}
+			catch (std::bad_alloc&){return false;} //couldn't get the memory
+		}
+		brickElements[brick] = 0;
+		bricks[dirIndex] = brick;
+		return true;
+	}
+
+	void releaseBrick(int dirIndex){ //returns the storage of an (empty) brick to the free list
+		freeBricks.push_back(bricks[dirIndex]);
+		bricks[dirIndex] = -1;
+	}
+
+	void TightenMinMax(){ //moves min and max inwards past any empty slabs. Amortized O(1) since they only move outwards when elements are added.
+		tightenAxis(slabCount[0], aOff.x, &cMin.x, &cMax.x);
+		tightenAxis(slabCount[1], aOff.y, &cMin.y, &cMax.y);
+		tightenAxis(slabCount[2], aOff.z, &cMin.z, &cMax.z);
+		if (cMin.x > cMax.x || cMin.y > cMax.y || cMin.z > cMax.z){ //empty
+			cMin = Index3D(INT_MAX, INT_MAX, INT_MAX);
+			cMax = Index3D(INT_MIN, INT_MIN, INT_MIN);
+		}
+	}
+
+	static void tightenAxis(const std::vector<int>& count, int offset, int* pMin, int* pMax){
+		int first = *pMin-offset, last = *pMax-offset, size = (int)count.size();
+		if (first < 0) first = 0;
+		if (last >= size) last = size-1;
+		while (first <= last && count[first] == 0) first++;
+		while (last >= first && count[last] == 0) last--;
+		*pMin = first+offset;
+		*pMax = last+offset;
 	}
 
 	T defaultValue; //value to fill newly initialized space with
 	std::vector<T> data;
 	Index3D aSize, aOff; //allocated size and offset
 	Index3D cMin, cMax; //current minimum and maximum values in x/y/x currently in 
+	std::vector<int> slabCount[3]; //number of elements in each i, j, and k slab of the allocated volume
+
+	//paged mode only:
+	Index3D bSize; //allocated area in bricks
+	std::vector<int> bricks; //brick directory: index of the brick in data at each brick location of the allocated area, or -1 if not allocated
+	std::vector<int> brickElements; //number of elements in each brick
+	std::vector<int> freeBricks; //released bricks available for reuse
 
 };
 
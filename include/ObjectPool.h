@@ -0,0 +1,106 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <vector>
+#include <new>
+#include <cstddef>
+
+//!A block allocator for many objects of a single type.
+/*!
+Storage is taken from the system in blocks of many objects, so objects allocated one after another sit next to each other in memory and the cost of a system allocation is shared by the whole block. Blocks start small and double in size up to MaxBlockSize objects. Released storage is kept on a free list and handed out again by the next allocate(). Blocks never move, so a pointer stays valid until its storage is released.
+
+The pool only manages storage, not object lifetimes: construct an object with placement new on the pointer returned by allocate() and call its destructor before passing it to release(). clear() returns all blocks to the system at once and must only be called after every object in the pool has been destroyed.
+*/
+template <typename T, int MaxBlockSize = 4096>
+class CObjectPool
+{
+public:
+	CObjectPool() {freeList = NULL; blockUsed = blockCapacity = 0; nextBlockSize = 32; liveCount = 0; allocatedBytes = 0;} //!< Constructor
+	~CObjectPool(void) {clear();} //!< Destructor. Frees all blocks. Any objects still in the pool are not destroyed.
+
+	//! Returns uninitialized storage for one T. Throws std::bad_alloc if the memory is not available.
+	void* allocate(){
+		if (freeList){ //reuse released storage first
+			FreeSlot* pSlot = freeList;
+			freeList = pSlot->next;
+			liveCount++;
+			return pSlot;
+		}
+		if (blockUsed == blockCapacity) addBlock(nextBlockSize);
+		liveCount++;
+		return blocks.back() + sizeof(T)*blockUsed++;
+	}
+
+	//! Returns storage from allocate() to the pool for reuse. The object in it must already have been destroyed. @param[in] p the storage to release. NULL is ignored.
+	void release(void* p){
+		if (!p) return;
+		FreeSlot* pSlot = (FreeSlot*)p;
+		pSlot->next = freeList;
+		freeList = pSlot;
+		liveCount--;
+	}
+
+	//! Makes sure the next count allocations need at most one more system allocation. @param[in] count the number of objects about to be allocated.
+	void reserve(int count){
+		int available = blockCapacity-blockUsed;
+		for (FreeSlot* pSlot = freeList; pSlot && available < count; pSlot = pSlot->next) available++;
+		if (available < count) addBlock(count-available);
+	}
+
+	//! Frees all blocks. Every object allocated from this pool must already have been destroyed.
+	void clear(){
+		for (std::vector<char*>::iterator it = blocks.begin(); it != blocks.end(); it++) ::operator delete(*it);
+		blocks.clear();
+		freeList = NULL;
+		blockUsed = blockCapacity = 0;
+		nextBlockSize = 32;
+		liveCount = 0;
+		allocatedBytes = 0;
+	}
+
+	int size() const {return liveCount;} //!< Returns the number of objects currently allocated from this pool.
+	size_t memoryUsage() const {return allocatedBytes;} //!< Returns the number of bytes currently held from the system.
+
+private:
+	CObjectPool(const CObjectPool&); //not copyable: the pool owns its storage by address
+	CObjectPool& operator=(const CObjectPool&);
+
+	struct FreeSlot {FreeSlot* next;}; //released storage is linked through its own first bytes
+	static_assert(sizeof(T) >= sizeof(FreeSlot), "CObjectPool objects must be at least pointer sized");
+
+	void addBlock(int objectCount){ //starts a new block for at least objectCount objects. Any unused end of the previous block is put on the free list.
+		if (objectCount < nextBlockSize) objectCount = nextBlockSize;
+		blocks.reserve(blocks.size()+1); //so adding the block below can't throw and leak it
+		char* pBlock = (char*)::operator new(sizeof(T)*objectCount); //aligned for any fundamental type, and sizeof(T) is a multiple of T's alignment
+		while (blockUsed < blockCapacity){ //keep the unused end of the last block for later
+			FreeSlot* pSlot = (FreeSlot*)(blocks.back() + sizeof(T)*blockUsed++);
+			pSlot->next = freeList;
+			freeList = pSlot;
+		}
+		blocks.push_back(pBlock);
+		allocatedBytes += sizeof(T)*objectCount;
+		blockUsed = 0;
+		blockCapacity = objectCount;
+		if (nextBlockSize < MaxBlockSize) nextBlockSize = nextBlockSize*2 < MaxBlockSize ? nextBlockSize*2 : MaxBlockSize;
+	}
+
+	std::vector<char*> blocks; //all blocks from the system. New objects come from the end of the last one.
+	FreeSlot* freeList; //released storage, most recent first
+	int blockUsed, blockCapacity; //objects handed out from and held by the last block
+	int nextBlockSize; //objects in the next block
+	int liveCount; //objects currently allocated
+	size_t allocatedBytes;
+};
+
+#endif //OBJECTPOOL_H
@@ -25,7 +25,7 @@ updateContactForce() is called to calculate the repelling force. This force is r
 class CVX_Collision
 {
 public:
-	CVX_Collision(CVX_Voxel* v1, CVX_Voxel* v2); //!< Constructor taking the two voxels to watch for collision between. The order is irrelevant. @param[in] v1 One voxel @param[in] v2 The other voxel
+	CVX_Collision(CVX_Voxel* v1, CVX_Voxel* v2, const Vec3D<double>& v2FrameOffset = Vec3D<double>()); //!< Constructor taking the two voxels to watch for collision between. The order is irrelevant. @param[in] v1 One voxel @param[in] v2 The other voxel @param[in] v2FrameOffset Position of the coordinate frame of v2 relative to that of v1. Non-zero only if the two voxels belong to different CVoxelyze bodies of a CVX_Scene.
 	CVX_Collision& operator=(const CVX_Collision& col); //!< Overload "=" operator.
 	CVX_Collision(const CVX_Collision& col) {*this = col;} //!< copy constructor.
 
@@ -34,6 +34,7 @@ public:
 
 	CVX_Voxel* voxel1() const {return pV1;} //!<One voxel of this potential collision pair.
 	CVX_Voxel* voxel2() const {return pV2;} //!<The other voxel of this potential collision pair.
+	Vec3D<double> frameOffset() const {return v2Offset;} //!<The position of voxel2()'s coordinate frame relative to voxel1()'s coordinate frame. Zero unless the voxels belong to different bodies.
 
 	static float envelopeRadius; //!<The collision envelope radius that these two voxels collide at. Even though voxels are cubic, a spherical collision envelope is used for computation efficiency. Values are multiplied by the length of an edge of the voxel to determine the actual collision radius. Values less than 0.5 or greater than 0.866 are probably of limited use. Prefer around 0.625 (default).
 
@@ -42,6 +43,7 @@ private:
 	float penetrationStiff; //in N/m for these two voxels
 	float dampingC; //damping factor for these two voxels
 	Vec3D<float> force;
+	Vec3D<double> v2Offset; //offset of pV2's frame from pV1's frame
 };
 
 #endif //VX_COLLISION_H
@@ -0,0 +1,54 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#ifndef VX_HEIGHTFIELD_H
+#define VX_HEIGHTFIELD_H
+
+#include "Vec3D.h"
+#include <vector>
+
+//!Defines a static terrain surface as a regular grid of heights.
+/*!Heights are specified at the nodes of a regular grid in the XY plane with spacing() meters between nodes. Node (0,0) is located at (originX(), originY()). The terrain height anywhere on the grid is bilinearly interpolated from the four surrounding nodes. Beyond the edges of the grid the height of the nearest edge is extended outwards.
+
+A heightfield with no nodes is a flat plane at Z=0.
+
+A heightfield is used as the floor of a CVoxelyze object with CVoxelyze::setTerrain(). Contact is resolved against the plane tangent to the terrain directly below each voxel, so the terrain should be smooth relative to the voxel size.
+*/
+class CVX_Heightfield
+{
+public:
+	CVX_Heightfield(int xCount = 0, int yCount = 0, double spacing = 0.001, double originX = 0.0, double originY = 0.0); //!< Constructor. All heights are initialized to zero. @param[in] xCount Number of grid nodes in the X direction. @param[in] yCount Number of grid nodes in the Y direction. @param[in] spacing Distance between adjacent grid nodes in meters. @param[in] originX X location of node (0,0) in meters. @param[in] originY Y location of node (0,0) in meters.
+
+	void resize(int xCount, int yCount); //!< Changes the number of grid nodes. All heights are reset to zero. @param[in] xCount Number of grid nodes in the X direction. @param[in] yCount Number of grid nodes in the Y direction.
+	int xCount() const {return xNodes;} //!< Returns the number of grid nodes in the X direction.
+	int yCount() const {return yNodes;} //!< Returns the number of grid nodes in the Y direction.
+
+	void setSpacing(double spacing) {if (spacing > 0) step = spacing;} //!< Sets the distance between adjacent grid nodes. @param[in] spacing Distance in meters. Must be positive.
+	double spacing() const {return step;} //!< Returns the distance between adjacent grid nodes in meters.
+	void setOrigin(double originX, double originY) {x0 = originX; y0 = originY;} //!< Sets the location of node (0,0). @param[in] originX X location in meters. @param[in] originY Y location in meters.
+	double originX() const {return x0;} //!< Returns the X location of node (0,0) in meters.
+	double originY() const {return y0;} //!< Returns the Y location of node (0,0) in meters.
+
+	void setHeight(int xIndex, int yIndex, float height) {heights[yIndex*xNodes + xIndex] = height;} //!< Sets the height of a grid node. @param[in] xIndex X index of the node. Valid range from 0 to xCount()-1. @param[in] yIndex Y index of the node. Valid range from 0 to yCount()-1. @param[in] height Height in meters.
+	float height(int xIndex, int yIndex) const {return heights[yIndex*xNodes + xIndex];} //!< Returns the height of a grid node in meters. @param[in] xIndex X index of the node. Valid range from 0 to xCount()-1. @param[in] yIndex Y index of the node. Valid range from 0 to yCount()-1.
+
+	double height(double x, double y) const; //!< Returns the interpolated terrain height in meters at the specified location. @param[in] x X location in meters. @param[in] y Y location in meters.
+	Vec3D<double> normal(double x, double y) const; //!< Returns the upward unit normal of the terrain at the specified location. @param[in] x X location in meters. @param[in] y Y location in meters.
+	void sample(double x, double y, double* pHeight, Vec3D<double>* pNormal) const; //!< Returns both the interpolated terrain height and upward unit normal at the specified location with a single lookup. @param[in] x X location in meters. @param[in] y Y location in meters. @param[out] pHeight Height in meters. @param[out] pNormal Upward unit normal.
+
+private:
+	int xNodes, yNodes;
+	double step;
+	double x0, y0;
+	std::vector<float> heights; //x-fastest
+};
+
+#endif //VX_HEIGHTFIELD_H
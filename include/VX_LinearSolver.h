@@ -13,8 +13,15 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 #define CVX_LINEARSOLVER_H
 
 class CVoxelyze;
+class CVX_Link;
+#include "Quat3D.h"
+#include "VX_LoadCase.h"
 #include <string>
 #include <vector>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <functional>
 
 #ifdef PARDISO_5
 #ifdef _WIN32
@@ -28,30 +35,74 @@ extern "C" void pardiso (void* pt, int* maxfct, int* mnum, int* mtype, int* phas
 /*!
 Although voxelyze is fundamentally a dynamic non-linear materials simulator, sometimes a linear solution is still appropriate for a given problem. This class provides the means to do a one-time linear solve of the system in far less time than the equivalent doTimeStep() sequence.
 
-The simulation is currently always linearized about the voxels' nominal positions, so only the elastic modulus of materials is used. Density, poissons ratio, etc. are all disregarded.
+solve() linearizes the simulation about the voxels' nominal positions, so only the elastic modulus of materials is used. Density, poissons ratio, etc. are all disregarded.
 
-Currently only the pardiso solver is supported, although other more permissive solvers are in the works. See www.pardiso-project.com for the appropriate license (free for academic use) and libraries. Define PARDISO_5 in the preprocessor to compile in this pardiso support.
+Two families of solvers are available. The pardiso direct solver requires a license (free for academic use) and libraries from www.pardiso-project.com. Define PARDISO_5 in the preprocessor to compile in this pardiso support. The built-in DIRECT solver needs no license: it orders the voxels by nested dissection of the voxel lattice and factors the stiffness matrix in dense supernodal blocks. It is robust for stiff or poorly conditioned problems but its memory use grows much faster than the number of voxels for large 3D structures. The built-in preconditioned conjugate gradient solvers have no external dependencies. They never form the stiffness matrix: each iteration applies the beam stiffness of every link directly to the current displacement vector, so memory use grows only with the number of voxels. CG_MULTIGRID takes advantage of the regular voxel lattice to keep the number of iterations nearly constant as the structure grows. Use the USE_OMP preprocessor flag to run them in parallel.
 
-Because solver execution time can be lengthy, a rudimentary set of status variables is maintained during the solve process. They can be accessed safely while the process is running. Likewise cancelFlag can be set to true and the solver will abort execution as soon as it can. Note that this can still be a lengthy wait.
+solveNonlinear() extends the built-in solvers to large deformations and nonlinear materials. The loads are applied in increments and each increment is brought to equilibrium by Newton-Raphson iteration: the out of balance forces are found with the same link calculations as doTimeStep() and each correction is solved with the tangent stiffness of the deformed structure. The tangent is the beam stiffness of each link turned to its current orientation, with the axial stiffness taken from the slope of the material's stress/strain curve at the link's current strain and the sideways stiffening (or softening) caused by the axial force the link carries. Increments after the first start from the previous increment repeated, and a correction that makes the out of balance forces much worse is cut back. The voxel ordering, sparsity structure and multigrid hierarchy are shared by every iteration, so only the numeric factorization (or preconditioner) is rebuilt.
+
+solveModes() finds the natural frequencies and mode shapes of the structure from the same nominal stiffness and the lumped mass (and rotational inertia) of each voxel. The highest frequency is found by Lanczos iteration on the stiffness matrix directly, and the highest damping rate likewise on the damping matrix. The lowest frequencies use shift-invert Lanczos iteration, where each step is one solve with the chosen solver's cached factorization (or preconditioner).
+
+Because solver execution time can be lengthy, a rudimentary set of status variables is maintained during the solve process. solveAsync() runs solve() on a background thread so that the caller can carry on with other work. progressTick and progressMessage() can be read from any thread while a solve is running, and each phase of the solve (ordering, factorization or preconditioning, the solve itself) advances progressTick in proportion to its share of the work. Likewise cancelFlag can be set to true from any thread and the solver will abort execution with errorMsg set as soon as it can: between phases, between conjugate gradient iterations, between supernodes of the DIRECT factorization and between Newton or Lanczos iterations. Pardiso cannot be interrupted during one of its own phases, so this can still be a lengthy wait. The linked voxelyze object must not be modified (and no other solve started) until a solve has finished.
 */
 class CVX_LinearSolver
 {
 public:
+	//! The method used to solve the linear system
+	enum solverType {
+		AUTO, //!< Pardiso if voxelyze was built with PARDISO_5 defined, otherwise CG_MULTIGRID.
+		PARDISO, //!< Pardiso direct sparse solver. Requires PARDISO_5 and a pardiso license and library.
+		CG_JACOBI, //!< Built-in matrix-free conjugate gradient preconditioned with the inverse diagonal of the stiffness matrix.
+		CG_BLOCK_JACOBI, //!< Built-in matrix-free conjugate gradient preconditioned with the inverse 6x6 stiffness block of each voxel. Usually converges in far fewer iterations than CG_JACOBI.
+		CG_MULTIGRID, //!< Built-in matrix-free conjugate gradient preconditioned with one multigrid V-cycle. Coarse levels are formed by aggregating 2x2x2 blocks of the level below into a single rigid node. The number of iterations grows only slowly with the size of the structure, so this is the fastest choice for large problems.
+		DIRECT //!< Built-in sparse LDL^T direct solver. The voxels are ordered by recursively splitting the structure with single lattice layers (nested dissection) and the factorization is carried out on dense supernodes. Requires no external libraries and is insensitive to conditioning, but needs far more memory than the conjugate gradient solvers for large 3D structures.
+	};
+
 	CVX_LinearSolver(CVoxelyze* voxelyze); //!< Links to a voxelyze object and initializes the solver. The pointer to the voxelyze object must remain valid for the lifetime of this object. @param[in] voxelyze pointer to the voxelyze object to simulate.
-	bool solve(); //!< Formulates and solves the linear system and writes the resulting voxel positions and angles back to the linked voxelyze object. Returns false if the solver errors out. (check errorMsg for the reason). NOTE: calling this function modifies the state of the linked voxelyze object! This function may take a while if there are a large number of voxels.
+	~CVX_LinearSolver(); //!< Destructor. Releases any cached factorization.
+	bool solve(solverType type = AUTO); //!< Formulates and solves the linear system and writes the resulting voxel positions and angles back to the linked voxelyze object. Returns false if the solver errors out. (check errorMsg for the reason). NOTE: calling this function modifies the state of the linked voxelyze object! This function may take a while if there are a large number of voxels. Work from the previous solve is reused where possible: the sparsity structure and pardiso symbolic analysis are kept until voxels are added or removed, and the numeric factorization (or conjugate gradient preconditioner) is kept until stiffnesses or fixed degrees of freedom change. If only loads change just the final solve is repeated. @param[in] type The solution method to use.
+	std::future<bool> solveAsync(solverType type = AUTO); //!< Starts solve() on a background thread and returns immediately. The returned future holds the result of solve() once it is done. The voxelyze object is only written to at the very end of a successful solve. Until then use progressTick and progressMessage() to follow the solve and cancelFlag to abort it. Keep the future: destroying it waits for the solve to finish. @param[in] type The solution method to use.
+	bool solve(std::vector<CVX_LoadCase>& loadCases, solverType type = AUTO); //!< Solves several load cases of the same structure with a single factorization (or conjugate gradient preconditioner). Pardiso solves all the cases together in one multiple right-hand side pass while the conjugate gradient solvers iterate on each case in turn. Results are stored in each CVX_LoadCase and the linked voxelyze object is not modified. Which degrees of freedom are fixed is taken from the voxels' externals. Returns false if the solver errors out (check errorMsg for the reason). @param[in,out] loadCases The loads and prescribed displacements of each case. On success each case holds its resulting displacements. @param[in] type The solution method to use.
+	bool solveNonlinear(int loadSteps = 10, solverType type = AUTO); //!< Finds the static equilibrium of the linked voxelyze object including large deformations and nonlinear materials, and writes the resulting voxel positions and angles back to it. Like solve() the current state of the voxelyze object is discarded: the solution starts from the nominal voxel positions with no plastic deformation. External forces, moments, gravity and prescribed displacements are ramped up together in loadSteps equal increments, so nonlinear materials are loaded along the same path as if the loads were applied slowly. The floor and collisions are not considered. Returns false if an increment does not converge within maxNewtonIterations or the linear solver errors out (check errorMsg for the reason). In that case the voxelyze object is left at the last converged increment. @param[in] loadSteps The number of load increments. More increments are needed for strongly nonlinear problems. @param[in] type The solution method for each Newton correction. The pardiso matrix only holds the axis aligned nominal stiffness, so PARDISO (or AUTO if pardiso is compiled in) uses the built-in DIRECT solver instead.
+	bool solveModes(int modeCount = 6, bool modeShapes = false, solverType type = AUTO); //!< Modal analysis of the linked voxelyze object, which is not modified. Finds highestFrequency, highestDamping and the modeCount lowest natural frequencies (modeFrequencies) of the voxels' masses and rotational inertias on the nominal link stiffnesses. Fixed degrees of freedom are held at zero. Structures that are not fixed have six zero frequency rigid body modes. Returns false if the solver errors out (check errorMsg for the reason). @param[in] modeCount The number of lowest frequency modes to find. Zero finds only highestFrequency, which is much quicker. @param[in] modeShapes If true the shape of each of the lowest modes is kept for modeTranslation() and modeRotation(). @param[in] type The solution method used to invert the stiffness matrix for the lowest modes.
+	Vec3D<double> modeTranslation(int mode, int voxelIndex) const; //!< Returns the displacement of a voxel in one of the mode shapes found by the last solveModes(). Mode shapes are scaled to unit modal mass. @param[in] mode The index of the mode in modeFrequencies. @param[in] voxelIndex The index of the voxel as in CVoxelyze::voxel(int).
+	Vec3D<double> modeRotation(int mode, int voxelIndex) const; //!< Returns the rotation vector of a voxel in one of the mode shapes found by the last solveModes(). @param[in] mode The index of the mode in modeFrequencies. @param[in] voxelIndex The index of the voxel as in CVoxelyze::voxel(int).
+	void reset(); //!< Discards all cached structure and factorizations so the next solve() starts from scratch.
+
+	//parameters for the iterative solvers
+	double tolerance; //!< The conjugate gradient solvers stop once the residual force norm has been reduced by this factor from its initial value. Default 1e-8.
+	int maxIterations; //!< The conjugate gradient solvers give up after this many iterations. If zero or less (default) a limit of the number of degrees of freedom is used.
+	int iterations; //!< The number of iterations the last conjugate gradient solve took. The largest of any load case.
+	int multigridLevels; //!< The number of levels (including the voxels themselves) used by the last CG_MULTIGRID solve.
+	int analysisCount; //!< The number of times the structure of the problem (voxel connectivity, sparsity pattern and pardiso symbolic analysis) has been built by this solver.
+	int factorizationCount; //!< The number of times the pardiso or DIRECT numeric factorization or conjugate gradient preconditioner has been built by this solver.
+	double relativeResidual; //!< The residual force norm at the end of the last conjugate gradient solve relative to its initial value. The largest of any load case.
+
+	//parameters for the nonlinear solver
+	double newtonTolerance; //!< solveNonlinear() considers an increment converged once the largest out of balance force on any free degree of freedom (or moment divided by the voxel size) falls below this fraction of the largest applied load or link force. Default 1e-6.
+	int maxNewtonIterations; //!< solveNonlinear() gives up if an increment takes more Newton iterations than this. Default 50.
+	int newtonIterations; //!< The total number of Newton iterations (and therefore linear solves) the last solveNonlinear() took over all increments.
+
+	//results of the modal analysis
+	std::vector<double> modeFrequencies; //!< The lowest natural frequencies (Hz) found by the last solveModes(), in ascending order.
+	double highestFrequency; //!< The highest natural frequency (Hz) found by the last solveModes(). This sets the largest stable time step of the dynamic simulation.
+	double highestDamping; //!< The fastest damping rate (1/s) of any motion of the structure found by the last solveModes(): the largest eigenvalue of the inverse mass times the internal (link) and global damping of the materials. Zero if the materials are undamped. Together with highestFrequency this sets the largest stable time step.
 
 	//parameters to get information during the solving process
-	int progressTick; //!< An arbitrary progress number somewhere between zero and progressMaxTick to be used updating a progress bar.
+	std::atomic<int> progressTick; //!< An arbitrary progress number somewhere between zero and progressMaxTick to be used updating a progress bar. Safe to read from any thread.
 	int progressMaxTick; //!< An arbitrary maximum for progress bars.
-	std::string progressMsg; //!< A message indicating the current status of the solver
+	std::string progressMsg; //!< A message indicating the current status of the solver. Use progressMessage() instead while a solve is running on another thread.
+	std::string progressMessage() const; //!< Returns a copy of progressMsg. Safe to call from any thread.
+	std::function<void(float, const std::string&)> progressCallback; //!< If set, called with the fraction done (0 to 1) and the new progress message whenever the solve moves on to a new phase. Runs on the thread doing the solve, so it may set cancelFlag to stop the solve at that point. Must not be changed while a solve is running.
 	std::string errorMsg; //!< If an error occurs the reason will be found here.
-	bool cancelFlag; //!< A user-settable flag to indicate to the solver that an abort has been request during a solve process. May still not stop immediately, though.
+	std::atomic<bool> cancelFlag; //!< A user-settable flag to indicate to the solver that an abort has been request during a solve process. May still not stop immediately, though. Safe to set from any thread. Cleared when each solve starts.
 
 private: //off limits variable and functions (internal)
 	CVoxelyze* vx;
 	int dof; //degrees of freedom in the problem
-	std::vector<double> a, b, x;
+	std::vector<double> a, b, x; //b and x hold one column of dof values per load case
 	std::vector<int> ia, ja; //row index (1 based!), columns each value is in (1-based!)
+	std::vector<int> linkSlot; //for each link direction of each voxel, the rank of the adjacent voxel among all higher-indexed neighbors (-1 if lower-indexed or no link)
 
 	//Pardiso variables:
 	int mtype; //defines matrix type
@@ -61,16 +112,123 @@ private: //off limits variable and functions (internal)
 	double dparm[64];
 	int maxfct, mnum, phase, error, msglvl;
 
+	//cached state between solves
+	unsigned int cachedTopology; //CVoxelyze::topologyCount the structure was built for
+	bool structureValid; //adjacent is up to date
+	bool patternValid; //ia and ja are up to date
+	bool pardisoAnalyzed; //pardiso holds a symbolic analysis of the current pattern
+	bool factorValid; //the numeric factorization or preconditioner matches factoredType, factoredStiffness and factoredFixed
+	solverType factoredType;
+	std::vector<float> factoredStiffness; //link stiffness constants the preconditioner was built from
+	std::vector<bool> factoredFixed; //fixed degrees of freedom the preconditioner was built from
+	std::vector<double> aFactored; //matrix values of the current pardiso numeric factorization
+
+	//matrix-free conjugate gradient variables:
+	std::vector<int> adjacent; //index of the adjacent voxel in each of the 6 link directions of each voxel (-1 if none)
+	std::vector<CVX_Link*> voxLinks; //the link in each of the 6 link directions of each voxel (NULL if none)
+	std::vector<bool> fixedDof; //is each degree of freedom fixed or prescribed?
+	std::vector<double> precond; //inverse diagonal (6 per voxel) or inverse diagonal block (36 per voxel) of the stiffness matrix
+	std::vector<double> r, z, p, q; //conjugate gradient work vectors
+
+	//modal analysis
+	double massShift; //the matrix solved is K+massShift*M, so that the rigid body modes of structures that are not fixed do not make it singular
+	bool dampingMode; //modalOperator() applies M^-1*C instead of M^-1*K
+	std::vector<double> lumpedMass; //mass or moment of inertia of each degree of freedom
+	std::vector<double> shapes; //dof values of each mode shape found by solveModes()
+
+	//tangent stiffness of each link during solveNonlinear(). Empty for the nominal linear stiffness.
+	struct linkTangent {
+		double a1; //axial stiffness from the slope of the stress/strain curve
+		double geometric; //axial force over length: the sideways stiffness due to tension
+		Quat3D<double> rot; //current orientation of the link
+	};
+	std::vector<linkTangent> tangents; //for each link direction of each voxel, like voxLinks
+
+	//multigrid hierarchy. Level 0 is the voxels themselves (matrix-free), each coarser node is the rigid aggregate of up to 2x2x2 nodes of the level below.
+	struct mgLevel {
+		int count; //number of nodes
+		std::vector<int> coord; //integer lattice coordinates (3 per node)
+		std::vector<double> pos; //center location of each node (3 per node)
+		std::vector<int> parent; //index of the node in the next coarser level this node belongs to
+		std::vector<int> childStart, child; //nodes of the next finer level belonging to each node (compressed rows, levels > 0)
+		std::vector<int> rowStart, col; //block sparse stiffness structure (levels > 0)
+		std::vector<double> blocks; //6x6 stiffness blocks (levels > 0)
+		std::vector<double> diag; //factored 6x6 diagonal blocks for smoothing (levels > 0)
+		double omega; //smoother damping
+		std::vector<double> b, x, r; //right hand side, solution and residual work vectors
+	};
+	std::vector<mgLevel> levels;
+	std::vector<double> coarseFactor; //dense factorization of the coarsest level
+
+	//built-in direct solver. Whole voxels (6 degrees of freedom) are eliminated in nested dissection order. Consecutive voxels whose columns of L share the same structure form a supernode stored as one dense block.
+	bool directAnalyzed; //ordering and supernode structure are up to date
+	std::vector<int> elimOrder, elimPos; //voxel index at each elimination position and vice versa
+	std::vector<int> snFirst; //first elimination position of each supernode (plus one extra at the end)
+	std::vector<int> snRowStart, snRows; //elimination positions of the voxels below the diagonal block of each supernode (compressed rows, ascending)
+	std::vector<int> snParent; //supernode that receives the schur complement of each supernode (-1 if none)
+	std::vector<size_t> snFactorStart; //offset of each supernode's block in directFactor
+	std::vector<double> directFactor; //column major 6*voxels by 6*(voxels+rows below) block of unit lower triangular L per supernode with D stored on the diagonal
+
 	//functions
-	void calculateA(); //calculates the a (stiffness) matrix!
-	void addAValue(int row, int column, float value);
-	void consolidateA(); //gets rid of all the zeros for solving!
-	void applyBX(); //apply forces and fixe boundary conditions
+	bool prepare(solverType& type); //resolves AUTO and updates the cached structure. Returns false if there is nothing to solve.
+	bool solvePardiso(); //forms the full stiffness matrix and solves it with pardiso
+	bool solveSystem(solverType type); //solves b and x with the chosen method
+	bool solveCG(solverType type); //solves with matrix-free preconditioned conjugate gradient
+	bool iterateCG(solverType type, const double* bCase, double* xCase); //conjugate gradient iterations for a single right hand side with the current preconditioner
+	void buildAdjacency(bool structure); //fills voxLinks, and also adjacent if structure is true
+	void setupBoundaryConditions(const std::vector<CVX_LoadCase>* loadCases); //fills fixedDof from the externals and b and x from either the externals (loadCases is NULL) or each load case
+	void linkStiffness(std::vector<float>& stiffness); //gathers the beam constants (and tangent, if any) of every link
+	void multiplyA(const std::vector<double>& in, std::vector<double>& out); //out = A*in for the free degrees of freedom. Fixed degrees of freedom of out are zeroed.
+	static void linkProduct(const CVX_Link* pL, const linkTangent* pT, const double* xNeg, const double* xPos, double* out, bool negative); //adds the stiffness of link pL (turned to pT's tangent if not NULL) times the displacements of its two voxels to the 6 values of out for one of its voxels
+	static void beamProduct(double a1, double a2, double b1, double b2, double b3, const Vec3D<double>& d1, const Vec3D<double>& t1, const Vec3D<double>& d2, const Vec3D<double>& t2, bool negative, Vec3D<double>& f, Vec3D<double>& m); //beam stiffness with the given constants times the displacements and rotations of both ends of a link along +X, for one of its ends
+	void multiplyC(const std::vector<double>& in, std::vector<double>& out); //out = C*in (the symmetric part of the nominal internal and global damping) for the free degrees of freedom. Fixed degrees of freedom of out are zeroed.
+	static void linkDampingProduct(const CVX_Link* pL, const double* vNeg, const double* vPos, double* out, bool negative); //adds the symmetric part of the local damping of link pL times the velocities of its two voxels to the 6 values of out for one of its voxels
+	void setupPreconditioner(solverType type);
+	void applyPreconditioner(const std::vector<double>& in, std::vector<double>& out, solverType type);
+	void voxelBlocks(int index, double* diag, double* offDiag); //6x6 stiffness block of voxel index with itself (diag) and with each of its 6 possible neighbors (offDiag, 36 per direction)
+
+	void setupMultigrid(); //builds the coarse levels and smoothers (requires setupBoundaryConditions() and the CG_BLOCK_JACOBI preconditioner first)
+	void coarsen(int level); //aggregates level into a new coarser level with galerkin stiffness
+	void levelMultiply(int level, const std::vector<double>& in, std::vector<double>& out);
+	void smooth(int level, bool zeroStart); //one damped block jacobi sweep on levels[level].x. If zeroStart x is assumed to be zero.
+	void vCycle(int level); //approximately solves levels[level] for x given b
+	double estimateMaxEigenvalue(int level); //largest eigenvalue of the block jacobi preconditioned stiffness
+	static void rigidTransfer(const double* r, double* P); //6x6 matrix mapping the rigid motion of a coarse node to a fine node offset by r
+	static void factorSymmetric(int n, double* A); //in-place LDL^T of a symmetric positive semi-definite matrix. Pivots that vanish are dropped.
+	static void solveSymmetric(int n, const double* LD, double* x); //solves with the result of factorSymmetric() in place
+
+	bool solveDirect(); //solves with the built-in supernodal LDL^T factorization
+	void analyzeDirect(); //nested dissection ordering and symbolic factorization
+	void dissect(std::vector<int>& nodes, int begin, int end); //appends the nested dissection order of the voxels in nodes[begin, end) to elimOrder
+	bool factorDirect(); //multifrontal numeric factorization. Returns false if the stiffness matrix is singular or the solve was cancelled.
+	void solveDirectFactor(double* v); //solves L*D*L^T*v = v in place with the current factorization
+
+	bool lanczos(solverType type, bool invert, int wanted, std::vector<double>& values, std::vector<double>* vectors); //finds the wanted largest eigenvalues (and optionally eigenvectors) of M^-1*K (M^-1*C in dampingMode), or of (K+massShift*M)^-1*M if invert, on the free degrees of freedom. If invert the whole basis is kept (for full reorthogonalization) and a block of vectors is used so that repeated eigenvalues are found.
+	bool modalOperator(solverType type, bool invert, int count, const double* in, double* out); //applies M^-1*K (M^-1*C in dampingMode), or (K+massShift*M)^-1*M if invert, to count vectors
+	void massOrthonormalize(int count, double* block, const double* basis, int basisCount, double* R); //makes a block of count vectors M-orthonormal to each other and to basisCount basis vectors such that block(in) = block(out)*R, up to the part in the basis. Dependent vectors are replaced.
+	static void symmetricEigen(int n, double* A, double* values); //eigenvalues (ascending) and eigenvectors (overwriting the columns of the row major A) of a dense symmetric matrix by Householder reduction and tridiagonalEigen()
+	static void tridiagonalEigen(int n, double* d, double* e, double* z); //eigenvalues (ascending, into d) of a symmetric tridiagonal matrix with diagonal d and sub-diagonal e[1..n-1] by implicit QL iteration. The rotations are accumulated into the columns of the row major n by n z if not NULL.
+
+	bool linearSolve(solverType type); //solve() without clearing cancelFlag first
+
+	void calculatePattern(); //builds the exact upper triangular CSR structure (ia, ja) of the stiffness matrix
+	void calculateA(); //calculates the a (stiffness) matrix values in a single pass directly into their slots of the CSR structure
+	void releasePardiso(); //frees pardiso's internal memory
+	void applyBX(); //moves prescribed displacements of every load case to the right hand side and decouples the fixed degrees of freedom
 	void convertTo1Base(); //convert to 1-based indices for pardiso:
+	void convertTo0Base(); //and back again
 	void postResults(); //overwrites state of voxelyze object with the results
+
+	double nonlinearResidual(double loadFactor, const std::vector<float>& maxStrain, const std::vector<float>& strainOffset); //updates the links from the current voxel state and fills the first column of b with the out of balance forces under loadFactor of the applied loads. Returns the largest out of balance force relative to the largest applied load or link force.
+	void saveVoxelState(std::vector<Vec3D<double> >& pos, std::vector<Quat3D<double> >& orient); //copies the position and orientation of every voxel
+	void applyCorrection(const std::vector<Vec3D<double> >& pos, const std::vector<Quat3D<double> >& orient, double scale, bool snapFixed); //moves every voxel to pos and orient plus scale times the correction in x. If snapFixed the prescribed degrees of freedom are set exactly.
+	void updateTangents(); //fills tangents from the current link strains and orientations
 	void OutputMatrices(); //for debugging small system only!!
 
-	void updateProgress(float percent, std::string message) {progressTick=(int)(percent*100), progressMsg = message;} //percent 0-1.0
+	mutable std::mutex progressMutex; //guards progressMsg
+	void updateProgress(float percent, const std::string& message); //percent 0-1.0
+
+	friend class CVX_LinearSolverTest; //lets the unit tests check the assembled stiffness matrix, which only pardiso uses otherwise
 };
 
 //http://www.eng.fsu.edu/~chandra/courses/eml4536/Chapter4.ppt
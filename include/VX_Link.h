@@ -86,6 +86,7 @@ private:
 
 	//linkAxis axis() {return ax;}
 	linkAxis axis;
+	int listIndex; //index of this link in the owning CVoxelyze link list, or -1 if not in a list
 
 	//beam parameters
 	float a1() const;
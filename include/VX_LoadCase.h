@@ -0,0 +1,62 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#ifndef VX_LOADCASE_H
+#define VX_LOADCASE_H
+
+#include "VX_External.h"
+#include <vector>
+#include <unordered_map>
+
+class CVX_Voxel;
+
+//! A set of loads and prescribed displacements for one linear analysis.
+/*!
+Load cases let CVX_LinearSolver::solve() evaluate many loadings of the same structure at once. The stiffness matrix is factored (or the conjugate gradient preconditioner built) a single time and then every case is solved with it.
+
+Which degrees of freedom are fixed is always taken from the voxels' externals so that all cases share one factorization. A load case only supplies the values: forces and moments on free degrees of freedom and prescribed displacements on fixed ones. Anything not set in the case is zero. The forces, moments and displacements in the voxels' externals are ignored.
+
+The results are kept in the load case itself and the voxels are left untouched. Results are indexed the same as CVoxelyze::voxel(int) at the time of the solve. Removing voxels moves others to new places in the voxel list, so results from before an edit may belong to different voxels afterwards: solve again after changing the structure.
+*/
+class CVX_LoadCase
+{
+public:
+	CVX_LoadCase() {} //!< Constructs an empty load case.
+	void clear(); //!< Removes all loads, prescribed displacements and results.
+
+	void setForce(CVX_Voxel* voxel, const Vec3D<float>& force) {load(voxel).force = force;} //!< Applies a force to a voxel in this load case. Has no effect in any fixed degrees of freedom. @param[in] voxel The voxel to load. @param[in] force Force in newtons.
+	void setForce(CVX_Voxel* voxel, float xForce, float yForce, float zForce) {setForce(voxel, Vec3D<float>(xForce, yForce, zForce));} //!< Convenience function for setForce(CVX_Voxel*, const Vec3D<float>&).
+	void setMoment(CVX_Voxel* voxel, const Vec3D<float>& moment) {load(voxel).moment = moment;} //!< Applies a moment to a voxel in this load case. Has no effect in any fixed degrees of freedom. @param[in] voxel The voxel to load. @param[in] moment Moment in newton-meters.
+	void setMoment(CVX_Voxel* voxel, float xMoment, float yMoment, float zMoment) {setMoment(voxel, Vec3D<float>(xMoment, yMoment, zMoment));} //!< Convenience function for setMoment(CVX_Voxel*, const Vec3D<float>&).
+	void setDisplacement(CVX_Voxel* voxel, dofComponent dof, double displacement); //!< Prescribes the displacement of a degree of freedom in this load case. Only has an effect if this degree of freedom is fixed in the voxel's external. @param[in] voxel The voxel to displace. @param[in] dof The degree of freedom in question. @param[in] displacement The displacement in meters (translational dofs) or radians (rotational dofs).
+	int loadCount() const {return (int)loads.size();} //!< Returns the number of voxels with loads or prescribed displacements in this case.
+
+	bool isSolved() const {return !result.empty();} //!< Returns true if this load case holds results from CVX_LinearSolver::solve().
+	Vec3D<double> displacement(int voxelIndex) const {if (!isSolvedVoxel(voxelIndex)) return Vec3D<double>(); const double* d = &result[6*voxelIndex]; return Vec3D<double>(d[0], d[1], d[2]);} //!< Returns the displacement in meters of a voxel from its nominal position for this load case, or zero if the case is not solved or voxelIndex is out of range. @param[in] voxelIndex The index of the voxel as in CVoxelyze::voxel(int) at the time of the solve. Removing voxels reorders the voxel list, so solve again after editing the structure.
+	Vec3D<double> angularDisplacement(int voxelIndex) const {if (!isSolvedVoxel(voxelIndex)) return Vec3D<double>(); const double* d = &result[6*voxelIndex+3]; return Vec3D<double>(d[0], d[1], d[2]);} //!< Returns the rotation of a voxel from its nominal orientation as a rotation vector in radians for this load case, or zero if the case is not solved or voxelIndex is out of range. @param[in] voxelIndex The index of the voxel as in CVoxelyze::voxel(int) at the time of the solve. Removing voxels reorders the voxel list, so solve again after editing the structure.
+
+private:
+	struct voxelLoad {
+		CVX_Voxel* voxel;
+		Vec3D<double> force, moment;
+		Vec3D<double> translation, rotation; //prescribed displacements
+	};
+	std::vector<voxelLoad> loads;
+	std::unordered_map<CVX_Voxel*, int> loadIndex; //index in loads of each voxel
+	voxelLoad& load(CVX_Voxel* voxel); //returns the load of a voxel, adding one if needed
+
+	std::vector<double> result; //6 per voxel
+	bool isSolvedVoxel(int voxelIndex) const {return voxelIndex >= 0 && 6*(size_t)voxelIndex < result.size();} //is there a result for this voxel index?
+
+	friend class CVX_LinearSolver;
+};
+
+#endif //VX_LOADCASE_H
@@ -48,6 +48,7 @@ protected:
 	
 	friend class CVoxelyze; //give the main simulation class full access
 	friend class CVX_Link; //give links direct access to parameters
+	friend class CVX_LinearSolver;
 };
 
 
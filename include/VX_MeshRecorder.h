@@ -0,0 +1,91 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#ifndef VX_MESH_RECORDER_H
+#define VX_MESH_RECORDER_H
+
+#include "VX_MeshRender.h"
+#include <vector>
+#include <fstream>
+
+//!Records the deforming mesh of a simulation over time into a single compact file.
+/*!The topology (quads and lines) of a CVX_MeshRender is written once when the file is opened. Each call to recordFrame() then appends only the vertex positions and any per-quad scalar fields of the current mesh.
+
+Vertex positions are quantized to a fixed precision (in meters) and stored as the difference from the quantized positions of the previous frame, packed into variable length integers. Since most vertices move only a small number of quantization steps between recorded frames this typically takes one or two bytes per coordinate. Every keyframeInterval frames the absolute quantized positions are stored instead so that any frame can be decoded without reading the whole file. Quantization error never accumulates: every decoded position is within half of the precision of the recorded one.
+
+When the recorder is closed a table of frame offsets is appended so that CVX_MeshReader can seek directly to any frame. A file that was never closed (for instance if the simulation crashed) can still be read; its frames are located by scanning.
+
+The topology of the mesh must not change while recording. If voxels are added or removed start a new file.
+*/
+class CVX_MeshRecorder
+{
+public:
+	CVX_MeshRecorder(); //!< Constructor.
+	~CVX_MeshRecorder(); //!< Destructor. Closes the file if open.
+
+	bool open(const char* filePath, const CVX_MeshRender& mesh, double precision = 1e-6, int fieldCount = 0, int keyframeInterval = 50); //!< Creates (or overwrites) a recording and writes the topology of the mesh. Returns false if the file could not be created. @param[in] filePath File path of the recording. @param[in] mesh The mesh to record. Its topology must remain constant for the duration of the recording. @param[in] precision The quantization step of vertex positions in meters. @param[in] fieldCount The number of scalar values per quad to be provided to each recordFrame() call. @param[in] keyframeInterval The number of frames between absolute (keyframe) records. Smaller values speed up random access at the expense of file size.
+	bool recordFrame(const CVX_MeshRender& mesh, float time = 0.0f, const float* quadFields = 0); //!< Appends the current vertex positions of the mesh as a new frame. Returns false if no file is open, the mesh topology has changed or the write failed. @param[in] mesh The mesh the recording was opened with, updated to the current state with CVX_MeshRender::updateMesh(). @param[in] time A time stamp for this frame. @param[in] quadFields If fieldCount was nonzero, an array of fieldCount values per quad in quad order (q1f1, q1f2, ... q2f1, ...).
+	bool close(); //!< Writes the frame index and closes the file. Returns false if the index could not be written.
+
+	bool isOpen() const {return file.is_open();} //!< Returns true if a recording is in progress.
+	int frameCount() const {return (int)frameOffsets.size();} //!< Returns the number of frames recorded so far.
+
+private:
+	std::ofstream file;
+	int vertCount, quadCount, fieldCount, keyframeInterval;
+	double precision;
+
+	std::vector<int> lastQuantized; //quantized vertex positions of the last frame
+	std::vector<unsigned char> buffer; //reused encoding buffer
+	std::vector<unsigned long long> frameOffsets;
+	std::vector<float> frameTimes;
+};
+
+//!Decodes meshes recorded by CVX_MeshRecorder.
+/*!After opening a recording the topology is available from quadList() and lineList() and the vertex positions of any frame can be decoded with readFrame(). Frames are most efficiently read in increasing order: each subsequent frame only needs to apply one set of differences to the previous one. Jumping to an arbitrary frame decodes forward from the closest preceding keyframe.
+*/
+class CVX_MeshReader
+{
+public:
+	CVX_MeshReader(); //!< Constructor.
+
+	bool open(const char* filePath); //!< Opens a recording and reads its topology and frame index. Returns false if the file could not be opened or is not a valid recording. @param[in] filePath File path of the recording.
+	void close(); //!< Closes the recording.
+
+	int frameCount() const {return (int)frameOffsets.size();} //!< Returns the number of frames in the recording.
+	int vertexCount() const {return vertCount;} //!< Returns the number of vertices in each frame.
+	int quadCount() const {return (int)quadIndices.size()/4;} //!< Returns the number of quads.
+	int fieldCount() const {return fields;} //!< Returns the number of scalar values per quad in each frame.
+	double precision() const {return quantum;} //!< Returns the quantization step of vertex positions in meters.
+	float frameTime(int frame) const {return frameTimes[frame];} //!< Returns the time stamp of a frame. @param[in] frame The frame index. Valid range from 0 to frameCount()-1.
+	const std::vector<int>* quadList() const {return &quadIndices;} //!< Returns a pointer to the quad vertex indices in the same format as CVX_MeshRender (q1v1, q1v2, q1v3, q1v4, q2v1, ...).
+	const std::vector<int>* lineList() const {return &lineIndices;} //!< Returns a pointer to the line vertex indices in the same format as CVX_MeshRender (l1v1, l1v2, l2v1, ...).
+
+	bool readFrame(int frame, std::vector<float>* vertices, std::vector<float>* quadFields = 0); //!< Decodes the vertex positions (and optionally per-quad fields) of a frame. Returns false if the frame is out of range or the file is corrupt. @param[in] frame The frame index. Valid range from 0 to frameCount()-1. @param[out] vertices Vertex positions in the same format as CVX_MeshRender (vx1, vy1, vz1, vx2, ...). @param[out] quadFields If not NULL, the fieldCount() values per quad that were recorded with this frame.
+
+private:
+	std::ifstream file;
+	int vertCount, fields, keyframeInterval;
+	double quantum;
+	std::vector<int> quadIndices, lineIndices;
+	std::vector<unsigned long long> frameOffsets;
+	std::vector<float> frameTimes;
+
+	int currentFrame; //the frame currentQuantized holds (-1 if none)
+	std::vector<int> currentQuantized;
+	std::vector<float> currentFields;
+	std::vector<unsigned char> buffer;
+
+	bool decodeFrame(int frame); //applies frame to currentQuantized
+	void scanFrames(unsigned long long start, unsigned long long end); //rebuilds the frame index of a recording that was not closed
+};
+
+#endif //VX_MESH_RECORDER_H
@@ -14,6 +14,7 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 
 #include "Voxelyze.h"
 #include <vector>
+#include <unordered_map>
 
 //! Voxelyze mesh visualizer
 /*!
@@ -31,18 +32,42 @@ public:
 		STATE_INFO //!< Display a color coded "head map" of the specified CVoxelyze::stateInfoType (displacement, kinetic energy, etc.)
 	};
 
-	CVX_MeshRender(CVoxelyze* voxelyzeInstance); //!< Initializes this mesh visualization with the specified voxelyze instance. This voxelyze pointer must remain valid for the duration of this object. @param[in] voxelyzeInstance The voxelyze instance to link this mesh object to.
+	CVX_MeshRender(CVoxelyze* voxelyzeInstance, bool mergeFaces = false); //!< Initializes this mesh visualization with the specified voxelyze instance. This voxelyze pointer must remain valid for the duration of this object. @param[in] voxelyzeInstance The voxelyze instance to link this mesh object to. @param[in] mergeFaces If true, coplanar exposed faces of same colored voxels are merged into larger quads. See setFaceMerging().
 	void generateMesh(); //!< Generates (or regenerates) this mesh from the linked voxelyze object. This must be called whenever voxels are added or removed in the simulation.
+	void setFaceMerging(bool mergeFaces); //!< Selects between one quad per exposed voxel face (false, the default) and a reduced mesh in which adjacent coplanar exposed faces of voxels with the same material color are greedily merged into rectangular quads (true). Regenerates the mesh if the mode changes. Merged quad corners are still positioned by averaging the deformed voxel corners that meet there, but each quad stays flat between its corners and takes its color from a single voxel, so merging is best suited to previews and exports with MATERIAL coloring. Large deformations may open small gaps where the corner of one quad lies along the edge of a larger neighbor. @param[in] mergeFaces Enables or disables face merging.
+	bool isFaceMerging() const {return merge;} //!< Returns true if coplanar faces are merged into larger quads. See setFaceMerging().
 	void updateMesh(viewColoring colorScheme = MATERIAL, CVoxelyze::stateInfoType stateType = CVoxelyze::DISPLACEMENT); //!< Updates the mesh according to the current state of the linked voxelyze object and the coloring scheme specified by the arguments. @param[in] colorScheme The coloring scheme. @param[in] stateType If colorScheme = STATE_INFO, this argument determines the state to color the object according to. Only kinetic energy, strain energy, displacement, and pressure are currently supported.
 
+	const std::vector<float>* vertexList() const {return &vertices;} //!< Returns a pointer to the current deformed vertex positions (vx1, vy1, vz1, vx2, vy2, vz2, ...).
+	const std::vector<int>* quadList() const {return &quads;} //!< Returns a pointer to the vertex indices of each quad (q1v1, q1v2, q1v3, q1v4, q2v1, ...) in counter-clockwise order.
+	const std::vector<int>* lineList() const {return &lines;} //!< Returns a pointer to the vertex indices of each line (l1v1, l1v2, l2v1, ...).
+
+	//! Defines the layout of each vertex in renderVertexList()
+	enum renderVertexLayout {
+		POSITION_OFFSET = 0, //!< Offset of the x, y, z position
+		NORMAL_OFFSET = 3, //!< Offset of the x, y, z unit normal
+		COLOR_OFFSET = 6, //!< Offset of the red, green, blue color in the range [0,1]
+		VERTEX_STRIDE = 9 //!< Number of floats per vertex
+	};
+	const std::vector<float>* renderVertexList() const {return &renderVertices;} //!< Returns a pointer to a render-ready buffer of interleaved vertices (x, y, z, nx, ny, nz, r, g, b, ...) laid out according to renderVertexLayout. Each quad has its own four vertices in the same order as quadList() so that it keeps a flat normal and color. The buffer is updated in place by updateMesh() and reallocated by generateMesh().
+	const std::vector<unsigned int>* renderIndexList() const {return &renderIndices;} //!< Returns a pointer to the triangle index buffer into renderVertexList(), six (two counter-clockwise triangles) per quad. This only changes when generateMesh() is called. See topologyVersion().
+	void renderDirtyRange(int* firstVertex, int* vertexCount) const {*firstVertex = dirtyFirst; *vertexCount = dirtyCount;} //!< Returns the range of vertices in renderVertexList() that were changed by the last call to updateMesh() or generateMesh(), so that only that part needs to be uploaded. @param[out] firstVertex The first changed vertex. @param[out] vertexCount The number of vertices in the range (zero if nothing changed).
+	int topologyVersion() const {return topology;} //!< Returns a number that is incremented each time generateMesh() rebuilds the mesh. Viewers may compare this to the previous value to decide whether renderIndexList() needs to be uploaded again and the buffers resized.
+
 	void saveObj(const char* filePath); //!< Save the current deformed mesh as an obj file to the path specified. Coloring is not supported yet. @param[in] filePath File path to save the obj file as. Creates or overwrites.
+	bool saveStl(const char* filePath); //!< Saves the current deformed mesh as a binary STL file. Each quad is split into two triangles that share its normal. The quad color is stored in the attribute bytes of each triangle in the common 15 bit (VisCAM/SolidView) convention. Returns false if the file could not be written. @param[in] filePath File path to save the stl file as. Creates or overwrites.
+	bool savePly(const char* filePath); //!< Saves the current deformed mesh as a binary little endian PLY file with shared vertices and one four sided face per quad. Each face carries its color (8 bits per channel) and normal. Returns false if the file could not be written. @param[in] filePath File path to save the ply file as. Creates or overwrites.
+	bool saveGlb(const char* filePath); //!< Saves the current deformed mesh as a binary glTF 2.0 (.glb) file. Each quad gets its own four vertices so that its flat normal and color (COLOR_0) are kept, and is drawn as two triangles. Returns false if there are no quads or the file could not be written. @param[in] filePath File path to save the glb file as. Creates or overwrites.
 	void glDraw(); //!< Executes openGL drawing commands to draw this mesh in an Open GL window if USE_OPEN_GL is defined.
 
 private:
 	CVoxelyze* vx;
+	bool merge; //merge coplanar faces
 
 	std::vector<float> vertices; //vx1, vy1, vz1, vx2, vy2, vz2, vx3, ...
-	std::vector<CVX_Voxel*> vertexLinks; //vx1NNN, vx1NNP, [CVX_Voxel::voxelCorner enum order], ... vx2NNN, vx2NNp, ... (null if no link) 
+	std::vector<int> vertexCorners; //vx1NNN, vx1NNP, [CVX_Voxel::voxelCorner enum order], ... vx2NNN, vx2NNp, ... index into corners of each voxel touching this vertex (-1 if no voxel)
+	std::vector<Vec3D<float> > corners; //v1NNN, v1NNP, ... v2NNN, ... deformed corner positions of each voxel, recalculated by every updateMesh()
+	std::vector<float> voxelValues; //the stateInfo value of each voxel for STATE_INFO coloring
 
 	std::vector<int> quads; //q1v1, q1v2, q1v3, q1v4, q2v1, q2v2, ... (ccw order)
 	std::vector<float> quadColors; //q1R, q1G, q1B, q2R, q2G, q2B, ... 
@@ -51,10 +76,19 @@ private:
 
 	std::vector<int> lines; //l1v1, l1v2, l2v1, l2v2, ...
 
+	std::vector<float> renderVertices; //q1v1x, q1v1y, q1v1z, q1v1nx, ... q1v1r, q1v1g, q1v1b, q1v2x, ... (VERTEX_STRIDE floats per vertex, 4 vertices per quad)
+	std::vector<unsigned int> renderIndices; //q1t1v1, q1t1v2, q1t1v3, q1t2v1, ... (two triangles per quad)
+	int dirtyFirst, dirtyCount; //range of render vertices changed by the last update
+	int topology; //incremented by generateMesh()
+	bool renderRebuilt; //render buffers reallocated since the last update
+
 	float jetMapR(float val) {if (val<0.5f) return 0.0f; else if (val>0.75f) return 1.0f; else return val*4-2;}
 	float jetMapG(float val) {if (val<0.25f) return val*4; else if (val>0.75f) return 4-val*4; else return 1.0f;}
 	float jetMapB(float val) {if (val>0.5f) return 0.0f; else if (val<0.25f) return 1.0f; else return 2-val*4;}
 
+	void addQuad(std::unordered_map<long long, int>* vIndMap, std::vector<long long>* vertexKeys, const Index3D* quadCorners, int voxIndex); //adds a quad with corners at the specified vertex lattice locations, creating vertices as needed
+	void generateMergedQuads(std::unordered_map<long long, int>* vIndMap, std::vector<long long>* vertexKeys);
+
 	float linkMaxColorValue(CVX_Voxel* pV, CVoxelyze::stateInfoType coloring); //for link properties, the max
 };
 #endif
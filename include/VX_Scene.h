@@ -0,0 +1,81 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#ifndef VX_SCENE_H
+#define VX_SCENE_H
+
+#include "Vec3D.h"
+#include <vector>
+
+class CVoxelyze;
+class CVX_Voxel;
+class CVX_Collision;
+
+//!Simulates several independent voxelyze objects that may collide with one another.
+/*!Each body in a scene is a complete CVoxelyze object with its own lattice, materials and settings. This keeps each body's CArray3D lookup compact even when the bodies are far apart. A body is placed in the scene with a translational origin: a voxel at position p in its own voxelyze object is at origin+p in the scene. Rotated origins are not supported.
+
+Contacts between voxels of different bodies are found with a shared broadphase (a uniform grid over the surface voxels of all bodies in scene coordinates) and resolved with regular CVX_Collision objects. Contacts between voxels of the same body are still handled by that body if CVoxelyze::enableCollisions() is set.
+
+Bodies are not owned by the scene. They must remain valid until they are removed with removeBody() or the scene is destroyed. Gravity, floor and all other environmental settings are evaluated by each body in its own coordinate system.
+
+Call doTimeStep() in place of CVoxelyze::doTimeStep() on the individual bodies.
+*/
+class CVX_Scene
+{
+public:
+	CVX_Scene(); //!< Constructs an empty scene.
+	~CVX_Scene(); //!< Destructor. Removes all bodies from the scene. The bodies themselves are not deleted.
+
+	void clear(); //!< Removes all bodies and contacts from this scene. The bodies themselves are not deleted.
+
+	bool addBody(CVoxelyze* body, const Vec3D<double>& origin = Vec3D<double>()); //!< Adds a voxelyze object to this scene. Returns false if body is null or already part of the scene. @param[in] body The voxelyze object to add. @param[in] origin The location of the body's coordinate system origin in the scene in meters.
+	bool removeBody(CVoxelyze* body); //!< Removes a voxelyze object from this scene and clears any scene contact forces acting on it. Returns false if body was not part of the scene. @param[in] body The voxelyze object to remove.
+	int bodyCount() const {return (int)bodies.size();} //!< Returns the number of bodies in this scene.
+	CVoxelyze* body(int bodyIndex) const {return bodies[bodyIndex].pVx;} //!< Returns a pointer to a body in this scene. @param[in] bodyIndex the current index of a body. Valid range from 0 to bodyCount()-1.
+
+	bool setBodyOrigin(CVoxelyze* body, const Vec3D<double>& origin); //!< Moves the origin of a body within this scene. Returns false if body is not part of this scene. @param[in] body The voxelyze object to move. @param[in] origin The new location of the body's origin in the scene in meters.
+	Vec3D<double> bodyOrigin(CVoxelyze* body) const; //!< Returns the location of a body's origin in this scene. Returns a zero vector if body is not part of this scene. @param[in] body The voxelyze object in question.
+
+	bool doTimeStep(float dt = -1.0f); //!< Updates inter-body contacts then executes a single timestep on each body. Returns false if any body diverged. @param[in] dt The timestep to take in seconds. The default value of -1.0f will use recommendedTimeStep().
+	float recommendedTimeStep() const; //!< Returns the smallest recommended timestep of all bodies in this scene.
+
+	const std::vector<CVX_Collision*>* contactList() const {return &contactsList;} //!< Returns a pointer to the current list of potential contacts between voxels of different bodies. voxel1() belongs to the body with the lower index. The frameOffset() of each contact is the origin of voxel2()'s body relative to the origin of voxel1()'s body.
+
+private:
+	struct sceneBody {
+		CVoxelyze* pVx;
+		Vec3D<double> origin;
+		unsigned int topology; //topologyCount of pVx when contacts were last generated
+	};
+	std::vector<sceneBody> bodies;
+	int bodyIndex(const CVoxelyze* body) const; //returns the index of body in bodies or -1 if not found
+
+	std::vector<CVX_Collision*> contactsList;
+	std::vector<int> contactBodies; //the index of the body of voxel1() and voxel2() of each contact in contactsList (2 per contact)
+	bool contactsStale;
+
+	struct gridEntry {
+		long long cell; //packed grid cell key
+		int body;
+		CVX_Voxel* pV;
+		Vec3D<double> pos; //scene position when contacts were last generated
+		bool operator<(const gridEntry& e) const {return cell<e.cell || (cell==e.cell && body<e.body);}
+	};
+	std::vector<gridEntry> grid; //surface voxels of all bodies sorted by cell
+
+	float watchRadius() const; //largest contact watch radius (in meters) of any body
+	void updateContacts();
+	void regenerateContacts();
+	void releaseContacts(); //deletes all contacts and zeroes the scene forces they contributed
+	void clearSceneForces(CVoxelyze* body, bool deallocate); //zeroes (or frees) the scene force of every voxel in body
+};
+
+#endif //VX_SCENE_H
@@ -17,8 +17,11 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 #include "VX_External.h"
 #include "VX_MaterialVoxel.h" //needed for inline of some "get" functions
 #include "VX_Collision.h"
+#include "ObjectPool.h"
 #include <list>
 
+class CVX_Heightfield;
+
 
 //!Defines a specific instance of a voxel and holds its current state.
 /*!The voxel class contains all information about a voxel's physical characteristics, state, and CVX_Link's to other adjacent voxels.
@@ -70,7 +73,7 @@ public:
 	CVX_MaterialVoxel* material() {return mat;} //!<Returns the linked material object containing the physical properties of this voxel.
 	
 	bool externalExists() {return ext?true:false;} //!< Returns true if this voxel has had its CVX_External object created. This does not mecessarily imply that this external object actually contains any fixes or forces.
-	CVX_External* external() {if (!ext) ext = new CVX_External(); return ext;} //!< Returns a pointer to this voxel's unique external object that contains fixes, forces, and/or displacements. Allocates a new empty one if it doesn't already exist. Use externalExists() to determine if external() has been previously called at any time.
+	CVX_External* external() {if (!ext) ext = extPool ? new (extPool->allocate()) CVX_External() : new CVX_External(); return ext;} //!< Returns a pointer to this voxel's unique external object that contains fixes, forces, and/or displacements. Allocates a new empty one if it doesn't already exist. Use externalExists() to determine if external() has been previously called at any time.
 
 
 	void timeStep(float dt); //!< Advances this voxel's state according to all forces and moments acting on it. Large timesteps will cause instability. Use CVoxelyze::recommendedTimeStep() to get the recommended largest stable timestep. @param[in] dt Timestep (in second) to advance.
@@ -81,6 +84,7 @@ public:
 	Vec3D<double> displacement() const {return (pos - originalPosition());} //!< Returns the 3D displacement of this voxel from its original location in meters (GCS)/
 	Vec3D<float> size() const {return cornerOffset(PPP)-cornerOffset(NNN);} //!< Returns the current deformed size of this voxel in the local voxel coordinates system (LCS). If asymmetric forces are acting on this voxel, the voxel may not be centered on position(). Use cornerNegative() and cornerPositive() to determine this information.
 	Vec3D<float> cornerPosition(voxelCorner corner) const; //!< Returns the deformed location of the voxel corner in the specified corner in the global coordinate system (GCS). Essentially cornerOffset() with the voxel's current global position/rotation applied.
+	void cornerPositions(Vec3D<float>* corners) const; //!< Returns the deformed locations of all 8 voxel corners in the global coordinate system (GCS) at once. Identical to calling cornerPosition() for each corner, but the strain of each link is only looked up once. @param[out] corners Array of 8 corner positions to fill in CVX_Voxel::voxelCorner order.
 	Vec3D<float> cornerOffset(voxelCorner corner) const; //!< Returns the deformed location of the voxel corner in the specified corner in the local voxel coordinate system (LCS). Used to draw the deformed voxel in the correct position relative to the position().
 	bool isInterior() const {return (boolStates & SURFACE)?true:false;} //!< Returns true if the voxel is surrounded by other voxels on its 6 coordinate faces. Returns false if 1 or more faces are exposed.
 	bool isSurface() const {return !isInterior();} //!< Convenience function to enhance code readibility. The inverse of isInterior(). Returns true 1 or more faces are exposed. Returns false if the voxel is surrounded by other voxels on its 6 coordinate faces.
@@ -116,10 +120,10 @@ public:
 
 	void haltMotion(){linMom = angMom = Vec3D<>(0,0,0);} //!< Halts all momentum of this block. Unless fixed the voxel will continue to move in subsequent timesteps.
 
-	void enableFloor(bool enabled) {enabled ? boolStates |= FLOOR_ENABLED : boolStates &= ~FLOOR_ENABLED;} //!< Enables this voxel interacting with the floor at Z=0. @param[in] enabled Enable interaction
-	bool isFloorEnabled() const {return boolStates & FLOOR_ENABLED ? true : false;} //!< Returns true of this voxel will interact with the floor at Z=0.
+	void enableFloor(bool enabled) {enabled ? boolStates |= FLOOR_ENABLED : boolStates &= ~FLOOR_ENABLED;} //!< Enables this voxel interacting with the floor at Z=0 (or the terrain of the owning CVoxelyze object if one has been set). @param[in] enabled Enable interaction
+	bool isFloorEnabled() const {return boolStates & FLOOR_ENABLED ? true : false;} //!< Returns true of this voxel will interact with the floor.
 	bool isFloorStaticFriction() const {return boolStates & FLOOR_STATIC_FRICTION ? true : false;} //!< Returns true if this voxel is in contact with the floor and stationary in the horizontal directions. This corresponds to that voxel being in the mode of static friction (as opposed to kinetic) with the floor.
-	float floorPenetration() const {return (float)(baseSizeAverage()/2 - mat->nominalSize()/2 - pos.z);} //!< Returns the interference (in meters) between the collision envelope of this voxel and the floor at Z=0. Positive numbers correspond to interference. If the voxel is not touching the floor 0 is returned.
+	float floorPenetration() const; //!< Returns the interference (in meters) between the collision envelope of this voxel and the floor at Z=0 (or the terrain directly below it). Positive numbers correspond to interference. Negative numbers are the clearance to the floor.
 
 	Vec3D<double> force(); //!< Calculates and returns the sum of the current forces on this voxel. This would normally only be called internally, but can be used to query the state of a voxel for visualization or debugging.
 	Vec3D<double> moment(); //!< Calculates and returns the sum of the current moments on this voxel. This would normally only be called internally, but can be used to query the state of a voxel for visualization or debugging.
@@ -150,6 +154,7 @@ private:
 	CVX_MaterialVoxel* mat;
 	short ix, iy, iz;
 	CVX_External* ext;
+	CObjectPool<CVX_External>* extPool; //pool to allocate ext from (owned by the CVoxelyze this voxel belongs to), or NULL to use new
 
 	void replaceMaterial(CVX_MaterialVoxel* newMaterial); //!<Replaces the material properties of this voxel (but not links) to this new CVX_Material. May cause unexpected behavior if certain material properties are changed mid-simulation. @param [in] newMaterial The new material properties for this voxel.
 
@@ -170,7 +175,9 @@ private:
 
 	float temp; //0 is no expansion
 
-	void floorForce(float dt, Vec3D<double>* pTotalForce); //modifies pTotalForce to include the object's interaction with a floor. This should be calculated as the last step of sumForce so that pTotalForce is complete.
+	const CVX_Heightfield* terrain; //terrain owned by the CVoxelyze object to use as the floor, or NULL for a flat floor at z=0
+	float floorContact(Vec3D<double>* pNormal) const; //returns floorPenetration() and the upward floor normal below this voxel
+	float floorForce(float dt, Vec3D<double>* pTotalForce, Vec3D<double>* pNormal); //modifies pTotalForce to include the object's interaction with a floor. This should be calculated as the last step of sumForce so that pTotalForce is complete. Returns the floor penetration and sets pNormal to the floor normal.
 
 
 	Vec3D<float> strain(bool poissonsStrain) const; //LCS returns voxel strain. if tensionStrain true and no actual tension in that
@@ -180,9 +187,12 @@ private:
 	bool poissonsStrainInvalid; //flag for recomputing poissons strain.
 
 	void eulerStep(float dt); //execute an euler time step at the specified dt
+	void enforceFixed(); //moves any fixed degrees of freedom to their prescribed displacement and removes their momentum
 	float previousDt; //remember the duration of the last timestep of this voxel
 
 	void updateSurface();
+	int surfaceIndex; //index of this voxel in the owning CVoxelyze surface voxel list, or -1 if not in the list
+	int listIndex; //index of this voxel in the owning CVoxelyze voxel list, or -1 if not in a list
 	void enableCollisions(bool enabled, float watchRadius = 0.0f); //watchRadius in voxel units
 	bool isCollisionsEnabled() const {return boolStates & COLLISIONS_ENABLED ? true : false;}
 	void generateNearby(int linkDepth, bool surfaceOnly = true);
@@ -190,9 +200,11 @@ private:
 	Vec3D<float>* lastColWatchPosition;
 	std::vector<CVX_Collision*>* colWatch;
 	std::vector<CVX_Voxel*>* nearby;
+	Vec3D<double>* sceneForce; //sum of contact forces from voxels of other bodies in a CVX_Scene (GCS). Only allocated once this voxel is involved in such a contact.
 
 
 	friend class CVoxelyze; //give access to private members directly
+	friend class CVX_Scene;
 	friend class CVXS_SimGLView; //TEMPORARY
 	friend class CVX_LinearSolver;
 
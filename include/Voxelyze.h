@@ -14,8 +14,10 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 
 //#include "VX_Enums.h"
 #include "Array3D.h"
+#include "ObjectPool.h"
 #include "VX_Link.h"
 #include "VX_Voxel.h"
+#include "VX_LinearSolver.h"
 #include <vector> //delete if PIMPL'd
 #include <list> //delete if PIMPL'd
 #include <algorithm> //delete if PIMPL'd
@@ -26,6 +28,7 @@ class CVX_Material;
 class CVX_MaterialVoxel;
 class CVX_MaterialLink;
 class CVX_Collision;
+class CVX_Heightfield;
 
 //! Defines and simulates a configuration of voxels.
 /*!
@@ -67,20 +70,28 @@ public:
 	};
 
 	CVoxelyze(double voxelSize = DEFAULT_VOXEL_SIZE); //!< Constructs an empty voxelyze object. @param[in] voxelSize base size of the voxels in this instance in meters.
-	CVoxelyze(const char* jsonFilePath) {loadJSON(jsonFilePath);} //!< Constructs a voxelyze object from a *.vxl.json file. The details of this file format are available in the Voxelyze user guide. @param[in] jsonFilePath path to the json file
+	CVoxelyze(const char* jsonFilePath) {topologyCount=0; pTerrain=NULL; pLinearSolver=NULL; loadJSON(jsonFilePath);} //!< Constructs a voxelyze object from a *.vxl.json file. The details of this file format are available in the Voxelyze user guide. @param[in] jsonFilePath path to the json file
 	CVoxelyze(rapidjson::Value* pV); //!< Constructs a voxelyze object from a rapidjson parser node that contains valid voxelyze sub-nodes. @param[in] pV pointer to a rapidjson Value that contains Voxelyze information. See rapidjson documentation and the *.vxl.json format info in the voxelyze user guide.
 	~CVoxelyze(void); //!< Destructor
-	CVoxelyze(CVoxelyze& VIn) {*this = VIn;} //!< Copy constructor
+	CVoxelyze(CVoxelyze& VIn) {topologyCount=0; pTerrain=NULL; pLinearSolver=NULL; clear(); voxSize=VIn.voxSize; *this = VIn;} //!< Copy constructor
 	CVoxelyze& operator=(CVoxelyze& VIn); //!< Equals operator
 
 	void clear(); //!< Erases all voxels and materials and restores the voxelyze object to its default (empty) state.
 	bool loadJSON(const char* jsonFilePath); //!< Clears this voxelyze instance and loads fresh from a *.vxl.json file. The details of this file format are available in the Voxelyze user guide. @param[in] jsonFilePath path to the json file
 	bool saveJSON(const char* jsonFilePath); //!< Saves this voxelyze instance to a json file. All voxels are saved at their default locations - the state is not captured. It is recommended to specify the standard *.vxl.json file suffix. @param[in] jsonFilePath path to the desired json file. Will create or overwrite a file at this path.
 
-	bool doLinearSolve(/*SOLVER thisSolver, float stepPercentage = 1.0f*/); //!< Linearizes the voxelyze object and does a one-time linear solution to set the position and orientation of all voxels. The current state of the voxel object will be discarded. Currently only the pardiso solver is supported. To make use of this feature voxelyze must be built with PARDISO_5 defined in the preprocessor. A valid pardiso 5 license file and library file (i.e libpardiso500-WIN-X86-64.dll for windows) should be obtained from www.pardiso-project.org and placed in the directory your executable will be run from.
+	bool doLinearSolve(CVX_LinearSolver::solverType solver = CVX_LinearSolver::AUTO); //!< Linearizes the voxelyze object and does a one-time linear solution to set the position and orientation of all voxels. The current state of the voxel object will be discarded. Returns false if the solve failed. Repeated calls reuse the same linearSolver() so that only the work affected by changes since the last call is redone. @param[in] solver The solution method. The built-in conjugate gradient and direct solvers need no external libraries. To make use of the pardiso solver voxelyze must be built with PARDISO_5 defined in the preprocessor. A valid pardiso 5 license file and library file (i.e libpardiso500-WIN-X86-64.dll for windows) should be obtained from www.pardiso-project.org and placed in the directory your executable will be run from. By default pardiso is used if available, otherwise CVX_LinearSolver::CG_MULTIGRID.
+	std::future<bool> doLinearSolveAsync(CVX_LinearSolver::solverType solver = CVX_LinearSolver::AUTO); //!< Starts doLinearSolve() on a background thread and returns immediately. The future becomes ready with the result of the solve. Meanwhile progress can be followed (and the solve cancelled) through linearSolver(). This voxelyze object must not be modified or simulated until the future is ready. See CVX_LinearSolver::solveAsync() for details. @param[in] solver The solution method.
+	bool doLinearSolve(std::vector<CVX_LoadCase>& loadCases, CVX_LinearSolver::solverType solver = CVX_LinearSolver::AUTO); //!< Linearizes the voxelyze object and solves several load cases with a single factorization. Unlike doLinearSolve(CVX_LinearSolver::solverType) the voxels are not modified: the resulting displacements are stored in each load case. Which degrees of freedom are fixed is taken from the voxels' externals. Returns false if the solve failed. @param[in,out] loadCases The loads and prescribed displacements of each case. @param[in] solver The solution method.
+
+	bool doNonlinearSolve(int loadSteps = 10, CVX_LinearSolver::solverType solver = CVX_LinearSolver::AUTO); //!< Solves for the static equilibrium including large deformations and nonlinear materials by incremental Newton-Raphson iteration on the tangent stiffness. Each iteration is one linear solve with the same linearSolver() as doLinearSolve(), so the voxel ordering and sparsity structure are shared by every iteration. Usually converges in a few iterations per increment. The current state of the voxel object will be discarded and the floor is not considered. Returns false if the solve failed. See CVX_LinearSolver::solveNonlinear() for details. @param[in] loadSteps The number of equal load increments. @param[in] solver The solution method for each iteration.
+	bool doModalAnalysis(int modeCount = 6, bool modeShapes = false, CVX_LinearSolver::solverType solver = CVX_LinearSolver::AUTO); //!< Finds the natural frequencies and mode shapes of the voxelyze object about its nominal state with the same linearSolver() as doLinearSolve(). The voxels are not modified. The results are in the public members of linearSolver(). See CVX_LinearSolver::solveModes() for details. Returns false if the solve failed. @param[in] modeCount The number of lowest frequency modes to find. @param[in] modeShapes If true the mode shapes are kept as well. @param[in] solver The solution method used by the lowest frequency search.
+	bool doRelaxationSolve(float tolerance = 1e-4f, int maxIterations = 100000, int* pIterations = NULL); //!< Moves the voxelyze object to its static equilibrium by kinetic dynamic relaxation. Starting from the current state, each voxel is given a fictitious mass scaled to the stiffness of its links so that a unit pseudo time step is stable, and the voxels are advanced with the same link and voxel force calculations as doTimeStep() but without damping. Whenever the total kinetic energy passes a peak the voxels are moved back to the peak and restarted from rest. This reaches equilibrium in far fewer iterations than damped dynamics and, unlike doLinearSolve(), supports large deformations and nonlinear materials. The floor is not considered. On return all voxels are at rest. Nonlinear materials are treated as if loaded monotonically from the current state. Returns true once the largest out of balance force on any free degree of freedom has fallen below tolerance times the largest force at the start (applied loads, forces carried by links or the initial imbalance), false if maxIterations were used up or the simulation diverged. @param[in] tolerance Convergence threshold relative to the largest force at the start. @param[in] maxIterations The maximum number of iterations. @param[out] pIterations If not NULL, receives the number of iterations taken.
+	CVX_LinearSolver* linearSolver(); //!< Returns the linear solver used by doLinearSolve(). It caches the problem structure and factorization between solves, and its public members report progress and convergence. The pointer remains valid until clear() is called.
 
 	bool doTimeStep(float dt = -1.0f); //!< Executes a single timestep on this voxelyze object and updates all state information (voxel positions and orientations) accordingly. In most situations this function will be called repeatedly until the desired result is obtained. @param[in] dt The timestep to take in seconds. If this value is too large the system will display divergent instability. Use recommendedTimeStep() to get a conservative estimate of the largest stable timestep. Also the default value of -1.0f will blindly use this recommended timestep.
 	float recommendedTimeStep() const; //!< Returns an estimate of the largest stable time step based on the current state of the simulation. If poisson's ratios are all zero and material properties do not otherwise change this can be called once and the same timestep value used for all subsequent doTimeStep() calls. Otherwise the timestep should be recalculated whenever the simulation has changed.
+	float stableTimeStep(); //!< Returns the largest stable time step from the exact highest natural frequency of the structure, found by a modal analysis with linearSolver(). Unlike recommendedTimeStep() this accounts for every link and voxel together and for the internal and global damping of the materials, so it is usually several times larger. Collisions and the floor are not considered. The modal analysis is repeated on every call, so call this once and reuse the value unless the structure or its materials change. Falls back to recommendedTimeStep() if the modal analysis fails.
 	void resetTime(); //!< Resets all voxels to their initial state and zeroes the elapsed time counter. Call this to "start over" without changing any of the voxels.
 
 	CVX_Material* addMaterial(float youngsModulus = 1e6f, float density = 1e3f); //!< Adds a material to this voxelyze object with the minimum necessary information for dynamic simulation (stiffness, density). Returns a pointer to the newly created material that can be used to further specify properties using CVX_Material public memer functions. See CVX_Material documentation. This function does not create any voxels, but a returned CVX_material pointer is a necessary parameter for the setVoxel() function that does add voxels. @param[in] youngsModulus the desired stiffness (Young's Modulus) of this material in Pa (N/m^2). @param[in] density the desired density of this material in Kg/m^3.
@@ -94,10 +105,15 @@ public:
 
 
 	CVX_Voxel* setVoxel(CVX_Material* material, int xIndex, int yIndex, int zIndex); //!< Adds a voxel made of material at the specified index. If a voxel already exists here it is replaced. The returned pointer can be safely modified by calling any CVX_Voxel public member function on it. @param[in] material material this voxel is made from. This material must already be a part of the simulation - the pointer will have originated from addMaterial() or material(). @param[in] xIndex the X index of this voxel. @param[in] yIndex the Y index of this voxel. @param[in] zIndex the Z index of this voxel.
+	bool setVoxels(const int* materialIndices, int xCount, int yCount, int zCount, int xOffset=0, int yOffset=0, int zOffset=0); //!< Sets a whole block of voxels at once from a dense grid of material indices. Much faster than calling setVoxel() for each voxel when building large models: all memory is reserved up front and links are made in one pass along each axis. Existing voxels in the block are replaced as with setVoxel(). Returns false without changing anything if the parameters or any material index are invalid. @param[in] materialIndices xCount*yCount*zCount material indices (see material()) in X-fastest order (index = x + xCount*(y + yCount*z)). A negative index leaves that position unchanged. @param[in] xCount the X size of the grid. @param[in] yCount the Y size of the grid. @param[in] zCount the Z size of the grid. @param[in] xOffset the X index of the first grid element. @param[in] yOffset the Y index of the first grid element. @param[in] zOffset the Z index of the first grid element.
+	bool setVoxelRuns(const int* runs, int runCount, int xCount, int yCount, int zCount, int xOffset=0, int yOffset=0, int zOffset=0); //!< Run length encoded version of setVoxels(). Runs may continue from one X row to the next. Returns false without changing anything if the runs do not add up to the grid size exactly or any material index is invalid. @param[in] runs runCount pairs of (material index, run length) covering the grid in the same X-fastest order as setVoxels(). A negative material index leaves that run of positions unchanged. @param[in] runCount the number of runs. @param[in] xCount the X size of the grid. @param[in] yCount the Y size of the grid. @param[in] zCount the Z size of the grid. @param[in] xOffset the X index of the first grid element. @param[in] yOffset the Y index of the first grid element. @param[in] zOffset the Z index of the first grid element.
+	int removeVoxels(const std::vector<CVX_Voxel*>& toRemove); //!< Removes many voxels at once along with all of their links. Each removal takes constant time regardless of the number of voxels. Null pointers, repeated pointers and pointers to voxels not in this voxelyze object are ignored. Returns the number of voxels removed. @param[in] toRemove pointers to the voxels to remove, as returned by setVoxel() or voxel(). These pointers are invalid once this function returns.
 	CVX_Voxel* voxel(int xIndex, int yIndex, int zIndex) const {return voxels(xIndex, yIndex, zIndex);} //!< Returns a pointer to the voxel at this location if one exists, or null otherwise. The returned pointer can be safely modified by calling any CVX_Voxel public member function on it. @param[in] xIndex the X index to query. @param[in] yIndex the Y index to query. @param[in] zIndex the Z index to query.
 	int voxelCount() const {return voxelsList.size();} //!< Returns the number of voxels currently in this voxelyze object.
 	CVX_Voxel* voxel(int voxelIndex) const {return voxelsList[voxelIndex];} //!< Returns a pointer to a voxel that has been added to this voxelyze object. CVX_Voxel public member functions can be safely called on this pointer to query or modify the voxel. A given index may or may not always return the same voxel - Use voxel pointers to keep permanent handles to specific voxels. This function is primarily used while iterating through all voxels in conjuntion with voxelCount(). @param[in] voxelIndex the current index of a voxel. Valid range from 0 to voxelCount()-1.
 	const std::vector<CVX_Voxel*>* voxelList() const {return &voxelsList;} //!< Returns a pointer to the internal list of voxels in this voxelyze object. In some situations where all voxels must be iterated over quickly there may be performance gains from iterating directly on the underlying std::vector container accessed with this function.
+	int surfaceVoxelCount() const {return surfaceVoxelsList.size();} //!< Returns the number of voxels with at least one exposed face (i.e. not completely surrounded by other voxels).
+	const std::vector<CVX_Voxel*>* surfaceVoxelList() const {return &surfaceVoxelsList;} //!< Returns a pointer to the internal list of surface voxels (voxels with at least one exposed face) in this voxelyze object. This list is kept up to date as voxels are added and removed and is in no particular order.
 
 
 	int indexMinX() const {return voxels.minIndices().x;} //!< The minimum X index of any voxel in this voxelyze object. Use to determine limits.
@@ -126,6 +142,9 @@ public:
 
 	void enableFloor(bool enabled = true); //!< Enables or disables a floor that resists voxel penetration at z=0. @param[in] enabled If true, enables the floor. Otherwise disables it.
 	bool isFloorEnabled(void) const {return floor;} //!< Returns a boolean value indication if the floor is enabled or not.
+	void setTerrain(const CVX_Heightfield& terrain); //!< Replaces the flat floor at z=0 with a static heightfield terrain. The terrain is copied. The floor must still be enabled with enableFloor() for voxels to interact with it. @param[in] terrain The terrain to use as the floor.
+	void clearTerrain(); //!< Removes any terrain set with setTerrain() and restores the flat floor at z=0.
+	const CVX_Heightfield* terrain() const {return pTerrain;} //!< Returns the terrain in use as the floor, or NULL if the floor is flat at z=0.
 
 	void enableCollisions(bool enabled = true); //!< Enables or disables a collision watcher that results in voxels resisting penetration with one another. This may slow down the simulation significantly. @param[in] enabled If true, enables the collision detection. Otherwise disables it.
 	bool isCollisionsEnabled(void) const {return collisions;} //!< Returns a boolean value indication if the collision watcher is enabled or not.
@@ -139,6 +158,8 @@ private:
 	float ambientTemp;
 	float grav;
 	bool floor, collisions;
+	CVX_Heightfield* pTerrain; //terrain to use as the floor, or NULL for a flat floor at z=0
+	CVX_LinearSolver* pLinearSolver; //persistent linear solver (created on first use)
 
 	//constants... somewhere else?
 	float boundingRadius; //(in voxel units) radius to collide a voxel at
@@ -153,17 +174,26 @@ private:
 	std::list<CVX_MaterialLink*> linkMats; //any generated material combinations
 
 	CVX_Voxel* addVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex, int yIndex, int zIndex); //creates a new voxel if there isn't one here. Otherwise
+	CVX_Voxel* createVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex, int yIndex, int zIndex); //allocates a voxel and adds it to the array and list without linking it or updating the surface list
 	void removeVoxel(int xIndex, int yIndex, int zIndex);
 	void replaceVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex, int yIndex, int zIndex); //replaces the material of this voxel while retaining its position, velocity, etc.
 
 
-	CArray3D<CVX_Voxel*> voxels; //main voxel array 3D lookup
+	CObjectPool<CVX_Voxel> voxelPool; //storage for all voxels, links and externals, so that objects created together sit together in memory and clear() frees them in a few blocks
+	CObjectPool<CVX_Link> linkPool;
+	CObjectPool<CVX_External> externalPool;
+
+	CArray3D<CVX_Voxel*, 3> voxels; //main voxel array 3D lookup (8x8x8 bricks allocated as needed)
 	std::vector<CVX_Voxel*> voxelsList; //main list of existing voxels (no particular order) (always kept syncd with voxels)
+	std::vector<CVX_Voxel*> surfaceVoxelsList; //list of voxels with at least one exposed face (no particular order) (always kept syncd with voxels)
+	void updateSurfaceList(CVX_Voxel* pV); //adds or removes pV from surfaceVoxelsList according to its current surface status. Call whenever links to this voxel change.
+	void removeFromSurfaceList(CVX_Voxel* pV); //removes pV from surfaceVoxelsList if it is there.
 
-	CArray3D<CVX_Link*> links[3]; //main link arrays in the X[0], Y[1] and Z[2] directions. (0,0,0) is the bond pointting in the positive direction from voxel (0,0,0)
+	CArray3D<CVX_Link*, 3> links[3]; //main link arrays in the X[0], Y[1] and Z[2] directions. (0,0,0) is the bond pointting in the positive direction from voxel (0,0,0)
 	std::vector<CVX_Link*> linksList; //main list of all existing links (no particular order) (always kept syncd with voxels)
 
 	CVX_Link* addLink(int xIndex, int yIndex, int zIndex, CVX_Voxel::linkDirection direction); //adds a link (if one isn't already present) and updates parameters
+	CVX_Link* createLink(CVX_Voxel* voxel1, CVX_Voxel::linkDirection direction, CVX_Voxel* voxel2); //allocates a link between voxel1 and its neighbor voxel2 in this direction and adds it to the arrays, list and voxels. Does not update the surface list.
 	void removeLink(int xIndex, int yIndex, int zIndex, CVX_Voxel::linkDirection direction); //removes just the link and all references to it in connected voxels
 
 	int xIndexLinkOffset(CVX_Voxel::linkDirection direction) const {return (direction == CVX_Voxel::X_NEG) ? -1 : 0;} //the link X index offset from a voxel index and link direction
@@ -175,6 +205,7 @@ private:
 
 	std::vector<CVX_Collision*> collisionsList;
 	bool collisionsStale, nearbyStale; //flags to recalculate collision lists and voxel nearby lists.
+	unsigned int topologyCount; //incremented whenever voxels are added or removed so that external observers (i.e. CVX_Scene) know to refresh any cached voxel pointers.
 
 	void updateCollisions();
 	void clearCollisions(); //remove all existing collisions
@@ -183,6 +214,8 @@ private:
 	bool writeJSON(rapidjson::PrettyWriter<rapidjson::StringBuffer>& w);
 	bool readJSON(rapidjson::Value& vxl);
 
+	friend class CVX_Scene;
+	friend class CVX_LinearSolver;
 };
 
 
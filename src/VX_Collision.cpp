@@ -14,10 +14,11 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 
 float CVX_Collision::envelopeRadius = 0.625f;
 
-CVX_Collision::CVX_Collision(CVX_Voxel* v1, CVX_Voxel* v2)
+CVX_Collision::CVX_Collision(CVX_Voxel* v1, CVX_Voxel* v2, const Vec3D<double>& v2FrameOffset)
 {
 	pV1 = v1;
 	pV2 = v2;
+	v2Offset = v2FrameOffset;
 	penetrationStiff = 2.0f/(1.0f/v1->material()->penetrationStiffness()+1.0f/pV2->material()->penetrationStiffness());
 	dampingC = 0.5f*(v1->material()->collisionDampingTranslateC() + v2->material()->collisionDampingTranslateC()); //average
 }
@@ -27,7 +28,9 @@ CVX_Collision& CVX_Collision::operator=(const CVX_Collision& col)
 	pV1 = col.pV1;
 	pV2 = col.pV2;
 	penetrationStiff = col.penetrationStiff;
+	dampingC = col.dampingC;
 	force = col.force;
+	v2Offset = col.v2Offset;
 	return *this;
 }
 
@@ -42,7 +45,7 @@ Vec3D<float> const CVX_Collision::contactForce(CVX_Voxel* pVoxel)
 void CVX_Collision::updateContactForce() 
 {
 	//just basic sphere envelope, repel with the stiffness of the material... (assumes UpdateConstants has been called)
-	Vec3D<float> offset = (Vec3D<float>)(pV2->position() - pV1->position());
+	Vec3D<float> offset = (Vec3D<float>)(pV2->position() + v2Offset - pV1->position());
 	float NomDist = (float)((pV1->baseSizeAverage() + pV2->baseSizeAverage())*envelopeRadius); //effective diameter of 1.5 voxels... (todo: remove length2!!
 	float RelDist = NomDist -offset.Length(); //negative for overlap!
 
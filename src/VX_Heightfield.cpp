@@ -0,0 +1,80 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#include "VX_Heightfield.h"
+#include <cmath>
+
+CVX_Heightfield::CVX_Heightfield(int xCount, int yCount, double spacing, double originX, double originY)
+{
+	step = spacing > 0 ? spacing : 0.001;
+	x0 = originX;
+	y0 = originY;
+	resize(xCount, yCount);
+}
+
+void CVX_Heightfield::resize(int xCount, int yCount)
+{
+	if (xCount <= 0 || yCount <= 0) xCount = yCount = 0;
+	xNodes = xCount;
+	yNodes = yCount;
+	heights.assign(xNodes*yNodes, 0.0f);
+}
+
+double CVX_Heightfield::height(double x, double y) const
+{
+	double h;
+	Vec3D<double> n;
+	sample(x, y, &h, &n);
+	return h;
+}
+
+Vec3D<double> CVX_Heightfield::normal(double x, double y) const
+{
+	double h;
+	Vec3D<double> n;
+	sample(x, y, &h, &n);
+	return n;
+}
+
+void CVX_Heightfield::sample(double x, double y, double* pHeight, Vec3D<double>* pNormal) const
+{
+	*pNormal = Vec3D<double>(0,0,1);
+	if (xNodes == 0){ //flat plane at z=0
+		*pHeight = 0;
+		return;
+	}
+
+	//continuous grid coordinates, clamped to the grid so heights extend flat beyond the edges
+	double gx = (x-x0)/step, gy = (y-y0)/step;
+	bool inX = true, inY = true;
+	if (gx < 0){gx = 0; inX = false;}
+	else if (gx > xNodes-1){gx = xNodes-1; inX = false;}
+	if (gy < 0){gy = 0; inY = false;}
+	else if (gy > yNodes-1){gy = yNodes-1; inY = false;}
+
+	int i = xNodes > 1 ? (int)gx : 0, j = yNodes > 1 ? (int)gy : 0;
+	if (i > xNodes-2) i = xNodes > 1 ? xNodes-2 : 0; //last cell includes the upper edge
+	if (j > yNodes-2) j = yNodes > 1 ? yNodes-2 : 0;
+	double u = gx-i, v = gy-j;
+
+	int i1 = xNodes > 1 ? i+1 : i, j1 = yNodes > 1 ? j+1 : j;
+	double h00 = heights[j*xNodes + i], h10 = heights[j*xNodes + i1];
+	double h01 = heights[j1*xNodes + i], h11 = heights[j1*xNodes + i1];
+
+	*pHeight = (1-v)*((1-u)*h00 + u*h10) + v*((1-u)*h01 + u*h11);
+
+	double dhdx = inX ? ((1-v)*(h10-h00) + v*(h11-h01))/step : 0;
+	double dhdy = inY ? ((1-u)*(h01-h00) + u*(h11-h10))/step : 0;
+	if (dhdx != 0 || dhdy != 0){
+		*pNormal = Vec3D<double>(-dhdx, -dhdy, 1);
+		pNormal->Normalize();
+	}
+}
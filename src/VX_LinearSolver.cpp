@@ -13,13 +13,18 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 #include "Voxelyze.h"
 #include "VX_MaterialLink.h"
 #include <unordered_map>
-#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <climits>
 
 //VERSION 5
 
 //some static info to reference in the algorithms
 static int blockOff[6][3] = {{0,4,5},{1,3,5},{2,3,4},{1,2,3},{0,2,4},{0,1,5}};
 static dofComponent dofMap[6] = {X_TRANSLATE, Y_TRANSLATE, Z_TRANSLATE, X_ROTATE, Y_ROTATE, Z_ROTATE};
+static inline int blockSlot(int row, int col) {for (int k=0; k<3; k++) if (blockOff[row][k]==col) return k; return -1;} //position of col among the 3 entries of row in a 6x6 block
+static inline double pseudoRandom(unsigned int& seed) {seed = seed*1664525u + 1013904223u; return (double)(seed>>8)/(1<<24) - 0.5;} //repeatable start vectors for the modal analysis
+static int couple[3][2][3] = {{{1,5,1},{2,4,-1}}, {{0,5,-1},{2,3,1}}, {{0,4,1},{1,3,-1}}}; //for each link axis: translational row, rotational column and sign of the b2 bending coupling on the negative end voxel
 
 CVX_LinearSolver::CVX_LinearSolver(CVoxelyze* voxelyze)
 {
@@ -34,6 +39,25 @@ CVX_LinearSolver::CVX_LinearSolver(CVoxelyze* voxelyze)
 	error = 0; //Initialize error flag
 	int solver = 0; //use default (non-iterative) Pardiso solver
 
+	tolerance = 1e-8;
+	maxIterations = 0;
+	newtonTolerance = 1e-6;
+	maxNewtonIterations = 50;
+	newtonIterations = 0;
+	highestFrequency = 0;
+	highestDamping = 0;
+	massShift = 0;
+	dampingMode = false;
+	iterations = 0;
+	multigridLevels = 0;
+	relativeResidual = 0;
+	analysisCount = 0;
+	factorizationCount = 0;
+
+	cachedTopology = 0;
+	structureValid = patternValid = pardisoAnalyzed = factorValid = directAnalyzed = false;
+	factoredType = AUTO;
+
 	progressTick = 0;
 	progressMaxTick = 100; //never changes
 	progressMsg = "";
@@ -45,13 +69,244 @@ CVX_LinearSolver::CVX_LinearSolver(CVoxelyze* voxelyze)
 #endif
 }
 
+CVX_LinearSolver::~CVX_LinearSolver()
+{
+	releasePardiso();
+}
+
+void CVX_LinearSolver::reset()
+{
+	releasePardiso();
+	structureValid = patternValid = factorValid = directAnalyzed = false;
+}
+
+
+bool CVX_LinearSolver::solve(solverType type) //formulates and solves system!
+{
+	cancelFlag = false;
+	return linearSolve(type);
+}
+
+std::future<bool> CVX_LinearSolver::solveAsync(solverType type)
+{
+	cancelFlag = false; //now, so that a cancel before the thread gets going still counts
+	return std::async(std::launch::async, &CVX_LinearSolver::linearSolve, this, type);
+}
+
+bool CVX_LinearSolver::linearSolve(solverType type)
+{
+	if (!prepare(type)) return false;
+	setupBoundaryConditions(NULL);
+
+	bool Success = solveSystem(type);
+	if (!Success) return false;
+	if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;} //last chance before the voxels are changed
+
+	updateProgress(0.9f, "Processing results...");
+	postResults();
+	updateProgress(1.0f, "Done.");
+	return true;
+}
+
+bool CVX_LinearSolver::solve(std::vector<CVX_LoadCase>& loadCases, solverType type)
+{
+	cancelFlag = false;
+	if (loadCases.empty()) return true;
+	if (!prepare(type)) return false;
+	setupBoundaryConditions(&loadCases);
+
+	bool Success = solveSystem(type);
+	if (!Success) return false;
+
+	updateProgress(0.9f, "Processing results...");
+	for (int c=0; c<nrhs; c++) loadCases[c].result.assign(x.begin()+c*dof, x.begin()+(c+1)*dof);
+	updateProgress(1.0f, "Done.");
+	return true;
+}
+
+bool CVX_LinearSolver::solveNonlinear(int loadSteps, solverType type)
+{
+	cancelFlag = false;
+	newtonIterations = 0;
+	if (!prepare(type)) return false;
+	if (type == PARDISO) type = DIRECT; //the pardiso matrix only holds the axis aligned nominal stiffness
+	if (loadSteps < 1) loadSteps = 1;
+	setupBoundaryConditions(NULL);
+	std::vector<double> prescribed(x); //full prescribed displacements of the fixed degrees of freedom
+	bool anyPrescribed = false;
+	for (int i=0; i<dof; i++) if (prescribed[i] != 0) anyPrescribed = true;
+
+	int vCount = dof/6, linkCount = vx->linkCount();
+	for (int i=0; i<vCount; i++){ //start from the nominal state
+		CVX_Voxel* pV = vx->voxel(i);
+		pV->pos = pV->originalPosition();
+		pV->orient = Quat3D<double>();
+		pV->haltMotion();
+		pV->poissonsStrainInvalid = true;
+	}
+	for (int i=0; i<linkCount; i++) vx->link(i)->reset(); //and no plastic deformation
+
+	//state at the end of the last converged increment. The plastic history of each link is only committed here so that overshoot during the iterations never counts as loading.
+	std::vector<float> maxStrain(linkCount), strainOffset(linkCount);
+	for (int i=0; i<linkCount; i++){
+		maxStrain[i] = vx->link(i)->maxStrain;
+		strainOffset[i] = vx->link(i)->strainOffset;
+	}
+	std::vector<Vec3D<double> > lastPos(vCount), itPos(vCount);
+	std::vector<Quat3D<double> > lastOrient(vCount), itOrient(vCount);
+	saveVoxelState(lastPos, lastOrient);
+
+	bool Success = true;
+	for (int step=1; step<=loadSteps && Success; step++){
+		double loadFactor = (double)step/loadSteps;
+		double residual = nonlinearResidual(loadFactor, maxStrain, strainOffset);
+		bool movePrescribed = anyPrescribed; //the first iteration of the increment moves the prescribed degrees of freedom
+
+		//after the first increment, predict each one by repeating the last (which also moves the prescribed degrees of freedom)
+		for (int i=0; i<vCount; i++){
+			CVX_Voxel* pV = vx->voxel(i);
+			Vec3D<double> dPos = pV->pos - lastPos[i], dRot = (pV->orient*lastOrient[i].Conjugate()).ToRotationVector();
+			for (int j=0; j<3; j++){
+				x[6*i+j] = dPos[j];
+				x[6*i+3+j] = dRot[j];
+			}
+		}
+		saveVoxelState(lastPos, lastOrient);
+		if (step > 1){
+			applyCorrection(lastPos, lastOrient, 1.0, step == loadSteps);
+			double predictedResidual = nonlinearResidual(loadFactor, maxStrain, strainOffset);
+			if (predictedResidual < HUGE_VAL){
+				residual = predictedResidual;
+				movePrescribed = false;
+			}
+			else applyCorrection(lastPos, lastOrient, 0.0, false); //diverged
+		}
+
+		for (int it=0; ; it++){
+			if (residual <= newtonTolerance && !movePrescribed) break;
+			if (it >= maxNewtonIterations){ errorMsg = "Newton-Raphson iteration did not converge. Try more load steps.\n"; Success = false; break;}
+			if (cancelFlag){ errorMsg = "Solve cancelled.\n"; Success = false; break;}
+			updateProgress(((float)(step-1) + (float)it/maxNewtonIterations)/loadSteps, "Newton-Raphson: Solving...");
+
+			//correction with the tangent stiffness of the current state
+			updateTangents();
+			for (int i=0; i<dof; i++) x[i] = (movePrescribed && fixedDof[i]) ? prescribed[i]/loadSteps : 0.0;
+			if (!solveSystem(type)){ Success = false; break;}
+			newtonIterations++;
+
+			//far from equilibrium the full correction can go well beyond the range of the tangent: halve it while it makes the out of balance forces much worse. Moving the prescribed degrees of freedom is always taken in full.
+			saveVoxelState(itPos, itOrient);
+			double scale = 1.0, trialResidual;
+			for (int halvings=0; ; halvings++){
+				applyCorrection(itPos, itOrient, scale, step == loadSteps);
+				trialResidual = nonlinearResidual(loadFactor, maxStrain, strainOffset);
+				if (trialResidual <= 10*residual || movePrescribed || halvings == 10) break;
+				scale *= 0.5;
+			}
+			residual = trialResidual;
+			movePrescribed = false;
+			if (residual == HUGE_VAL){ errorMsg = "Newton-Raphson iteration diverged. Try more load steps.\n"; Success = false; break;}
+		}
+
+		if (Success){
+			for (int i=0; i<linkCount; i++){
+				maxStrain[i] = vx->link(i)->maxStrain;
+				strainOffset[i] = vx->link(i)->strainOffset;
+			}
+		}
+		else { //back to the last converged increment
+			applyCorrection(lastPos, lastOrient, 0.0, false);
+			nonlinearResidual(loadFactor - 1.0/loadSteps, maxStrain, strainOffset);
+		}
+	}
+
+	tangents.clear();
+	for (int i=0; i<linkCount; i++) vx->link(i)->setBoolState(CVX_Link::LOCAL_VELOCITY_VALID, false); //nor the jump to the result by the next doTimeStep()
+	if (Success) updateProgress(1.0f, "Done.");
+	return Success;
+}
+
+bool CVX_LinearSolver::solveModes(int modeCount, bool modeShapes, solverType type)
+{
+	cancelFlag = false;
+	modeFrequencies.clear();
+	shapes.clear();
+	highestFrequency = 0;
+	highestDamping = 0;
+	if (!prepare(type)) return false;
+	setupBoundaryConditions(NULL);
+
+	//lumped mass matrix
+	int vCount = dof/6, freeCount = 0;
+	bool damped = false;
+	lumpedMass.resize(dof);
+	for (int i=0; i<vCount; i++){
+		CVX_MaterialVoxel* pMat = vx->voxel(i)->mat;
+		for (int j=0; j<6; j++) lumpedMass[6*i+j] = j<3 ? pMat->mass() : pMat->momentInertia();
+		if (pMat->internalDamping() != 0 || pMat->globalDamping() != 0) damped = true;
+	}
+	for (int i=0; i<dof; i++) if (!fixedDof[i]) freeCount++;
+	if (freeCount == 0){ errorMsg = "No free degrees of freedom found. Aborting.\n"; return false;}
+	if (modeCount > freeCount) modeCount = freeCount;
+
+	//highest frequency directly from the stiffness matrix
+	updateProgress(0.02f, "Modal analysis: Highest frequency...");
+	std::vector<double> values;
+	if (!lanczos(type, false, 1, values, NULL)) return false;
+	double maxEigenvalue = values[0];
+	highestFrequency = sqrt(std::max(0.0, maxEigenvalue))/(2*3.14159265358979);
+
+	//likewise the fastest decaying motion from the damping matrix
+	if (damped){
+		dampingMode = true;
+		bool Success = lanczos(type, false, 1, values, NULL);
+		dampingMode = false;
+		if (!Success) return false;
+		highestDamping = std::max(0.0, values[0]);
+	}
+
+	//lowest frequencies from the inverse of the shifted stiffness matrix, which is never singular and leaves the lowest modes far apart
+	if (modeCount > 0){
+		massShift = maxEigenvalue > 0 ? 1e-6*maxEigenvalue : 1.0;
+		bool Success = lanczos(type, true, modeCount, values, modeShapes ? &shapes : NULL);
+		double shift = massShift;
+		massShift = 0;
+		if (!Success){ shapes.clear(); return false;}
+
+		for (int k=0; k<modeCount; k++){
+			double eigenvalue = 1.0/values[k] - shift;
+			modeFrequencies.push_back(sqrt(std::max(0.0, eigenvalue))/(2*3.14159265358979));
+		}
+	}
+
+	updateProgress(1.0f, "Done.");
+	return true;
+}
 
-bool CVX_LinearSolver::solve() //formulates and solves system!
+Vec3D<double> CVX_LinearSolver::modeTranslation(int mode, int voxelIndex) const
+{
+	if (mode < 0 || (size_t)(mode+1)*dof > shapes.size() || voxelIndex < 0 || 6*voxelIndex >= dof) return Vec3D<double>();
+	const double* v = &shapes[(size_t)mode*dof + 6*voxelIndex];
+	return Vec3D<double>(v[0], v[1], v[2]);
+}
+
+Vec3D<double> CVX_LinearSolver::modeRotation(int mode, int voxelIndex) const
+{
+	if (mode < 0 || (size_t)(mode+1)*dof > shapes.size() || voxelIndex < 0 || 6*voxelIndex >= dof) return Vec3D<double>();
+	const double* v = &shapes[(size_t)mode*dof + 6*voxelIndex];
+	return Vec3D<double>(v[3], v[4], v[5]);
+}
+
+bool CVX_LinearSolver::solveSystem(solverType type)
+{
+	if (type == PARDISO) return solvePardiso();
+	if (type == DIRECT) return solveDirect();
+	return solveCG(type);
+}
+
+bool CVX_LinearSolver::prepare(solverType& type)
 {
-	std::cout << "Solving...\n";
 	updateProgress(0, "Forming matrices...");
-	cancelFlag = false; //this may be set to true, in which case we should interrupt the solve process...
-	bool Success = true; //flag to track whether a part of the process fails.
 
 	//deal with disconnected voxels of lack of fixed voxels here?
 
@@ -59,9 +314,37 @@ bool CVX_LinearSolver::solve() //formulates and solves system!
 	dof = vx->voxelCount()*6;
 	if (dof == 0) return false;
 
+	if (type == AUTO){
+#ifdef PARDISO_5
+		type = PARDISO;
+#else
+		type = CG_MULTIGRID;
+#endif
+	}
+
+	//voxels added or removed since the last solve invalidate everything
+	if (!structureValid || cachedTopology != vx->topologyCount){
+		reset();
+		buildAdjacency(true);
+		structureValid = true;
+		cachedTopology = vx->topologyCount;
+		analysisCount++;
+	}
+	else buildAdjacency(false); //links are recreated when a voxel's material is replaced
+	if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;}
+	return true;
+}
+
+bool CVX_LinearSolver::solvePardiso()
+{
+	bool Success = true; //flag to track whether a part of the process fails.
+
+	if (!patternValid){
+		calculatePattern();
+		patternValid = true;
+	}
 	calculateA();
 	applyBX();
-	convertTo1Base();
 	//OutputMatrices(); //uncomment to output info for small systems
 
 	if (dof == 0){ errorMsg = "No free degrees of freedom found. Aborting.\n"; return false;}
@@ -72,17 +355,35 @@ bool CVX_LinearSolver::solve() //formulates and solves system!
 	int idum = 0; //Integer dummy var
 
 #ifdef PARDISO_5
-	updateProgress(0.02, "Pardiso: Analyzing...");
-	phase = 11;
-	pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+	convertTo1Base();
+	error = 0;
+
+	if (!pardisoAnalyzed){ //sparsity pattern changed
+		updateProgress(0.02, "Pardiso: Analyzing...");
+		phase = 11;
+		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+		if (error == 0) pardisoAnalyzed = true;
+	}
 
-	updateProgress(0.05, "Pardiso: Numerical factorization...");
-	phase = 22;
-	pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+	if (error == 0 && cancelFlag){ convertTo0Base(); errorMsg = "Solve cancelled.\n"; return false;}
+	if (error == 0 && (!factorValid || factoredType != PARDISO || a != aFactored)){ //stiffness or fixed degrees of freedom changed
+		updateProgress(0.05, "Pardiso: Numerical factorization...");
+		phase = 22;
+		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+		if (error == 0){
+			aFactored = a;
+			factorValid = true;
+			factoredType = PARDISO;
+			factorizationCount++;
+		}
+	}
 
-	updateProgress(0.79, "Pardiso: Solving, iterative refinement...");
-	phase = 33;
-	pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+	if (error == 0 && cancelFlag){ convertTo0Base(); errorMsg = "Solve cancelled.\n"; return false;}
+	if (error == 0){
+		updateProgress(0.79, "Pardiso: Solving, iterative refinement...");
+		phase = 33;
+		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+	}
 
 	if (error != 0){
 		Success=false;
@@ -96,232 +397,1254 @@ bool CVX_LinearSolver::solve() //formulates and solves system!
 		case -12: errorMsg = "Wrong username or hostname\n";
 		default: errorMsg = "Pardiso Error\n";
 		}
+		releasePardiso(); //start over next time
 	}
 
-	updateProgress(0.9, "Pardiso: Cleaning up...");
-	phase = -1; /* Release internal memory. */
-	pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &a[0], &ia[0], &ja[0], &idum, &nrhs, iparm, &msglvl, &b[0], &x[0], &error, dparm);
+	convertTo0Base(); //the pattern is reused by the next solve
 #else
+	errorMsg = "Pardiso support not compiled in. Define PARDISO_5 or use a built-in solver.\n";
 	Success = false;
 #endif
 
+	return Success;
+}
 
-	if (!Success) return false;
+void CVX_LinearSolver::releasePardiso()
+{
+#ifdef PARDISO_5
+	if (pardisoAnalyzed){
+		updateProgress(0.9, "Pardiso: Cleaning up...");
+		int idum = 0;
+		double ddum = 0;
+		phase = -1; /* Release internal memory. */
+		pardiso(pt, &maxfct, &mnum, &mtype, &phase, &dof, &ddum, &idum, &idum, &idum, &nrhs, iparm, &msglvl, &ddum, &ddum, &error, dparm);
+	}
+#endif
+	pardisoAnalyzed = false;
+	if (factoredType == PARDISO) factorValid = false;
+}
 
-	updateProgress(0.9f, "Processing results...");
-	postResults();
+bool CVX_LinearSolver::solveCG(solverType type)
+{
+	//the preconditioner only needs rebuilding if the stiffness or fixed degrees of freedom changed
+	std::vector<float> stiffness;
+	linkStiffness(stiffness);
+	if (!factorValid || factoredType != type || stiffness != factoredStiffness || fixedDof != factoredFixed){
+		setupPreconditioner(type);
+		if (type == CG_MULTIGRID){
+			updateProgress(0.02f, "Multigrid: Building coarse levels...");
+			setupMultigrid();
+		}
+		factorValid = true;
+		factoredType = type;
+		factoredStiffness.swap(stiffness);
+		factoredFixed = fixedDof;
+		factorizationCount++;
+	}
+	if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;}
+	updateProgress(0.05f, "Conjugate gradient: Solving...");
+
+	r.resize(dof); z.resize(dof); p.resize(dof); q.resize(dof);
+
+	//each load case is solved in turn with the same preconditioner
+	int maxIts = 0;
+	double maxResidual = 0;
+	for (int c=0; c<nrhs; c++){
+		if (!iterateCG(type, &b[c*dof], &x[c*dof])) return false;
+		maxIts = std::max(maxIts, iterations);
+		maxResidual = std::max(maxResidual, relativeResidual);
+	}
+	iterations = maxIts;
+	relativeResidual = maxResidual;
 	return true;
 }
 
-void CVX_LinearSolver::calculateA() //calculates the big stiffness matrix!
+bool CVX_LinearSolver::iterateCG(solverType type, const double* bCase, double* xCase)
 {
-	int vCount = vx->voxelCount(), lCount = vx->linkCount();
-	int nA = 12*vCount+18*lCount; //approximate number of non-zero elements in A (overestimates by quite a bit!)
+	std::vector<double> xc(xCase, xCase+dof);
 
-	//build temporary reverse lookup from voxel* to index
-	std::unordered_map<CVX_Voxel*, int> v2i;
-	for (int i=0; i<vCount; i++) {v2i[vx->voxel(i)] = i;}
+	//initial residual: x holds the prescribed displacements and zero elsewhere
+	multiplyA(xc, q);
+	double r0Norm2 = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+:r0Norm2)
+#endif
+	for (int i=0; i<dof; i++){
+		r[i] = fixedDof[i] ? 0.0 : bCase[i]-q[i];
+		r0Norm2 += r[i]*r[i];
+	}
 
-	ia.resize(dof+1);
-	ja.resize(nA);
-	a.clear();
-	a.resize(nA, 0); //optimized set everything to 0
+	iterations = 0;
+	relativeResidual = 0;
+	if (r0Norm2 == 0) return true; //nothing to do (unloaded)
 
-	std::vector<int> i2List;
+	applyPreconditioner(r, z, type);
+	double rz = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+:rz)
+#endif
+	for (int i=0; i<dof; i++){
+		p[i] = z[i];
+		rz += r[i]*z[i];
+	}
+
+	int maxIt = maxIterations > 0 ? maxIterations : dof;
+	double tol2 = tolerance*tolerance*r0Norm2;
+	double rNorm2 = r0Norm2;
+
+	while (rNorm2 > tol2){
+		if (iterations >= maxIt){ errorMsg = "Conjugate gradient did not converge.\n"; relativeResidual = sqrt(rNorm2/r0Norm2); return false;}
+		if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;}
+
+		multiplyA(p, q);
+		double pq = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+:pq)
+#endif
+		for (int i=0; i<dof; i++) pq += p[i]*q[i];
+		if (pq <= 0){ errorMsg = "Stiffness matrix is singular. Check that the structure is sufficiently fixed.\n"; return false;}
 
-	int iACounter = 1, jACounter = 0; //first ia always 0
+		double alpha = rz/pq;
+		rNorm2 = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+:rNorm2)
+#endif
+		for (int i=0; i<dof; i++){
+			xc[i] += alpha*p[i];
+			r[i] -= alpha*q[i];
+			rNorm2 += r[i]*r[i];
+		}
 
-	for (int i=0; i<vCount; i++){ //for each voxel...
-		CVX_Voxel* iv = vx->voxel(i);
+		applyPreconditioner(r, z, type);
+		double rzNew = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+:rzNew)
+#endif
+		for (int i=0; i<dof; i++) rzNew += r[i]*z[i];
 
-		//populate i2
-		i2List.clear();
-		for (int j=0; j<6; j++){ //for each possible link
-			if (iv->link((CVX_Voxel::linkDirection)j)){
-				int i2 = v2i[iv->adjacentVoxel((CVX_Voxel::linkDirection)j)];
-				if (i2>i) i2List.push_back(i2);
+		double beta = rzNew/rz;
+		rz = rzNew;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<dof; i++) p[i] = z[i] + beta*p[i];
+
+		iterations++;
+		if (iterations%10 == 0){ //convergence is roughly linear in log(residual)
+			double done = log(rNorm2/r0Norm2)/log(tol2/r0Norm2);
+			updateProgress(0.05f+0.85f*(float)(done<0?0:(done>1?1:done)), "Conjugate gradient: Solving...");
+		}
+	}
+
+	relativeResidual = sqrt(rNorm2/r0Norm2);
+	std::copy(xc.begin(), xc.end(), xCase);
+	return true;
+}
+
+void CVX_LinearSolver::setupBoundaryConditions(const std::vector<CVX_LoadCase>* loadCases)
+{
+	int vCount = vx->voxelCount();
+	nrhs = loadCases ? (int)loadCases->size() : 1;
+
+	//fixed degrees of freedom always come from the externals. One column of b and x per load case.
+	x.assign(dof*nrhs, 0.0);
+	b.assign(dof*nrhs, 0.0);
+	fixedDof.assign(dof, false);
+	for (int i=0; i<vCount; i++){
+		CVX_Voxel* pV = vx->voxel(i);
+		if (!pV->externalExists()) continue;
+		CVX_External* pE = pV->external();
+		for (int j=0; j<6; j++) if (pE->isFixed(dofMap[j])) fixedDof[6*i+j] = true;
+		if (loadCases) continue;
+
+		Vec3D<double> force(pE->force()), moment(pE->moment());
+		Vec3D<double> translation(pE->translation()), rotation(pE->rotation());
+		for (int j=0; j<6; j++){
+			if (fixedDof[6*i+j]) x[6*i+j] = (j<3) ? translation[j] : rotation[j%3];
+			else b[6*i+j] = (j<3) ? force[j] : moment[j%3];
+		}
+	}
+
+	if (!loadCases) return;
+	for (int c=0; c<nrhs; c++){
+		const std::vector<CVX_LoadCase::voxelLoad>& loads = (*loadCases)[c].loads;
+		double *bc = &b[c*dof], *xc = &x[c*dof];
+		for (int k=0; k<(int)loads.size(); k++){
+			const CVX_LoadCase::voxelLoad& l = loads[k];
+			if (!l.voxel) continue;
+			int i = l.voxel->listIndex; //solver indices are voxel list indices
+			if (i<0 || i>=vCount || vx->voxel(i) != l.voxel) continue; //not part of this simulation
+
+			for (int j=0; j<6; j++){
+				int thisDof = 6*i+j;
+				if (fixedDof[thisDof]) xc[thisDof] = (j<3) ? l.translation[j] : l.rotation[j%3];
+				else bc[thisDof] = (j<3) ? l.force[j] : l.moment[j%3];
 			}
 		}
-		std::sort(i2List.begin(), i2List.end());
+	}
+}
+
+void CVX_LinearSolver::linkProduct(const CVX_Link* pL, const linkTangent* pT, const double* xNeg, const double* xPos, double* out, bool negative)
+{
+	//rotate into the link frame (as if the link was along +X)
+	Vec3D<double> d1(xNeg[0], xNeg[1], xNeg[2]), t1(xNeg[3], xNeg[4], xNeg[5]), d2(xPos[0], xPos[1], xPos[2]), t2(xPos[3], xPos[4], xPos[5]);
+	if (pT){ //back to the nominal orientation of the link first
+		d1 = pT->rot.RotateVec3DInv(d1); t1 = pT->rot.RotateVec3DInv(t1);
+		d2 = pT->rot.RotateVec3DInv(d2); t2 = pT->rot.RotateVec3DInv(t2);
+	}
+	d1 = pL->toAxisX(d1); t1 = pL->toAxisX(t1);
+	d2 = pL->toAxisX(d2); t2 = pL->toAxisX(t2);
+	double g = pT ? pT->geometric : 0; //a link under tension resists sideways motion of its ends (and buckles under compression)
+
+	Vec3D<double> f, m;
+	beamProduct(pT ? pT->a1 : pL->a1(), pL->a2(), pL->b1()+g, pL->b2(), pL->b3(), d1, t1, d2, t2, negative, f, m);
+	pL->toAxisOriginal(&f);
+	pL->toAxisOriginal(&m);
+	if (pT){
+		f = pT->rot.RotateVec3D(f);
+		m = pT->rot.RotateVec3D(m);
+	}
+
+	out[0] += f.x; out[1] += f.y; out[2] += f.z;
+	out[3] += m.x; out[4] += m.y; out[5] += m.z;
+}
+
+void CVX_LinearSolver::beamProduct(double a1, double a2, double b1, double b2, double b3, const Vec3D<double>& d1, const Vec3D<double>& t1, const Vec3D<double>& d2, const Vec3D<double>& t2, bool negative, Vec3D<double>& f, Vec3D<double>& m)
+{
+	//same beam equations as CVX_Link::updateForces(), linearized about the nominal (or tangent) state. These are the forces on each voxel, so negate to get K*x.
+	Vec3D<double> d = d2-d1;
+	if (negative){
+		f = -Vec3D<double>(a1*d.x, b1*d.y - b2*(t1.z + t2.z), b1*d.z + b2*(t1.y + t2.y));
+		m = -Vec3D<double>(a2*(t2.x - t1.x), -b2*d.z - b3*(2*t1.y + t2.y), b2*d.y - b3*(2*t1.z + t2.z));
+	}
+	else {
+		f = Vec3D<double>(a1*d.x, b1*d.y - b2*(t1.z + t2.z), b1*d.z + b2*(t1.y + t2.y));
+		m = -Vec3D<double>(a2*(t1.x - t2.x), -b2*d.z - b3*(t1.y + 2*t2.y), b2*d.y - b3*(t1.z + 2*t2.z));
+	}
+}
+
+void CVX_LinearSolver::linkDampingProduct(const CVX_Link* pL, const double* vNeg, const double* vPos, double* out, bool negative)
+{
+	Vec3D<double> v1 = pL->toAxisX(Vec3D<double>(vNeg[0], vNeg[1], vNeg[2])), w1 = pL->toAxisX(Vec3D<double>(vNeg[3], vNeg[4], vNeg[5]));
+	Vec3D<double> v2 = pL->toAxisX(Vec3D<double>(vPos[0], vPos[1], vPos[2])), w2 = pL->toAxisX(Vec3D<double>(vPos[3], vPos[4], vPos[5]));
+	const CVX_MaterialLink* mat = pL->mat;
+	double sqA1=mat->_sqA1, sqA2xIp=mat->_sqA2xIp, sqB1=mat->_sqB1, sqB2xFMp=mat->_sqB2xFMp, sqB3xIp=mat->_sqB3xIp;
+
+	//The local damping of CVX_Link::updateForces() is the beam stiffness with the sqrt terms in place of the beam constants, with each end's forces scaled by sqrt(m)*zeta of its own voxel (and moments by half that): C = D*Ks.
+	//Only the symmetric part 0.5*(D*Ks + Ks*D) takes energy out, so that is what's applied here.
+	double cNeg = pL->pVNeg->mat->_sqrtMass*pL->pVNeg->mat->internalDamping(), cPos = pL->pVPos->mat->_sqrtMass*pL->pVPos->mat->internalDamping();
+	double cThis = negative ? cNeg : cPos;
+	Vec3D<double> f, m, fD, mD;
+	beamProduct(sqA1, sqA2xIp, sqB1, sqB2xFMp, sqB3xIp, v1, w1, v2, w2, negative, f, m);
+	beamProduct(sqA1, sqA2xIp, sqB1, sqB2xFMp, sqB3xIp, cNeg*v1, 0.5*cNeg*w1, cPos*v2, 0.5*cPos*w2, negative, fD, mD);
+	f = 0.5*(cThis*f + fD);
+	m = 0.5*(0.5*cThis*m + mD);
+	pL->toAxisOriginal(&f);
+	pL->toAxisOriginal(&m);
+
+	out[0] += f.x; out[1] += f.y; out[2] += f.z;
+	out[3] += m.x; out[4] += m.y; out[5] += m.z;
+}
+
+void CVX_LinearSolver::multiplyC(const std::vector<double>& in, std::vector<double>& out)
+{
+	int vCount = dof/6;
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		double* pOut = &out[6*i];
+		for (int k=0; k<6; k++) pOut[k] = 0;
+
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = voxLinks[6*i+j];
+			if (!pL) continue;
+			const double* pThis = &in[6*i];
+			const double* pOther = &in[6*adjacent[6*i+j]];
+			if (CVX_Voxel::isPositive((CVX_Voxel::linkDirection)j)) linkDampingProduct(pL, pThis, pOther, pOut, true);
+			else linkDampingProduct(pL, pOther, pThis, pOut, false);
+		}
+
+		CVX_MaterialVoxel* pMat = vx->voxel(i)->mat; //global damping acts on each voxel's own velocity
+		for (int k=0; k<3; k++){
+			pOut[k] += pMat->globalDampingTranslateC()*in[6*i+k];
+			pOut[k+3] += pMat->globalDampingRotateC()*in[6*i+k+3];
+		}
+
+		for (int k=0; k<6; k++) if (fixedDof[6*i+k]) pOut[k] = 0;
+	}
+}
+
+void CVX_LinearSolver::multiplyA(const std::vector<double>& in, std::vector<double>& out)
+{
+	int vCount = dof/6;
+
+	//gather the contribution of every link to each voxel. Each link is evaluated from both ends, but no two threads ever write to the same voxel.
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		double* pOut = &out[6*i];
+		for (int k=0; k<6; k++) pOut[k] = 0;
+
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = voxLinks[6*i+j];
+			if (!pL) continue;
+			const double* pThis = &in[6*i];
+			const double* pOther = &in[6*adjacent[6*i+j]];
+			const linkTangent* pT = tangents.empty() ? NULL : &tangents[6*i+j];
+			if (CVX_Voxel::isPositive((CVX_Voxel::linkDirection)j)) linkProduct(pL, pT, pThis, pOther, pOut, true); //this voxel is the negative end of the link
+			else linkProduct(pL, pT, pOther, pThis, pOut, false);
+		}
+		if (massShift != 0) for (int k=0; k<6; k++) pOut[k] += massShift*lumpedMass[6*i+k]*in[6*i+k];
+
+		for (int k=0; k<6; k++) if (fixedDof[6*i+k]) pOut[k] = 0;
+	}
+}
+
+void CVX_LinearSolver::voxelBlocks(int index, double* diag, double* offDiag)
+{
+	double unit[6], zero[6] = {0};
+	for (int k=0; k<36; k++) diag[k] = 0;
+	for (int k=0; k<216; k++) offDiag[k] = 0;
+
+	//assemble column by column
+	for (int c=0; c<6; c++){
+		for (int k=0; k<6; k++) unit[k] = (k==c) ? 1.0 : 0.0;
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = voxLinks[6*index+j];
+			if (!pL) continue;
+			const linkTangent* pT = tangents.empty() ? NULL : &tangents[6*index+j];
+			double colD[6] = {0}, colO[6] = {0};
+			if (CVX_Voxel::isPositive((CVX_Voxel::linkDirection)j)){ //this voxel is the negative end of the link
+				linkProduct(pL, pT, unit, zero, colD, true);
+				linkProduct(pL, pT, zero, unit, colO, true);
+			}
+			else {
+				linkProduct(pL, pT, zero, unit, colD, false);
+				linkProduct(pL, pT, unit, zero, colO, false);
+			}
+			for (int k=0; k<6; k++){
+				diag[6*k+c] += colD[k];
+				offDiag[36*j+6*k+c] = colO[k];
+			}
+		}
+	}
+	if (massShift != 0) for (int k=0; k<6; k++) diag[6*k+k] += massShift*lumpedMass[6*index+k];
+}
+
+void CVX_LinearSolver::setupPreconditioner(solverType type)
+{
+	int vCount = dof/6;
+	bool blockJacobi = (type != CG_JACOBI);
+	precond.assign(blockJacobi ? 36*vCount : 6*vCount, 0.0);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		double K[36], offDiag[216];
+		voxelBlocks(i, K, offDiag);
+
+		//fixed degrees of freedom are decoupled from the rest
+		for (int k=0; k<6; k++){
+			if (!fixedDof[6*i+k]) continue;
+			for (int l=0; l<6; l++) K[6*k+l] = K[6*l+k] = 0;
+			K[6*k+k] = 1;
+		}
 
-		for (int j=0; j<6; j++){ //for each degree of freedom of the current voxel
-			int diagAIndex = jACounter; //index in a and ja of the diagonal element
+		if (!blockJacobi){
+			for (int k=0; k<6; k++) precond[6*i+k] = K[6*k+k] > 0 ? 1.0/K[6*k+k] : 1.0;
+			continue;
+		}
 
-			//diagonal block
-			ja[jACounter++] = 6*i+j; //diagonal element
-			if (j<3){ //2 off-diagonals for first 3 dof, none for the rest
-				ja[jACounter++] = 6*i+blockOff[j][1];
-				ja[jACounter++] = 6*i+blockOff[j][2];
+		//invert the block by gauss-jordan elimination with partial pivoting
+		double* inv = &precond[36*i];
+		for (int k=0; k<6; k++) inv[6*k+k] = 1.0;
+		bool singular = false;
+		for (int c=0; c<6 && !singular; c++){
+			int piv = c;
+			for (int k=c+1; k<6; k++) if (fabs(K[6*k+c]) > fabs(K[6*piv+c])) piv = k;
+			if (K[6*piv+c] == 0){ singular = true; break;}
+			if (piv != c){
+				for (int l=0; l<6; l++){
+					double tmp = K[6*c+l]; K[6*c+l] = K[6*piv+l]; K[6*piv+l] = tmp;
+					tmp = inv[6*c+l]; inv[6*c+l] = inv[6*piv+l]; inv[6*piv+l] = tmp;
+				}
 			}
-		
-			//off-diagonal block(s)
-			int nI2 = i2List.size(); //number of other voxels connected to this one
-			for (int m=0; m<nI2; m++){
-				for (int k=0; k<3; k++)	ja[jACounter++] = 6*i2List[m]+blockOff[j][k];
+			double d = 1.0/K[6*c+c];
+			for (int l=0; l<6; l++){K[6*c+l] *= d; inv[6*c+l] *= d;}
+			for (int k=0; k<6; k++){
+				if (k==c || K[6*k+c] == 0) continue;
+				double f = K[6*k+c];
+				for (int l=0; l<6; l++){K[6*k+l] -= f*K[6*c+l]; inv[6*k+l] -= f*inv[6*c+l];}
 			}
+		}
+		if (singular){ //isolated voxel: fall back to identity
+			for (int k=0; k<36; k++) inv[k] = (k%7==0) ? 1.0 : 0.0;
+		}
+	}
+}
+
+void CVX_LinearSolver::applyPreconditioner(const std::vector<double>& in, std::vector<double>& out, solverType type)
+{
+	if (type == CG_MULTIGRID){
+		levels[0].b = in;
+		vCycle(0);
+		out = levels[0].x;
+		return;
+	}
 
-			ia[iACounter] = ia[iACounter-1] + (jACounter-diagAIndex);
-			iACounter++;
+	bool blockJacobi = (type == CG_BLOCK_JACOBI);
+	int vCount = dof/6;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		if (blockJacobi){
+			const double* inv = &precond[36*i];
+			const double* pIn = &in[6*i];
+			for (int k=0; k<6; k++){
+				double sum = 0;
+				for (int l=0; l<6; l++) sum += inv[6*k+l]*pIn[l];
+				out[6*i+k] = sum;
+			}
+		}
+		else {
+			for (int k=0; k<6; k++) out[6*i+k] = precond[6*i+k]*in[6*i+k];
 		}
 	}
+}
 
+void CVX_LinearSolver::setupMultigrid()
+{
+	int vCount = dof/6;
+	float vSize = (float)vx->voxelSize();
+
+	levels.clear();
+	levels.push_back(mgLevel());
+	mgLevel& fine = levels[0];
+	fine.count = vCount;
+	fine.coord.resize(3*vCount);
+	fine.pos.resize(3*vCount);
+	for (int i=0; i<vCount; i++){
+		CVX_Voxel* pV = vx->voxel(i);
+		fine.coord[3*i] = pV->indexX();
+		fine.coord[3*i+1] = pV->indexY();
+		fine.coord[3*i+2] = pV->indexZ();
+		for (int k=0; k<3; k++) fine.pos[3*i+k] = fine.coord[3*i+k]*vSize;
+	}
 
-	//add in elements to a matrix
-	for (int i=0; i<lCount; i++){
-		CVX_Link* pL = vx->link(i);
-		int i1 = v2i[pL->voxel(true)];
-		int i2 = v2i[pL->voxel(false)];
-		if (i1>i2) {int tmp=i1; i1=i2; i2=tmp;} //swap to keep i1 lower than i2
+	//keep halving until the coarsest level is small enough to factor directly
+	const int maxCoarseNodes = 64, maxLevels = 20;
+	do {
+		coarsen((int)levels.size()-1);
+	} while (levels.back().count > maxCoarseNodes && (int)levels.size() < maxLevels);
+	multigridLevels = (int)levels.size();
+
+	for (int l=0; l<(int)levels.size(); l++){
+		mgLevel& L = levels[l];
+		L.b.assign(6*L.count, 0.0);
+		L.x.assign(6*L.count, 0.0);
+		L.r.assign(6*L.count, 0.0);
+	}
+	for (int l=0; l<(int)levels.size()-1; l++) levels[l].omega = 4.0/(3.0*estimateMaxEigenvalue(l));
+
+	//dense factorization of the coarsest level
+	mgLevel& C = levels.back();
+	int n = 6*C.count;
+	coarseFactor.assign(n*n, 0.0);
+	for (int I=0; I<C.count; I++){
+		for (int s=C.rowStart[I]; s<C.rowStart[I+1]; s++){
+			const double* K = &C.blocks[36*s];
+			int J = C.col[s];
+			for (int k=0; k<6; k++) for (int m=0; m<6; m++) coarseFactor[(6*I+k)*n + 6*J+m] = K[6*k+m];
+		}
+	}
+	factorSymmetric(n, &coarseFactor[0]);
+}
 
-		int ax = (int)pL->axis;
+void CVX_LinearSolver::coarsen(int level)
+{
+	levels.push_back(mgLevel());
+	mgLevel& F = levels[level];
+	mgLevel& C = levels[level+1];
+
+	//aggregate 2x2x2 blocks of fine nodes
+	std::unordered_map<long long, int> c2i;
+	F.parent.resize(F.count);
+	C.count = 0;
+	for (int i=0; i<F.count; i++){
+		int cc[3];
+		for (int k=0; k<3; k++) cc[k] = F.coord[3*i+k] >= 0 ? F.coord[3*i+k]/2 : -((1-F.coord[3*i+k])/2); //round towards negative infinity
+		long long key = (((long long)(cc[0]+(1<<20)))<<42) | (((long long)(cc[1]+(1<<20)))<<21) | (long long)(cc[2]+(1<<20));
+		std::unordered_map<long long, int>::iterator it = c2i.find(key);
+		if (it == c2i.end()){
+			it = c2i.insert(std::make_pair(key, C.count++)).first;
+			for (int k=0; k<3; k++) C.coord.push_back(cc[k]);
+		}
+		F.parent[i] = it->second;
+	}
 
-		for (int j=0; j<6; j++){ //for each DOF
-			int row1 = i1*6+j;
-			int row2 = i2*6+j;
+	C.childStart.assign(C.count+1, 0);
+	for (int i=0; i<F.count; i++) C.childStart[F.parent[i]+1]++;
+	for (int I=0; I<C.count; I++) C.childStart[I+1] += C.childStart[I];
+	C.child.resize(F.count);
+	std::vector<int> fill(C.childStart.begin(), C.childStart.end()-1);
+	for (int i=0; i<F.count; i++) C.child[fill[F.parent[i]]++] = i;
+
+	C.pos.assign(3*C.count, 0.0);
+	for (int I=0; I<C.count; I++){
+		int nChild = C.childStart[I+1]-C.childStart[I];
+		for (int c=C.childStart[I]; c<C.childStart[I+1]; c++) for (int k=0; k<3; k++) C.pos[3*I+k] += F.pos[3*C.child[c]+k]/nChild;
+	}
 
-			//diagonals:
-			if (j<3){
-				float diagValD = (ax==j) ? pL->a1() : pL->b1(); //diagonals on the diagonal block
-				float diagValO = -diagValD; //diagonals on the off-diagonal block
-				addAValue(row1, row1, diagValD);
-				addAValue(row1, row2, diagValO);
-				addAValue(row2, row2, diagValD);
+	//links only join face-adjacent nodes, so each coarse node couples to itself and at most its 6 face neighbors
+	static const int faceOff[6][3] = {{1,0,0},{-1,0,0},{0,1,0},{0,-1,0},{0,0,1},{0,0,-1}};
+	C.rowStart.assign(1, 0);
+	for (int I=0; I<C.count; I++){
+		C.col.push_back(I);
+		for (int j=0; j<6; j++){
+			long long key = (((long long)(C.coord[3*I]+faceOff[j][0]+(1<<20)))<<42) | (((long long)(C.coord[3*I+1]+faceOff[j][1]+(1<<20)))<<21) | (long long)(C.coord[3*I+2]+faceOff[j][2]+(1<<20));
+			std::unordered_map<long long, int>::iterator it = c2i.find(key);
+			if (it != c2i.end()) C.col.push_back(it->second);
+		}
+		C.rowStart.push_back((int)C.col.size());
+	}
+	C.blocks.assign(36*C.col.size(), 0.0);
+
+	//galerkin coarse stiffness: sum of P_a^T * K_ab * P_b over all fine blocks
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int I=0; I<C.count; I++){
+		double diag[36], offDiag[216], Pa[36], Pb[36], KP[36], rel[3];
+		for (int c=C.childStart[I]; c<C.childStart[I+1]; c++){
+			int a = C.child[c];
+			for (int k=0; k<3; k++) rel[k] = F.pos[3*a+k] - C.pos[3*I+k];
+			rigidTransfer(rel, Pa);
+			if (level == 0) for (int k=0; k<6; k++) if (fixedDof[6*a+k]) for (int m=0; m<6; m++) Pa[6*k+m] = 0;
+
+			//gather the fine row of node a
+			int nBlocks = 0;
+			int bIndex[7];
+			const double* Kab[7];
+			if (level == 0){
+				voxelBlocks(a, diag, offDiag);
+				bIndex[nBlocks] = a; Kab[nBlocks++] = diag;
+				for (int j=0; j<6; j++) if (voxLinks[6*a+j]){bIndex[nBlocks] = adjacent[6*a+j]; Kab[nBlocks++] = &offDiag[36*j];}
 			}
 			else {
-				float diagValD = (ax==j%3) ? pL->a2() : 2*pL->b3(); //diagonals on the diagonal block
-				float diagValO = (ax==j%3) ? -pL->a2() : pL->b3(); //diagonals on the off-diagonal block
-				addAValue(row1, row1, diagValD);
-				addAValue(row1, row2, diagValO);
-				addAValue(row2, row2, diagValD);
-			}
-		}
-
-		//off-diagonals:
-		int R1, C1, R2, C2;
-		float val;
-		switch (ax){
-			case 0: //X_AXIS
-				R1 = 1; C1 = 5;
-				R2 = 2; C2 = 4;
-				val = pL->b2();
-				break;
-			case 1: //Y_AXIS
-				R1 = 0; C1 = 5;
-				R2 = 2; C2 = 3;
-				val = -pL->b2();
-				break;
-//			case 2: //Z_AXIS
-			default: //Z_AXIS
-				R1 = 0; C1 = 4;
-				R2 = 1; C2 = 3;
-				val = pL->b2();
-				break;
+				for (int s=F.rowStart[a]; s<F.rowStart[a+1]; s++){bIndex[nBlocks] = F.col[s]; Kab[nBlocks++] = &F.blocks[36*s];}
+			}
+
+			for (int n=0; n<nBlocks; n++){
+				int b = bIndex[n], J = F.parent[b];
+				for (int k=0; k<3; k++) rel[k] = F.pos[3*b+k] - C.pos[3*J+k];
+				rigidTransfer(rel, Pb);
+				if (level == 0) for (int k=0; k<6; k++) if (fixedDof[6*b+k]) for (int m=0; m<6; m++) Pb[6*k+m] = 0;
+
+				for (int k=0; k<6; k++) for (int m=0; m<6; m++){
+					double sum = 0;
+					for (int o=0; o<6; o++) sum += Kab[n][6*k+o]*Pb[6*o+m];
+					KP[6*k+m] = sum;
+				}
+
+				int slot = C.rowStart[I];
+				while (C.col[slot] != J) slot++;
+				double* pBlock = &C.blocks[36*slot];
+				for (int k=0; k<6; k++) for (int m=0; m<6; m++){
+					double sum = 0;
+					for (int o=0; o<6; o++) sum += Pa[6*o+k]*KP[6*o+m];
+					pBlock[6*k+m] += sum;
+				}
+			}
 		}
+	}
 
-		addAValue(i1*6+R1, i1*6+C1, val);
-		addAValue(i1*6+R1, i2*6+C1, val);
-		addAValue(i1*6+C1, i2*6+R1, -val);
-		addAValue(i2*6+R1, i2*6+C1, -val);
+	C.diag.resize(36*C.count);
+	for (int I=0; I<C.count; I++){
+		for (int k=0; k<36; k++) C.diag[36*I+k] = C.blocks[36*C.rowStart[I]+k]; //diagonal block is always first in the row
+		factorSymmetric(6, &C.diag[36*I]);
+	}
+}
 
-		addAValue(i1*6+R2, i1*6+C2, -val);
-		addAValue(i1*6+R2, i2*6+C2, -val);
-		addAValue(i1*6+C2, i2*6+R2, val);
-		addAValue(i2*6+R2, i2*6+C2, val);
+void CVX_LinearSolver::levelMultiply(int level, const std::vector<double>& in, std::vector<double>& out)
+{
+	if (level == 0){ multiplyA(in, out); return; }
+
+	mgLevel& L = levels[level];
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int I=0; I<L.count; I++){
+		double* pOut = &out[6*I];
+		for (int k=0; k<6; k++) pOut[k] = 0;
+		for (int s=L.rowStart[I]; s<L.rowStart[I+1]; s++){
+			const double* K = &L.blocks[36*s];
+			const double* pIn = &in[6*L.col[s]];
+			for (int k=0; k<6; k++) for (int m=0; m<6; m++) pOut[k] += K[6*k+m]*pIn[m];
+		}
 	}
+}
 
-	consolidateA(); //remove all the zeros
+void CVX_LinearSolver::smooth(int level, bool zeroStart)
+{
+	mgLevel& L = levels[level];
+	if (zeroStart) std::fill(L.r.begin(), L.r.end(), 0.0); //skip multiplying by a zero solution
+	else levelMultiply(level, L.x, L.r);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<L.count; i++){
+		double res[6], dx[6];
+		for (int k=0; k<6; k++) res[k] = L.b[6*i+k] - L.r[6*i+k];
+		if (level == 0){
+			const double* inv = &precond[36*i];
+			for (int k=0; k<6; k++){
+				dx[k] = 0;
+				for (int m=0; m<6; m++) dx[k] += inv[6*k+m]*res[m];
+			}
+		}
+		else {
+			for (int k=0; k<6; k++) dx[k] = res[k];
+			solveSymmetric(6, &L.diag[36*i], dx);
+		}
+		for (int k=0; k<6; k++) L.x[6*i+k] += L.omega*dx[k];
+	}
 }
 
+void CVX_LinearSolver::vCycle(int level)
+{
+	mgLevel& L = levels[level];
+	if (level == (int)levels.size()-1){
+		L.x = L.b;
+		solveSymmetric(6*L.count, &coarseFactor[0], &L.x[0]);
+		return;
+	}
+
+	const int sweeps = 1;
+	std::fill(L.x.begin(), L.x.end(), 0.0);
+	for (int i=0; i<sweeps; i++) smooth(level, i==0);
 
-void CVX_LinearSolver::addAValue(int row, int column, float value) //after ia and ja are populated, set a value in the a matrix. Row and Column are 0-based!
+	//restrict the residual: forces add up, moments pick up the lever arm of each force about the coarse node
+	levelMultiply(level, L.x, L.r);
+	mgLevel& C = levels[level+1];
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int I=0; I<C.count; I++){
+		double* pB = &C.b[6*I];
+		for (int k=0; k<6; k++) pB[k] = 0;
+		for (int c=C.childStart[I]; c<C.childStart[I+1]; c++){
+			int a = C.child[c];
+			double f[6];
+			for (int k=0; k<6; k++) f[k] = L.b[6*a+k] - L.r[6*a+k];
+			double rx = L.pos[3*a]-C.pos[3*I], ry = L.pos[3*a+1]-C.pos[3*I+1], rz = L.pos[3*a+2]-C.pos[3*I+2];
+			pB[0] += f[0]; pB[1] += f[1]; pB[2] += f[2];
+			pB[3] += f[3] + ry*f[2] - rz*f[1];
+			pB[4] += f[4] + rz*f[0] - rx*f[2];
+			pB[5] += f[5] + rx*f[1] - ry*f[0];
+		}
+	}
+
+	vCycle(level+1);
+
+	//prolong the coarse correction as a rigid body motion of each aggregate
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int a=0; a<L.count; a++){
+		int I = L.parent[a];
+		const double* u = &C.x[6*I];
+		double rx = L.pos[3*a]-C.pos[3*I], ry = L.pos[3*a+1]-C.pos[3*I+1], rz = L.pos[3*a+2]-C.pos[3*I+2];
+		double dx[6] = {u[0] + u[4]*rz - u[5]*ry, u[1] + u[5]*rx - u[3]*rz, u[2] + u[3]*ry - u[4]*rx, u[3], u[4], u[5]};
+		for (int k=0; k<6; k++) if (level != 0 || !fixedDof[6*a+k]) L.x[6*a+k] += dx[k];
+	}
+
+	for (int i=0; i<sweeps; i++) smooth(level, false);
+}
+
+double CVX_LinearSolver::estimateMaxEigenvalue(int level)
+{
+	//a few power iterations on the block jacobi preconditioned stiffness. Uses the level's b and x as scratch space.
+	mgLevel& L = levels[level];
+	int n = 6*L.count;
+	for (int i=0; i<n; i++) L.x[i] = (level == 0 && fixedDof[i]) ? 0.0 : 1.0 + 0.1*(i%7);
+
+	double lambda = 1.0;
+	for (int it=0; it<15; it++){
+		double norm = 0;
+		for (int i=0; i<n; i++) norm += L.x[i]*L.x[i];
+		norm = sqrt(norm);
+		if (norm == 0) return 1.0;
+		for (int i=0; i<n; i++) L.x[i] /= norm;
+
+		//x <- D^-1 A x. Smoothing from a zero solution with b = -A x gives exactly -omega D^-1 A x.
+		levelMultiply(level, L.x, L.b);
+		for (int i=0; i<n; i++) L.b[i] = -L.b[i];
+		std::fill(L.x.begin(), L.x.end(), 0.0);
+		L.omega = 1.0;
+		smooth(level, true);
+		for (int i=0; i<n; i++) L.x[i] = -L.x[i];
+
+		double newNorm = 0;
+		for (int i=0; i<n; i++) newNorm += L.x[i]*L.x[i];
+		lambda = sqrt(newNorm);
+	}
+	std::fill(L.x.begin(), L.x.end(), 0.0);
+	std::fill(L.b.begin(), L.b.end(), 0.0);
+	return lambda > 0 ? lambda : 1.0;
+}
+
+void CVX_LinearSolver::rigidTransfer(const double* r, double* P)
+{
+	//translation of a point offset by r from the coarse node is u + theta x r. Rotation is unchanged.
+	for (int k=0; k<36; k++) P[k] = (k%7==0) ? 1.0 : 0.0;
+	P[6*0+4] = r[2];	P[6*0+5] = -r[1];
+	P[6*1+3] = -r[2];	P[6*1+5] = r[0];
+	P[6*2+3] = r[1];	P[6*2+4] = -r[0];
+}
+
+void CVX_LinearSolver::factorSymmetric(int n, double* A)
 {
-	int curInd = ia[row];
-	int endInd = ia[row+1]; //still 1-based ia and ja
-	while (ja[curInd] != column){if (++curInd == endInd) return;}
-	a[curInd]+=value;
+	//row major. On output the diagonal holds D and the strict lower triangle holds L.
+	for (int j=0; j<n; j++){
+		double orig = A[n*j+j];
+		double d = orig;
+		for (int k=0; k<j; k++) d -= A[n*j+k]*A[n*j+k]*A[n*k+k];
+		if (d <= 1e-10*fabs(orig)){ //no independent stiffness left in this direction: drop it
+			A[n*j+j] = 0;
+			for (int i=j+1; i<n; i++) A[n*i+j] = 0;
+			continue;
+		}
+		A[n*j+j] = d;
+		for (int i=j+1; i<n; i++){
+			double sum = A[n*i+j];
+			for (int k=0; k<j; k++) sum -= A[n*i+k]*A[n*j+k]*A[n*k+k];
+			A[n*i+j] = sum/d;
+		}
+	}
+}
+
+void CVX_LinearSolver::solveSymmetric(int n, const double* LD, double* x)
+{
+	for (int i=0; i<n; i++) for (int k=0; k<i; k++) x[i] -= LD[n*i+k]*x[k];
+	for (int i=0; i<n; i++) x[i] = LD[n*i+i] > 0 ? x[i]/LD[n*i+i] : 0;
+	for (int i=n-1; i>=0; i--) for (int k=i+1; k<n; k++) x[i] -= LD[n*k+i]*x[k];
 }
 
+bool CVX_LinearSolver::solveDirect()
+{
+	//the factorization only needs rebuilding if the stiffness or fixed degrees of freedom changed
+	std::vector<float> stiffness;
+	linkStiffness(stiffness);
+	if (!factorValid || factoredType != DIRECT || stiffness != factoredStiffness || fixedDof != factoredFixed){
+		if (!directAnalyzed){
+			updateProgress(0.02f, "Direct: Ordering...");
+			analyzeDirect();
+			directAnalyzed = true;
+			if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;}
+		}
+		factorValid = false;
+		if (!factorDirect()) return false;
+		factorValid = true;
+		factoredType = DIRECT;
+		factoredStiffness.swap(stiffness);
+		factoredFixed = fixedDof;
+		factorizationCount++;
+	}
+	updateProgress(0.85f, "Direct: Solving...");
+
+	//fixed degrees of freedom are decoupled in the factorization, so their prescribed displacements move to the right hand side
+	q.resize(dof);
+	for (int c=0; c<nrhs; c++){
+		double* xc = &x[c*dof];
+		const double* bc = &b[c*dof];
+		std::vector<double> rhs(xc, xc+dof);
+		multiplyA(rhs, q);
+		for (int i=0; i<dof; i++) rhs[i] = fixedDof[i] ? 0.0 : bc[i]-q[i];
+		solveDirectFactor(&rhs[0]);
+		for (int i=0; i<dof; i++) if (!fixedDof[i]) xc[i] = rhs[i];
+	}
+	return true;
+}
 
-void CVX_LinearSolver::consolidateA() //gets rid of all the zeros for quicker solving! (maybe...). Assumes 1-based arrays!
+void CVX_LinearSolver::analyzeDirect()
 {
-	int index = 0; //master index of longer arrays
-	int shift = 0;
+	int vCount = dof/6;
+	std::vector<int> nodes(vCount);
+	for (int i=0; i<vCount; i++) nodes[i] = i;
+	elimOrder.clear();
+	elimOrder.reserve(vCount);
+	dissect(nodes, 0, vCount);
+	elimPos.resize(vCount);
+	for (int k=0; k<vCount; k++) elimPos[elimOrder[k]] = k;
+
+	//symbolic factorization by whole voxels: the structure of each column of L is its higher neighbors merged with the structure of its children in the elimination tree
+	std::vector<std::vector<int> > colRows(vCount);
+	std::vector<int> parent(vCount, -1), childHead(vCount, -1), childNext(vCount, -1), snOf(vCount);
+	double snNonzeros = 0; //true nonzero voxel blocks in the columns of the current supernode
+	snFirst.clear();
+	snRowStart.assign(1, 0);
+	snRows.clear();
+	for (int k=0; k<vCount; k++){
+		std::vector<int>& rows = colRows[k];
+		int v = elimOrder[k];
+		for (int j=0; j<6; j++){
+			int w = adjacent[6*v+j];
+			if (w >= 0 && elimPos[w] > k) rows.push_back(elimPos[w]);
+		}
+		for (int c=childHead[k]; c!=-1; c=childNext[c]) rows.insert(rows.end(), colRows[c].begin()+1, colRows[c].end()); //the first row of a child is k itself
+		std::sort(rows.begin(), rows.end());
+		rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+		if (!rows.empty()){
+			parent[k] = rows[0];
+			childNext[k] = childHead[rows[0]];
+			childHead[rows[0]] = k;
+		}
+
+		//k continues the current supernode if it is the parent of the previous column and storing the columns of the supernode as one dense block adds few zeros
+		bool merge = false;
+		if (k>0 && parent[k-1] == k){
+			double nc = k-snFirst.back()+1, nb = (double)rows.size();
+			double dense = nc*(nc+1)/2 + nc*nb;
+			double zeros = dense - (snNonzeros + rows.size()+1);
+			merge = nc <= 4 || zeros <= (nc <= 16 ? 0.5 : 0.1)*dense;
+		}
+		if (!merge){
+			if (k>0){
+				snRows.insert(snRows.end(), colRows[k-1].begin(), colRows[k-1].end());
+				snRowStart.push_back((int)snRows.size());
+			}
+			snFirst.push_back(k);
+			snNonzeros = 0;
+		}
+		snNonzeros += rows.size()+1;
+		snOf[k] = (int)snFirst.size()-1;
+
+		for (int c=childHead[k]; c!=-1; c=childNext[c]) std::vector<int>().swap(colRows[c]);
+	}
+	snRows.insert(snRows.end(), colRows[vCount-1].begin(), colRows[vCount-1].end());
+	snRowStart.push_back((int)snRows.size());
+	snFirst.push_back(vCount);
+
+	int nSuper = (int)snFirst.size()-1;
+	snParent.resize(nSuper);
+	snFactorStart.resize(nSuper+1);
+	snFactorStart[0] = 0;
+	for (int s=0; s<nSuper; s++){
+		int last = snFirst[s+1]-1;
+		snParent[s] = parent[last] < 0 ? -1 : snOf[parent[last]];
+		size_t p = 6*(snFirst[s+1]-snFirst[s]), n = p + 6*(snRowStart[s+1]-snRowStart[s]);
+		snFactorStart[s+1] = snFactorStart[s] + p*n;
+	}
+}
+
+void CVX_LinearSolver::dissect(std::vector<int>& nodes, int begin, int end)
+{
+	//small groups are eliminated as is
+	if (end-begin <= 8){
+		for (int i=begin; i<end; i++) elimOrder.push_back(nodes[i]);
+		return;
+	}
+
+	//split across the longest extent of the group's bounding box at the median voxel
+	int minI[3] = {INT_MAX, INT_MAX, INT_MAX}, maxI[3] = {INT_MIN, INT_MIN, INT_MIN};
+	std::vector<int> coord(end-begin);
+	for (int i=begin; i<end; i++){
+		CVX_Voxel* pV = vx->voxel(nodes[i]);
+		int c[3] = {pV->indexX(), pV->indexY(), pV->indexZ()};
+		for (int k=0; k<3; k++){
+			if (c[k] < minI[k]) minI[k] = c[k];
+			if (c[k] > maxI[k]) maxI[k] = c[k];
+		}
+	}
+	int axis = 0;
+	for (int k=1; k<3; k++) if (maxI[k]-minI[k] > maxI[axis]-minI[axis]) axis = k;
+	for (int i=begin; i<end; i++){
+		CVX_Voxel* pV = vx->voxel(nodes[i]);
+		coord[i-begin] = axis==0 ? pV->indexX() : (axis==1 ? pV->indexY() : pV->indexZ());
+	}
+	std::vector<int> sorted(coord);
+	std::nth_element(sorted.begin(), sorted.begin()+sorted.size()/2, sorted.end());
+	int mid = sorted[sorted.size()/2];
+
+	//links only join lattice neighbors, so the layer of voxels at mid separates the voxels on either side of it
+	std::vector<int> lower, upper, layer;
+	for (int i=begin; i<end; i++){
+		int c = coord[i-begin];
+		if (c < mid) lower.push_back(nodes[i]);
+		else if (c > mid) upper.push_back(nodes[i]);
+		else layer.push_back(nodes[i]);
+	}
+	int upperStart = begin+(int)lower.size(), layerStart = upperStart+(int)upper.size();
+	std::copy(lower.begin(), lower.end(), nodes.begin()+begin);
+	std::copy(upper.begin(), upper.end(), nodes.begin()+upperStart);
+
+	dissect(nodes, begin, upperStart);
+	dissect(nodes, upperStart, layerStart);
+	elimOrder.insert(elimOrder.end(), layer.begin(), layer.end());
+}
+
+//out[i] -= sum over c of cols[c][i]*w[c] for i in [0, len). Columns are applied four at a time so out only passes through the cache once per four.
+static void columnUpdate(double* out, int len, const double* const* cols, const double* w, int count)
+{
+	int c = 0;
+	for (; c+4<=count; c+=4){
+		const double *c0 = cols[c], *c1 = cols[c+1], *c2 = cols[c+2], *c3 = cols[c+3];
+		double w0 = w[c], w1 = w[c+1], w2 = w[c+2], w3 = w[c+3];
+		for (int i=0; i<len; i++) out[i] -= c0[i]*w0 + c1[i]*w1 + c2[i]*w2 + c3[i]*w3;
+	}
+	for (; c<count; c++){
+		const double* c0 = cols[c];
+		double w0 = w[c];
+		for (int i=0; i<len; i++) out[i] -= c0[i]*w0;
+	}
+}
+
+bool CVX_LinearSolver::factorDirect()
+{
+	int vCount = dof/6, nSuper = (int)snFirst.size()-1;
+	directFactor.assign(snFactorStart[nSuper], 0.0);
+
+	std::vector<int> childHead(nSuper, -1), childNext(nSuper, -1);
+	for (int s=nSuper-1; s>=0; s--){
+		if (snParent[s] < 0) continue;
+		childNext[s] = childHead[snParent[s]];
+		childHead[snParent[s]] = s;
+	}
+
+	std::vector<int> local(vCount, -1); //voxel position within the current front of each elimination position
+	std::vector<std::vector<double> > update(nSuper); //schur complement of each supernode until its parent absorbs it
+
+	//children always precede their parents in elimination order
+	for (int s=0; s<nSuper; s++){
+		if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;}
+		if (s%64 == 0) updateProgress(0.05f+0.8f*s/nSuper, "Direct: Numerical factorization...");
+
+		int first = snFirst[s], nc = snFirst[s+1]-first, nb = snRowStart[s+1]-snRowStart[s];
+		const int* below = nb ? &snRows[snRowStart[s]] : NULL;
+		int p = 6*nc, n = 6*(nc+nb), ns = n-p;
+		double* F = &directFactor[snFactorStart[s]]; //the pivot columns of the front: column j starts at F+j*n
+		std::vector<double> S((size_t)ns*ns, 0.0); //the rest of the front (lower triangle), column major
+		std::vector<double> scale(p); //original diagonal of each pivot column
+		for (int l=0; l<nc; l++) local[first+l] = l;
+		for (int l=0; l<nb; l++) local[below[l]] = nc+l;
+
+		//stiffness of the voxels in this supernode with themselves and every voxel eliminated later
+		for (int l=0; l<nc; l++){
+			int v = elimOrder[first+l];
+			double diag[36], offDiag[216];
+			voxelBlocks(v, diag, offDiag);
+			for (int k=0; k<6; k++){ //fixed degrees of freedom are decoupled from the rest
+				if (fixedDof[6*v+k]){
+					for (int m=0; m<6; m++) diag[6*k+m] = diag[6*m+k] = 0;
+					diag[6*k+k] = 1;
+					for (int j=0; j<6; j++) for (int m=0; m<6; m++) offDiag[36*j+6*k+m] = 0;
+				}
+				for (int j=0; j<6; j++) if (adjacent[6*v+j] >= 0 && fixedDof[6*adjacent[6*v+j]+k]) for (int m=0; m<6; m++) offDiag[36*j+6*m+k] = 0;
+			}
+
+			for (int c=0; c<6; c++){
+				scale[6*l+c] = diag[6*c+c];
+				for (int r=c; r<6; r++) F[(size_t)(6*l+c)*n + 6*l+r] += diag[6*r+c];
+			}
+			for (int j=0; j<6; j++){
+				int w = adjacent[6*v+j];
+				if (w < 0 || elimPos[w] < first+l) continue; //belongs to the column of the other voxel
+				int L = local[elimPos[w]];
+				for (int c=0; c<6; c++) for (int m=0; m<6; m++) F[(size_t)(6*l+c)*n + 6*L+m] += offDiag[36*j+6*c+m];
+			}
+		}
+
+		//add in the schur complements of the children
+		for (int c=childHead[s]; c!=-1; c=childNext[c]){
+			const int* cRows = &snRows[snRowStart[c]];
+			int m = 6*(snRowStart[c+1]-snRowStart[c]);
+			const double* U = &update[c][0];
+			for (int jc=0; jc<m; jc++){
+				int J = 6*local[cRows[jc/6]] + jc%6;
+				for (int ic=jc; ic<m; ic++){
+					int I = 6*local[cRows[ic/6]] + ic%6; //rows are ascending in both fronts, so I>=J
+					if (J < p) F[(size_t)J*n+I] += U[(size_t)jc*m+ic];
+					else S[(size_t)(J-p)*ns + I-p] += U[(size_t)jc*m+ic];
+				}
+			}
+			std::vector<double>().swap(update[c]);
+		}
+
+		//dense LDL^T of the pivot columns in panels of 48 so the trailing update works from cache
+		for (int jb=0; jb<p; jb+=48){
+			int je = std::min(jb+48, p);
+			for (int j=jb; j<je; j++){
+				double* Lj = F + (size_t)j*n;
+				double d = Lj[j];
+				if (!(d > 1e-10*scale[j])){ errorMsg = "Stiffness matrix is singular. Check that the structure is sufficiently fixed.\n"; return false;}
+				for (int i=j+1; i<n; i++) Lj[i] /= d;
+				for (int k=j+1; k<je; k++){
+					double w = Lj[k]*d;
+					double* Fk = F + (size_t)k*n;
+					for (int i=k; i<n; i++) Fk[i] -= Lj[i]*w;
+				}
+			}
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 8) if((size_t)(p-je)*n > 20000)
+#endif
+			for (int k=je; k<p; k++){
+				const double* cols[48];
+				double w[48];
+				int count = 0;
+				for (int j=jb; j<je; j++){
+					const double* Lj = F + (size_t)j*n;
+					if (Lj[k] == 0) continue;
+					cols[count] = Lj+k;
+					w[count++] = Lj[k]*Lj[j];
+				}
+				columnUpdate(F + (size_t)k*n + k, n-k, cols, w, count);
+			}
+		}
 
-	for (int i=0; i<dof; i++){ //for each element of ia;
-		ia[i+1] -= shift;
-		while (index < ia[i+1]){ //for everything on this row...
-			while (a[index + shift] == 0){ //if this is an element to remove
-				shift++;
-				ia[i+1]--;
+		//schur complement for the parent
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 8) if((size_t)ns*ns*p > 100000)
+#endif
+		for (int k=0; k<ns; k++){
+			std::vector<const double*> cols(p);
+			std::vector<double> w(p);
+			int count = 0;
+			for (int j=0; j<p; j++){
+				const double* Lj = F + (size_t)j*n + p;
+				if (Lj[k] == 0) continue;
+				cols[count] = Lj+k;
+				w[count++] = Lj[k]*F[(size_t)j*n+j];
 			}
-			a[index] = a[index+shift];
-			ja[index] = ja[index+shift];
+			columnUpdate(&S[(size_t)k*ns+k], ns-k, &cols[0], &w[0], count);
+		}
+		update[s].swap(S);
+
+		for (int l=0; l<nc; l++) local[first+l] = -1;
+		for (int l=0; l<nb; l++) local[below[l]] = -1;
+	}
+	return true;
+}
 
-			index++;
+void CVX_LinearSolver::solveDirectFactor(double* v)
+{
+	int vCount = dof/6, nSuper = (int)snFirst.size()-1;
+	std::vector<double> y(dof);
+	for (int k=0; k<vCount; k++) for (int m=0; m<6; m++) y[6*k+m] = v[6*elimOrder[k]+m];
+
+	std::vector<int> rowDof; //position in y of each row of the current supernode
+	for (int pass=0; pass<2; pass++){ //forward substitution with L, then backward with L^T
+		for (int t=0; t<nSuper; t++){
+			int s = pass==0 ? t : nSuper-1-t;
+			int first = snFirst[s], nb = snRowStart[s+1]-snRowStart[s];
+			int p = 6*(snFirst[s+1]-first), n = p+6*nb;
+			const double* F = &directFactor[snFactorStart[s]];
+			rowDof.resize(n);
+			for (int i=0; i<p; i++) rowDof[i] = 6*first+i;
+			for (int i=0; i<6*nb; i++) rowDof[p+i] = 6*snRows[snRowStart[s]+i/6] + i%6;
+			double* yS = &y[6*first];
+
+			if (pass == 0){
+				for (int j=0; j<p; j++){
+					const double* Lj = F + (size_t)j*n;
+					double yj = yS[j];
+					if (yj == 0) continue;
+					for (int i=j+1; i<n; i++) y[rowDof[i]] -= Lj[i]*yj;
+				}
+				for (int j=0; j<p; j++) yS[j] /= F[(size_t)j*n+j];
+			}
+			else {
+				for (int j=p-1; j>=0; j--){
+					const double* Lj = F + (size_t)j*n;
+					double sum = 0;
+					for (int i=j+1; i<n; i++) sum += Lj[i]*y[rowDof[i]];
+					yS[j] -= sum;
+				}
+			}
 		}
 	}
 
-	a.resize(index); //potential to free up some memory
-	ja.resize(index);
+	for (int k=0; k<vCount; k++) for (int m=0; m<6; m++) v[6*elimOrder[k]+m] = y[6*k+m];
 }
 
-void CVX_LinearSolver::applyBX() //Assumes 0-based indices
+void CVX_LinearSolver::buildAdjacency(bool structure)
 {
-	x.resize(dof);
-	b.resize(dof);
-	std::fill(b.begin(), b.end(), 0.0); //start with no forces applied
-	std::vector<int> aToZero; //list of "a" matrix indices to set to zero at the end.
-	std::vector<bool> fixed(dof); //any fixed degrees of freedom
+	int vCount = vx->voxelCount();
+
+	if (structure) adjacent.assign(6*vCount, -1);
 
+	voxLinks.assign(6*vCount, (CVX_Link*)NULL);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		CVX_Voxel* pV = vx->voxel(i);
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = pV->link((CVX_Voxel::linkDirection)j);
+			if (pL){
+				voxLinks[6*i+j] = pL;
+				if (structure) adjacent[6*i+j] = pL->voxel(j%2 == 0)->listIndex; //the voxel across the link (positive end for the positive directions). Solver indices are voxel list indices.
+			}
+		}
+	}
+}
+
+void CVX_LinearSolver::linkStiffness(std::vector<float>& stiffness)
+{
+	int vCount = dof/6;
+	stiffness.clear();
+	if (massShift != 0) for (int i=0; i<vCount; i++){ //shifted mass on the diagonal
+		stiffness.push_back((float)(massShift*lumpedMass[6*i]));
+		stiffness.push_back((float)(massShift*lumpedMass[6*i+3]));
+	}
+	for (int i=0; i<vCount; i++){
+		for (int j=0; j<6; j+=2){ //positive directions only so each link is visited once
+			CVX_Link* pL = voxLinks[6*i+j];
+			if (!pL) continue;
+			stiffness.push_back(pL->a1());
+			stiffness.push_back(pL->a2());
+			stiffness.push_back(pL->b1());
+			stiffness.push_back(pL->b2());
+			stiffness.push_back(pL->b3());
+			if (tangents.empty()) continue;
+			const linkTangent& t = tangents[6*i+j];
+			stiffness.push_back((float)t.a1);
+			stiffness.push_back((float)t.rot.w);
+			stiffness.push_back((float)t.rot.x);
+			stiffness.push_back((float)t.rot.y);
+			stiffness.push_back((float)t.rot.z);
+		}
+	}
+}
+
+void CVX_LinearSolver::calculatePattern()
+{
+	//Upper triangle only. Each voxel owns its 6 rows: the diagonal block (3 entries in each translational row, 1 in each rotational row) followed by 3 entries per link to a higher-indexed voxel in ascending voxel order.
 	int vCount = vx->voxelCount();
 
-	//fill in all displacements first: (and build list to note which are prescribed/fixed)
+	//rank of each link among the higher-indexed neighbors of its voxel gives the exact row lengths
+	std::vector<int> upCount(vCount+1, 0);
+	linkSlot.assign(6*vCount, -1);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
 	for (int i=0; i<vCount; i++){
-		CVX_Voxel* pVox = vx->voxel(i);
-		bool hasExternal = pVox->externalExists();
-		Vec3D<double> position(pVox->displacement());
-		Vec3D<double> angle = (pVox->orientation().w == 1) ? Vec3D<double>(0,0,0) : pVox->orientation().ToRotationVector();
-		Vec3D<float> force(hasExternal ? pVox->external()->force() : Vec3D<float>());
-		Vec3D<float> moment(hasExternal ? pVox->external()->moment() : Vec3D<float>());
-//		Vec3D<float> force(pVox->externalForce());
-//		Vec3D<float> moment(pVox->externalMoment());
-		
+		int n = 0;
 		for (int j=0; j<6; j++){
-			int thisDof = 6*i+j;
-			x[thisDof] = (j<3)?position[j]:angle[j%3]; //add in displacement
-			fixed[thisDof] = hasExternal ? pVox->external()->isFixed(dofMap[j]) : false; //note if it is presecribed/fixed
-//			fixed[thisDof] = pVox->isFixed(dofMap[j]); //note if it is presecribed/fixed
-			if (!fixed[thisDof]) b[thisDof] = (j<3)?force[j]:moment[j%3]; //add in forces if it's not a fixed degree of freedom
+			int other = adjacent[6*i+j];
+			if (other <= i) continue;
+			int rank = 0;
+			for (int k=0; k<6; k++) if (adjacent[6*i+k] > i && adjacent[6*i+k] < other) rank++;
+			linkSlot[6*i+j] = rank;
+			n++;
 		}
+		upCount[i+1] = n;
 	}
-	
-	//Add in forces that make prescribed displacements work and mark the a values that are to be removed
-	for (int thisDof=0; thisDof<dof; thisDof++){
-		if (fixed[thisDof]){
-			int dofCounter = 0; //keep track of the row we're searching when examining the column above the active diagonal element, or the column when in the final row.
-			for (int k=0; k<ia[thisDof+1]; k++){ //up through the end of this row
-				bool thisRow = (k>=ia[thisDof]); //searching the final row (otherwise searching the column above)
-				if (thisRow) dofCounter = ja[k]; //keep track of the column as we step through the row.
-				if (k==ia[dofCounter+1]) dofCounter++; //keep track of the row as we step through columns
-
-				if (ja[k]==thisDof || thisRow){
-					b[dofCounter] -= x[thisDof]*a[k];
-					if (k!=ia[thisDof]) aToZero.push_back(k); //if not diagonal, it will be zeroed. However, defer zeroing since some of these values could be used twice...
-				}
 
+	std::vector<int> voxStart(vCount+1, 0);
+	for (int i=0; i<vCount; i++) voxStart[i+1] = voxStart[i] + 12 + 18*upCount[i+1];
+	int nnz = voxStart[vCount];
+
+	ia.resize(dof+1);
+	ja.resize(nnz);
+	ia[dof] = nnz;
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		int rowStart = voxStart[i];
+		for (int r=0; r<6; r++){
+			ia[6*i+r] = rowStart;
+			int* pJa = &ja[rowStart];
+			*pJa++ = 6*i+r;
+			if (r<3){
+				*pJa++ = 6*i+blockOff[r][1];
+				*pJa++ = 6*i+blockOff[r][2];
 			}
+			for (int j=0; j<6; j++){
+				if (linkSlot[6*i+j] < 0) continue;
+				int* pBlock = pJa + 3*linkSlot[6*i+j];
+				for (int k=0; k<3; k++) pBlock[k] = 6*adjacent[6*i+j]+blockOff[r][k];
+			}
+			rowStart += (r<3 ? 3 : 1) + 3*upCount[i+1];
 		}
 	}
+}
 
-	//for all fixed degrees of freedom, set the a value to something that will work out
-	for (int thisDof=0; thisDof<dof; thisDof++){
-		if (fixed[thisDof]){
-			a[ia[thisDof]] = 1.0; //unit diagonal
-			b[thisDof] = x[thisDof];
+void CVX_LinearSolver::calculateA() //calculates the big stiffness matrix!
+{
+	int vCount = vx->voxelCount();
+	a.assign(ja.size(), 0.0);
+
+	//No two voxels write to the same rows.
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		const int* rowStart = &ia[6*i];
+		if (massShift != 0) for (int r=0; r<6; r++) a[rowStart[r]] += massShift*lumpedMass[6*i+r];
+
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = voxLinks[6*i+j];
+			if (!pL) continue;
+			int ax = (int)pL->axis;
+			bool thisNeg = CVX_Voxel::isPositive((CVX_Voxel::linkDirection)j); //this voxel is the negative end of the link
+			double axial[6] = {pL->b1(), pL->b1(), pL->b1(), 2*pL->b3(), 2*pL->b3(), 2*pL->b3()}; //diagonals on the diagonal block
+			double across[6] = {-pL->b1(), -pL->b1(), -pL->b1(), pL->b3(), pL->b3(), pL->b3()}; //diagonals on the off-diagonal block
+			axial[ax] = pL->a1(); across[ax] = -pL->a1();
+			axial[ax+3] = pL->a2(); across[ax+3] = -pL->a2();
+
+			for (int r=0; r<6; r++) a[rowStart[r]] += axial[r];
+			for (int c=0; c<2; c++){ //bending couplings within this voxel
+				int R = couple[ax][c][0], C = couple[ax][c][1];
+				double val = couple[ax][c][2]*pL->b2();
+				a[rowStart[R] + blockSlot(R, C)] += thisNeg ? val : -val;
+			}
+
+			if (linkSlot[6*i+j] < 0) continue; //the lower-indexed voxel owns the off-diagonal block
+			int slot = 3*linkSlot[6*i+j];
+			for (int r=0; r<6; r++) a[rowStart[r] + (r<3 ? 3 : 1) + slot + blockSlot(r, r)] = across[r];
+			for (int c=0; c<2; c++){
+				int R = couple[ax][c][0], C = couple[ax][c][1];
+				double val = couple[ax][c][2]*pL->b2();
+				a[rowStart[R] + 3 + slot + blockSlot(R, C)] = thisNeg ? val : -val; //translation of this voxel with rotation of the other
+				a[rowStart[C] + 1 + slot + blockSlot(C, R)] = thisNeg ? -val : val; //rotation of this voxel with translation of the other
+			}
+		}
+	}
+}
+
+void CVX_LinearSolver::applyBX() //Assumes 0-based indices. b, x and fixedDof come from setupBoundaryConditions().
+{
+	//Move the stiffness of prescribed displacements over to the forces of every load case and decouple the fixed degrees of freedom. Each stored (upper triangle) value couples its row and column symmetrically.
+	for (int row=0; row<dof; row++){
+		for (int k=ia[row]; k<ia[row+1]; k++){
+			int col = ja[k];
+			if (col == row){
+				if (fixedDof[row]) a[k] = 1.0; //unit diagonal
+				continue;
+			}
+			if (!fixedDof[row] && !fixedDof[col]) continue;
+
+			for (int c=0; c<nrhs; c++){
+				double* bc = &b[c*dof];
+				const double* xc = &x[c*dof];
+				if (!fixedDof[row]) bc[row] -= a[k]*xc[col];
+				if (!fixedDof[col]) bc[col] -= a[k]*xc[row];
+			}
+			a[k] = 0;
 		}
 	}
 
-	for (int i=0; i<(int)aToZero.size(); i++) a[aToZero[i]] = 0; //zero out the ones we've marked accordingly
+	for (int thisDof=0; thisDof<dof; thisDof++){
+		if (fixedDof[thisDof]) for (int c=0; c<nrhs; c++) b[c*dof+thisDof] = x[c*dof+thisDof];
+	}
 }
 
 void CVX_LinearSolver::convertTo1Base()
@@ -330,6 +1653,12 @@ void CVX_LinearSolver::convertTo1Base()
 	for (int i=0; i<(int)ja.size(); i++) ja[i]++;
 }
 
+void CVX_LinearSolver::convertTo0Base()
+{
+	for (int i=0; i<(int)ia.size(); i++) ia[i]--;
+	for (int i=0; i<(int)ja.size(); i++) ja[i]--;
+}
+
 void CVX_LinearSolver::postResults() //overwrites state of voxelyze object with the results
 {
 	int vCount = vx->voxelCount();
@@ -344,6 +1673,438 @@ void CVX_LinearSolver::postResults() //overwrites state of voxelyze object with
 
 
 
+double CVX_LinearSolver::nonlinearResidual(double loadFactor, const std::vector<float>& maxStrain, const std::vector<float>& strainOffset)
+{
+	int vCount = dof/6, linkCount = vx->linkCount();
+	double voxSize = vx->voxelSize();
+	bool Diverged = false;
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<linkCount; i++){
+		CVX_Link* pL = vx->link(i);
+		pL->maxStrain = maxStrain[i];
+		pL->strainOffset = strainOffset[i];
+		pL->setBoolState(CVX_Link::LOCAL_VELOCITY_VALID, false); //iterations must not be mistaken for motion by the internal damping
+		pL->updateForces();
+		if (pL->axialStrain() > 100) Diverged = true;
+	}
+
+	//force() and moment() include the full applied loads: take away the part not applied yet. The voxels are at rest, so there is no damping.
+	double refForce = 0, maxF = 0, maxM = 0, sum = 0; //the sum catches NaN, which max() would skip
+	for (int i=0; i<vCount; i++){
+		CVX_Voxel* pV = vx->voxel(i);
+		Vec3D<double> appliedF(0, 0, pV->mat->gravityForce()), appliedM;
+		if (pV->externalExists()){
+			appliedF += Vec3D<double>(pV->external()->force());
+			appliedM = Vec3D<double>(pV->external()->moment());
+		}
+		refForce = std::max(refForce, std::max(appliedF.Length(), appliedM.Length()/voxSize));
+
+		Vec3D<double> f = pV->force() - (1-loadFactor)*appliedF, m = pV->moment() - (1-loadFactor)*appliedM;
+		for (int j=0; j<3; j++){
+			b[6*i+j] = fixedDof[6*i+j] ? 0.0 : f[j];
+			b[6*i+3+j] = fixedDof[6*i+3+j] ? 0.0 : m[j];
+		}
+		for (int j=0; j<6; j++) sum += b[6*i+j];
+		maxF = std::max(maxF, Vec3D<double>(b[6*i], b[6*i+1], b[6*i+2]).Length());
+		maxM = std::max(maxM, Vec3D<double>(b[6*i+3], b[6*i+4], b[6*i+5]).Length());
+	}
+	for (int i=0; i<linkCount; i++) refForce = std::max(refForce, vx->link(i)->force(false).Length());
+
+	double maxResidual = std::max(maxF, maxM/voxSize);
+	if (Diverged || !(sum == sum)) return HUGE_VAL;
+	if (refForce == 0) return maxResidual == 0 ? 0 : 1;
+	return maxResidual/refForce;
+}
+
+void CVX_LinearSolver::saveVoxelState(std::vector<Vec3D<double> >& pos, std::vector<Quat3D<double> >& orient)
+{
+	int vCount = dof/6;
+	for (int i=0; i<vCount; i++){
+		pos[i] = vx->voxel(i)->pos;
+		orient[i] = vx->voxel(i)->orient;
+	}
+}
+
+void CVX_LinearSolver::applyCorrection(const std::vector<Vec3D<double> >& pos, const std::vector<Quat3D<double> >& orient, double scale, bool snapFixed)
+{
+	int vCount = dof/6;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		CVX_Voxel* pV = vx->voxel(i);
+		pV->pos = pos[i] + scale*Vec3D<double>(x[6*i], x[6*i+1], x[6*i+2]);
+		pV->orient = Quat3D<double>(scale*Vec3D<double>(x[6*i+3], x[6*i+4], x[6*i+5]))*orient[i];
+		if (snapFixed) pV->enforceFixed(); //remove any drift of the prescribed degrees of freedom
+		pV->poissonsStrainInvalid = true;
+	}
+}
+
+void CVX_LinearSolver::updateTangents()
+{
+	int vCount = dof/6;
+	tangents.resize(6*vCount);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<vCount; i++){
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = voxLinks[6*i+j];
+			if (!pL) continue;
+			linkTangent& t = tangents[6*i+j];
+
+			//beyond its largest strain so far a link follows the stress/strain curve, otherwise it unloads elastically
+			t.a1 = pL->a1();
+			float E = pL->mat->youngsModulus();
+			if (pL->strain >= pL->maxStrain && E != 0) t.a1 *= pL->mat->modulus(pL->strain)/E;
+			t.geometric = pL->_stress*pL->currentTransverseArea/pL->currentRestLength;
+
+			//the link turns with the average orientation of its two voxels
+			Quat3D<double> qNeg = pL->pVNeg->orientation(), qPos = pL->pVPos->orientation();
+			if (qNeg.w*qPos.w + qNeg.x*qPos.x + qNeg.y*qPos.y + qNeg.z*qPos.z < 0) qPos = qPos*-1.0; //same hemisphere
+			t.rot = qNeg + qPos;
+			t.rot.Normalize();
+		}
+	}
+}
+
+bool CVX_LinearSolver::lanczos(solverType type, bool invert, int wanted, std::vector<double>& values, std::vector<double>* vectors)
+{
+	int freeCount = 0;
+	for (int i=0; i<dof; i++) if (!fixedDof[i]) freeCount++;
+	if (wanted > freeCount) wanted = freeCount;
+	int p = invert ? std::min(6, freeCount) : 1; //a block of six finds the repeated frequencies of symmetric structures and the six rigid body modes of free ones
+	int maxSize = invert ? freeCount : std::min(freeCount, 1000);
+	const double ritzTolerance = 1e-6; //relative residual of each wanted eigenpair. Eigenvalues are accurate to about its square.
+
+	//pseudo random start block on the free degrees of freedom
+	std::vector<double> cur(p*dof), prev(p*dof, 0.0), W(p*dof), basis, A(p*p), R(p*p), Rprev(p*p, 0.0);
+	unsigned int seed = 12345;
+	for (int k=0; k<p*dof; k++) cur[k] = fixedDof[k%dof] ? 0.0 : pseudoRandom(seed);
+	massOrthonormalize(p, &cur[0], NULL, 0, &R[0]);
+
+	std::vector<double> blocksA, blocksR, H, theta; //diagonal and sub-diagonal blocks of the projected (block tridiagonal) matrix
+	int size = 0, nextCheck = std::max(2*p, wanted+p);
+	for (;;){
+		if (cancelFlag){ errorMsg = "Solve cancelled.\n"; return false;}
+		if (!modalOperator(type, invert, p, &cur[0], &W[0])) return false;
+
+		//project onto the current block and remove the three term recurrence
+		for (int k=0; k<p; k++){
+			for (int l=0; l<p; l++){
+				double dot = 0;
+				for (int i=0; i<dof; i++) dot += lumpedMass[i]*cur[k*dof+i]*W[l*dof+i];
+				A[k*p+l] = dot;
+			}
+		}
+		for (int k=0; k<p; k++) for (int l=0; l<k; l++) A[k*p+l] = A[l*p+k] = 0.5*(A[k*p+l] + A[l*p+k]);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<dof; i++){
+			for (int l=0; l<p; l++){
+				double sum = 0;
+				for (int k=0; k<p; k++) sum += cur[k*dof+i]*A[k*p+l] + prev[k*dof+i]*Rprev[l*p+k];
+				W[l*dof+i] -= sum;
+			}
+		}
+
+		//the basis is either every block so far or just the last two
+		if (!invert) basis = prev;
+		basis.insert(basis.end(), cur.begin(), cur.end());
+		size += p;
+		blocksA.insert(blocksA.end(), A.begin(), A.end());
+		bool full = size >= maxSize;
+		if (full) R.assign(p*p, 0.0);
+		else massOrthonormalize(p, &W[0], &basis[0], (int)(basis.size()/dof), &R[0]);
+		blocksR.insert(blocksR.end(), R.begin(), R.end());
+
+		if (full || size >= nextCheck){
+			nextCheck = size + p*std::max(1, size/(4*p)); //the dense eigenproblem grows with the cube of its size
+			updateProgress(invert ? 0.1f + 0.8f*(float)size/maxSize : 0.02f, invert ? "Modal analysis: Lowest frequencies..." : "Modal analysis: Highest frequency...");
+
+			int blocks = size/p;
+			H.assign(size*size, 0.0);
+			for (int j=0; j<blocks; j++){
+				for (int k=0; k<p; k++){
+					for (int l=0; l<p; l++){
+						H[(j*p+k)*size + j*p+l] = blocksA[j*p*p + k*p+l];
+						if (j+1 < blocks) H[((j+1)*p+k)*size + j*p+l] = H[(j*p+l)*size + (j+1)*p+k] = blocksR[j*p*p + k*p+l];
+					}
+				}
+			}
+			theta.resize(size);
+			symmetricEigen(size, &H[0], &theta[0]);
+
+			//the residual of each Ritz pair is carried by the next block
+			bool converged = true;
+			for (int w=0; w<wanted && converged; w++){
+				int c = size-1-w;
+				double res2 = 0;
+				for (int k=0; k<p; k++){
+					double res = 0;
+					for (int l=k; l<p; l++) res += R[k*p+l]*H[(size-p+l)*size + c];
+					res2 += res*res;
+				}
+				if (sqrt(res2) > ritzTolerance*fabs(theta[c])) converged = false;
+			}
+			if (converged || full) break;
+		}
+
+		prev.swap(cur);
+		cur.swap(W);
+		Rprev.swap(R);
+	}
+
+	values.resize(wanted);
+	for (int w=0; w<wanted; w++) values[w] = theta[size-1-w];
+	if (vectors){ //Ritz vectors are M-orthonormal
+		vectors->assign((size_t)wanted*dof, 0.0);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<dof; i++){
+			for (int w=0; w<wanted; w++){
+				double sum = 0;
+				for (int k=0; k<size; k++) sum += basis[(size_t)k*dof+i]*H[k*size + size-1-w];
+				(*vectors)[(size_t)w*dof+i] = sum;
+			}
+		}
+	}
+	return true;
+}
+
+bool CVX_LinearSolver::modalOperator(solverType type, bool invert, int count, const double* in, double* out)
+{
+	if (!invert){
+		std::vector<double> v(dof);
+		for (int k=0; k<count; k++){
+			q.assign(in+k*dof, in+(k+1)*dof);
+			if (dampingMode) multiplyC(q, v);
+			else multiplyA(q, v);
+			for (int i=0; i<dof; i++) out[k*dof+i] = fixedDof[i] ? 0.0 : v[i]/lumpedMass[i];
+		}
+		return true;
+	}
+
+	//one load case per vector
+	nrhs = count;
+	x.assign(count*dof, 0.0);
+	b.resize(count*dof);
+	for (int k=0; k<count*dof; k++) b[k] = fixedDof[k%dof] ? 0.0 : lumpedMass[k%dof]*in[k];
+	if (!solveSystem(type)) return false;
+	for (int k=0; k<count*dof; k++) out[k] = fixedDof[k%dof] ? 0.0 : x[k];
+	return true;
+}
+
+void CVX_LinearSolver::massOrthonormalize(int count, double* block, const double* basis, int basisCount, double* R)
+{
+	unsigned int seed = 54321;
+	for (int k=0; k<count*count; k++) R[k] = 0;
+
+	for (int l=0; l<count; l++){
+		double* w = block + (size_t)l*dof;
+		double startNorm2 = 0;
+		for (int i=0; i<dof; i++) startNorm2 += lumpedMass[i]*w[i]*w[i];
+
+		for (int attempt=0; attempt<2; attempt++){
+			for (int pass=0; pass<2; pass++){ //twice is enough
+				for (int k=0; k<basisCount+l; k++){
+					const double* v = k<basisCount ? basis + (size_t)k*dof : block + (size_t)(k-basisCount)*dof;
+					double dot = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+:dot)
+#endif
+					for (int i=0; i<dof; i++) dot += lumpedMass[i]*v[i]*w[i];
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+					for (int i=0; i<dof; i++) w[i] -= dot*v[i];
+					if (k >= basisCount && attempt == 0) R[(k-basisCount)*count+l] += dot;
+				}
+			}
+
+			double norm2 = 0;
+			for (int i=0; i<dof; i++) norm2 += lumpedMass[i]*w[i]*w[i];
+			if (norm2 > 1e-16*startNorm2 && norm2 > 0){
+				double norm = sqrt(norm2);
+				if (attempt == 0) R[l*count+l] = norm;
+				for (int i=0; i<dof; i++) w[i] /= norm;
+				break;
+			}
+
+			//nothing left: an invariant subspace has been found, so carry on from a new pseudo random vector (or give up if there is no room for one)
+			for (int i=0; i<dof; i++) w[i] = (attempt == 0 && !fixedDof[i]) ? pseudoRandom(seed) : 0.0;
+			startNorm2 = 0;
+			for (int i=0; i<dof; i++) startNorm2 += lumpedMass[i]*w[i]*w[i];
+		}
+	}
+}
+
+void CVX_LinearSolver::symmetricEigen(int n, double* A, double* values)
+{
+	//Householder reduction to tridiagonal form, accumulating the transformations in A (after the public domain JAMA tred2)
+	std::vector<double> e(n, 0.0);
+	double* d = values;
+	for (int j=0; j<n; j++) d[j] = A[(n-1)*n+j];
+
+	for (int i=n-1; i>0; i--){
+		double scale = 0, h = 0;
+		for (int k=0; k<i; k++) scale += fabs(d[k]);
+		if (scale == 0){
+			e[i] = d[i-1];
+			for (int j=0; j<i; j++){
+				d[j] = A[(i-1)*n+j];
+				A[i*n+j] = A[j*n+i] = 0;
+			}
+		}
+		else {
+			for (int k=0; k<i; k++){
+				d[k] /= scale;
+				h += d[k]*d[k];
+			}
+			double f = d[i-1], g = sqrt(h);
+			if (f > 0) g = -g;
+			e[i] = scale*g;
+			h -= f*g;
+			d[i-1] = f-g;
+			for (int j=0; j<i; j++) e[j] = 0;
+
+			for (int j=0; j<i; j++){
+				f = d[j];
+				A[j*n+i] = f;
+				g = e[j] + A[j*n+j]*f;
+				for (int k=j+1; k<i; k++){
+					g += A[k*n+j]*d[k];
+					e[k] += A[k*n+j]*f;
+				}
+				e[j] = g;
+			}
+			f = 0;
+			for (int j=0; j<i; j++){
+				e[j] /= h;
+				f += e[j]*d[j];
+			}
+			double hh = f/(h+h);
+			for (int j=0; j<i; j++) e[j] -= hh*d[j];
+			for (int j=0; j<i; j++){
+				f = d[j];
+				g = e[j];
+				for (int k=j; k<i; k++) A[k*n+j] -= f*e[k] + g*d[k];
+				d[j] = A[(i-1)*n+j];
+				A[i*n+j] = 0;
+			}
+		}
+		d[i] = h;
+	}
+
+	for (int i=0; i<n-1; i++){
+		A[(n-1)*n+i] = A[i*n+i];
+		A[i*n+i] = 1;
+		double h = d[i+1];
+		if (h != 0){
+			for (int k=0; k<=i; k++) d[k] = A[k*n+i+1]/h;
+			for (int j=0; j<=i; j++){
+				double g = 0;
+				for (int k=0; k<=i; k++) g += A[k*n+i+1]*A[k*n+j];
+				for (int k=0; k<=i; k++) A[k*n+j] -= g*d[k];
+			}
+		}
+		for (int k=0; k<=i; k++) A[k*n+i+1] = 0;
+	}
+	for (int j=0; j<n; j++){
+		d[j] = A[(n-1)*n+j];
+		A[(n-1)*n+j] = 0;
+	}
+	A[(n-1)*n+n-1] = 1;
+
+	tridiagonalEigen(n, d, &e[0], A);
+}
+
+void CVX_LinearSolver::tridiagonalEigen(int n, double* d, double* e, double* z)
+{
+	//implicit QL iteration (after the public domain JAMA tql2)
+	for (int i=1; i<n; i++) e[i-1] = e[i];
+	e[n-1] = 0;
+
+	double f = 0, tst1 = 0, eps = 2.220446049250313e-16;
+	for (int l=0; l<n; l++){
+		tst1 = std::max(tst1, fabs(d[l]) + fabs(e[l]));
+		int m = l;
+		while (m < n-1 && fabs(e[m]) > eps*tst1) m++;
+
+		if (m > l){
+			do {
+				double g = d[l];
+				double p = (d[l+1]-g)/(2*e[l]);
+				double r = sqrt(p*p+1);
+				if (p < 0) r = -r;
+				d[l] = e[l]/(p+r);
+				d[l+1] = e[l]*(p+r);
+				double dl1 = d[l+1], h = g-d[l];
+				for (int i=l+2; i<n; i++) d[i] -= h;
+				f += h;
+
+				p = d[m];
+				double c = 1, c2 = 1, c3 = 1, el1 = e[l+1], s = 0, s2 = 0;
+				for (int i=m-1; i>=l; i--){
+					c3 = c2;
+					c2 = c;
+					s2 = s;
+					g = c*e[i];
+					h = c*p;
+					r = sqrt(p*p + e[i]*e[i]);
+					e[i+1] = s*r;
+					s = e[i]/r;
+					c = p/r;
+					p = c*d[i] - s*g;
+					d[i+1] = h + s*(c*g + s*d[i]);
+					if (z) for (int k=0; k<n; k++){
+						h = z[k*n+i+1];
+						z[k*n+i+1] = s*z[k*n+i] + c*h;
+						z[k*n+i] = c*z[k*n+i] - s*h;
+					}
+				}
+				p = -s*s2*c3*el1*e[l]/dl1;
+				e[l] = s*p;
+				d[l] = c*p;
+			} while (fabs(e[l]) > eps*tst1);
+		}
+		d[l] += f;
+		e[l] = 0;
+	}
+
+	//ascending order
+	for (int i=0; i<n-1; i++){
+		int k = i;
+		for (int j=i+1; j<n; j++) if (d[j] < d[k]) k = j;
+		if (k == i) continue;
+		std::swap(d[i], d[k]);
+		if (z) for (int j=0; j<n; j++) std::swap(z[j*n+i], z[j*n+k]);
+	}
+}
+
+void CVX_LinearSolver::updateProgress(float percent, const std::string& message)
+{
+	{
+		std::lock_guard<std::mutex> lock(progressMutex);
+		progressTick = (int)(percent*progressMaxTick);
+		progressMsg = message;
+	}
+	if (progressCallback) progressCallback(percent, message); //outside the lock so the callback may read progressMessage()
+}
+
+std::string CVX_LinearSolver::progressMessage() const
+{
+	std::lock_guard<std::mutex> lock(progressMutex);
+	return progressMsg;
+}
+
 #include <fstream>
 void CVX_LinearSolver::OutputMatrices()
 { 
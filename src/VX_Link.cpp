@@ -27,6 +27,7 @@ CVX_Link::CVX_Link(CVX_Voxel* voxel1, CVX_Voxel* voxel2, CVX_MaterialLink* mater
 {
 	assert(voxel1 != NULL);
 	assert(voxel2 != NULL);
+	listIndex = -1;
 
 	bool reverseOrder = false;
 	if (voxel1->indexX() == voxel2->indexX() && voxel1->indexY() == voxel2->indexY()){
@@ -0,0 +1,44 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#include "VX_LoadCase.h"
+
+void CVX_LoadCase::clear()
+{
+	loads.clear();
+	loadIndex.clear();
+	result.clear();
+}
+
+void CVX_LoadCase::setDisplacement(CVX_Voxel* voxel, dofComponent dof, double displacement)
+{
+	voxelLoad& l = load(voxel);
+	switch (dof){
+	case X_TRANSLATE: l.translation.x = displacement; break;
+	case Y_TRANSLATE: l.translation.y = displacement; break;
+	case Z_TRANSLATE: l.translation.z = displacement; break;
+	case X_ROTATE: l.rotation.x = displacement; break;
+	case Y_ROTATE: l.rotation.y = displacement; break;
+	case Z_ROTATE: l.rotation.z = displacement; break;
+	}
+}
+
+CVX_LoadCase::voxelLoad& CVX_LoadCase::load(CVX_Voxel* voxel)
+{
+	std::unordered_map<CVX_Voxel*, int>::iterator it = loadIndex.find(voxel);
+	if (it != loadIndex.end()) return loads[it->second];
+
+	loadIndex[voxel] = (int)loads.size();
+	voxelLoad newLoad;
+	newLoad.voxel = voxel;
+	loads.push_back(newLoad);
+	return loads.back();
+}
@@ -0,0 +1,304 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#include "VX_MeshRecorder.h"
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+//File layout (all values little endian):
+//header: "VXMR", version, vertex count, quad count, line count, field count, keyframe interval (uint32), precision (double), quads (int32 x4), lines (int32 x2)
+//frames: record size (uint32, bytes following), time (float), keyframe flag (uint8), 3 varints per vertex, field count floats per quad
+//index (written by close()): offset (uint64) and time (float) of each frame, frame count (uint64), index offset (uint64), "VXMI"
+static const char headerMagic[4] = {'V','X','M','R'};
+static const char indexMagic[4] = {'V','X','M','I'};
+static const unsigned int formatVersion = 1;
+static const int headerSize = 4 + 6*4 + 8;
+static const int footerSize = 8 + 8 + 4;
+
+static bool hostIsBigEndian() {unsigned int one = 1; return *(unsigned char*)&one == 0;}
+static const bool bigEndianHost = hostIsBigEndian();
+static inline void putLE(unsigned char* dest, const void* value, int size) {memcpy(dest, value, size); if (bigEndianHost) for (int i=0; i<size/2; i++) std::swap(dest[i], dest[size-1-i]);}
+static inline void getLE(void* value, const unsigned char* src, int size) {memcpy(value, src, size); if (bigEndianHost) for (int i=0; i<size/2; i++) std::swap(((unsigned char*)value)[i], ((unsigned char*)value)[size-1-i]);}
+
+//signed integers as LEB128 varints after zigzag encoding so that small magnitudes of either sign take few bytes
+static inline unsigned char* putVarint(unsigned char* dest, long long value)
+{
+	unsigned long long z = ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+	while (z >= 0x80){*dest++ = (unsigned char)(z | 0x80); z >>= 7;}
+	*dest++ = (unsigned char)z;
+	return dest;
+}
+
+static inline const unsigned char* getVarint(const unsigned char* src, const unsigned char* end, long long* value)
+{
+	unsigned long long z = 0;
+	for (int shift=0; src<end && shift<64; shift+=7){
+		unsigned char b = *src++;
+		z |= (unsigned long long)(b & 0x7F) << shift;
+		if (!(b & 0x80)){*value = (long long)(z >> 1) ^ -(long long)(z & 1); return src;}
+	}
+	return 0; //truncated
+}
+
+static inline int quantize(float value, double precision)
+{
+	double q = floor(value/precision + 0.5);
+	if (q > INT_MAX) return INT_MAX;
+	if (q < INT_MIN) return INT_MIN;
+	return (int)q;
+}
+
+CVX_MeshRecorder::CVX_MeshRecorder()
+{
+	vertCount = quadCount = fieldCount = 0;
+	keyframeInterval = 1;
+	precision = 1e-6;
+}
+
+CVX_MeshRecorder::~CVX_MeshRecorder()
+{
+	close();
+}
+
+bool CVX_MeshRecorder::open(const char* filePath, const CVX_MeshRender& mesh, double precision, int fieldCount, int keyframeInterval)
+{
+	close();
+	file.open(filePath, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	const std::vector<int>& quads = *mesh.quadList();
+	const std::vector<int>& lines = *mesh.lineList();
+	vertCount = (int)mesh.vertexList()->size()/3;
+	quadCount = (int)quads.size()/4;
+	int lineCount = (int)lines.size()/2;
+	this->precision = precision > 0 ? precision : 1e-6;
+	this->fieldCount = fieldCount > 0 ? fieldCount : 0;
+	this->keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+	lastQuantized.assign(3*vertCount, 0);
+	frameOffsets.clear();
+	frameTimes.clear();
+
+	buffer.resize(headerSize + 4*(quads.size() + lines.size()));
+	unsigned char* p = &buffer[0];
+	memcpy(p, headerMagic, 4);
+	unsigned int counts[6] = {formatVersion, (unsigned int)vertCount, (unsigned int)quadCount, (unsigned int)lineCount, (unsigned int)this->fieldCount, (unsigned int)this->keyframeInterval};
+	for (int i=0; i<6; i++) putLE(p + 4 + 4*i, &counts[i], 4);
+	putLE(p + 28, &this->precision, 8);
+	p += headerSize;
+	for (int i=0; i<(int)quads.size(); i++, p+=4) putLE(p, &quads[i], 4);
+	for (int i=0; i<(int)lines.size(); i++, p+=4) putLE(p, &lines[i], 4);
+
+	file.write((const char*)&buffer[0], buffer.size());
+	if (!file){close(); return false;}
+	return true;
+}
+
+bool CVX_MeshRecorder::recordFrame(const CVX_MeshRender& mesh, float time, const float* quadFields)
+{
+	if (!file.is_open()) return false;
+	const std::vector<float>& vertices = *mesh.vertexList();
+	if ((int)vertices.size() != 3*vertCount || (int)mesh.quadList()->size() != 4*quadCount) return false;
+	if (fieldCount > 0 && quadFields == 0) return false;
+
+	bool keyframe = frameOffsets.size() % keyframeInterval == 0;
+	buffer.resize(4 + 4 + 1 + 10*3*(size_t)vertCount + 4*(size_t)fieldCount*quadCount);
+	unsigned char* p = &buffer[4];
+	putLE(p, &time, 4);
+	p[4] = keyframe ? 1 : 0;
+	p += 5;
+
+	const float* pVert = vertices.empty() ? 0 : &vertices[0];
+	for (int i=0; i<3*vertCount; i++){
+		int q = quantize(pVert[i], precision);
+		p = putVarint(p, keyframe ? (long long)q : (long long)q - lastQuantized[i]);
+		lastQuantized[i] = q;
+	}
+	for (int i=0; i<fieldCount*quadCount; i++, p+=4) putLE(p, &quadFields[i], 4);
+
+	unsigned int recordSize = (unsigned int)(p - &buffer[4]);
+	putLE(&buffer[0], &recordSize, 4);
+
+	frameOffsets.push_back((unsigned long long)file.tellp());
+	frameTimes.push_back(time);
+	file.write((const char*)&buffer[0], 4 + recordSize);
+	return file.good();
+}
+
+bool CVX_MeshRecorder::close()
+{
+	if (!file.is_open()) return true;
+
+	unsigned long long indexOffset = (unsigned long long)file.tellp(), count = frameOffsets.size();
+	buffer.resize(12*count + footerSize);
+	unsigned char* p = &buffer[0];
+	for (int i=0; i<(int)count; i++, p+=12){
+		putLE(p, &frameOffsets[i], 8);
+		putLE(p + 8, &frameTimes[i], 4);
+	}
+	putLE(p, &count, 8);
+	putLE(p + 8, &indexOffset, 8);
+	memcpy(p + 16, indexMagic, 4);
+
+	file.write((const char*)&buffer[0], buffer.size());
+	bool ok = file.good();
+	file.close();
+	return ok;
+}
+
+
+CVX_MeshReader::CVX_MeshReader()
+{
+	vertCount = fields = 0;
+	keyframeInterval = 1;
+	quantum = 1e-6;
+	currentFrame = -1;
+}
+
+bool CVX_MeshReader::open(const char* filePath)
+{
+	close();
+	file.open(filePath, std::ios::binary);
+	if (!file) return false;
+
+	unsigned char header[headerSize];
+	if (!file.read((char*)header, headerSize) || memcmp(header, headerMagic, 4) != 0){close(); return false;}
+	unsigned int counts[6];
+	for (int i=0; i<6; i++) getLE(&counts[i], header + 4 + 4*i, 4);
+	if (counts[0] != formatVersion){close(); return false;}
+	vertCount = counts[1];
+	fields = counts[4];
+	keyframeInterval = counts[5] > 0 ? counts[5] : 1;
+	getLE(&quantum, header + 28, 8);
+
+	buffer.resize(4*(4*(size_t)counts[2] + 2*(size_t)counts[3]));
+	if (!buffer.empty() && !file.read((char*)&buffer[0], buffer.size())){close(); return false;}
+	quadIndices.resize(4*counts[2]);
+	lineIndices.resize(2*counts[3]);
+	for (int i=0; i<(int)quadIndices.size(); i++) getLE(&quadIndices[i], &buffer[4*i], 4);
+	for (int i=0; i<(int)lineIndices.size(); i++) getLE(&lineIndices[i], &buffer[4*(quadIndices.size()+i)], 4);
+
+	unsigned long long framesStart = (unsigned long long)file.tellg();
+	file.seekg(0, std::ios::end);
+	unsigned long long fileSize = (unsigned long long)file.tellg();
+
+	//use the index if the recording was closed, otherwise find the frames by scanning
+	bool indexed = false;
+	if (fileSize >= framesStart + footerSize){
+		unsigned char footer[footerSize];
+		file.seekg(fileSize - footerSize);
+		unsigned long long count, indexOffset;
+		if (file.read((char*)footer, footerSize) && memcmp(footer + 16, indexMagic, 4) == 0){
+			getLE(&count, footer, 8);
+			getLE(&indexOffset, footer + 8, 8);
+			if (indexOffset >= framesStart && indexOffset + 12*count + footerSize == fileSize){
+				buffer.resize(12*count);
+				file.seekg(indexOffset);
+				if (count == 0 || file.read((char*)&buffer[0], buffer.size())){
+					frameOffsets.resize(count);
+					frameTimes.resize(count);
+					for (int i=0; i<(int)count; i++){
+						getLE(&frameOffsets[i], &buffer[12*i], 8);
+						getLE(&frameTimes[i], &buffer[12*i + 8], 4);
+					}
+					indexed = true;
+				}
+			}
+		}
+	}
+	file.clear();
+	if (!indexed) scanFrames(framesStart, fileSize);
+
+	currentQuantized.assign(3*vertCount, 0);
+	currentFields.assign(fields*quadCount(), 0.0f);
+	return true;
+}
+
+void CVX_MeshReader::close()
+{
+	if (file.is_open()) file.close();
+	file.clear();
+	vertCount = fields = 0;
+	quadIndices.clear();
+	lineIndices.clear();
+	frameOffsets.clear();
+	frameTimes.clear();
+	currentFrame = -1;
+}
+
+void CVX_MeshReader::scanFrames(unsigned long long start, unsigned long long end)
+{
+	frameOffsets.clear();
+	frameTimes.clear();
+	unsigned long long offset = start;
+	unsigned char recordHeader[8];
+	while (offset + 8 <= end){
+		file.seekg(offset);
+		if (!file.read((char*)recordHeader, 8)) break;
+		unsigned int recordSize;
+		float time;
+		getLE(&recordSize, recordHeader, 4);
+		getLE(&time, recordHeader + 4, 4);
+		if (recordSize < 5 || offset + 4 + recordSize > end) break; //incomplete last frame
+		frameOffsets.push_back(offset);
+		frameTimes.push_back(time);
+		offset += 4 + recordSize;
+	}
+	file.clear();
+}
+
+bool CVX_MeshReader::decodeFrame(int frame)
+{
+	file.seekg(frameOffsets[frame]);
+	unsigned char sizeBytes[4];
+	unsigned int recordSize;
+	if (!file.read((char*)sizeBytes, 4)){file.clear(); return false;}
+	getLE(&recordSize, sizeBytes, 4);
+	if (recordSize < 5) return false;
+	buffer.resize(recordSize);
+	if (!file.read((char*)&buffer[0], recordSize)){file.clear(); return false;}
+
+	const unsigned char *p = &buffer[5], *end = &buffer[0] + recordSize;
+	bool keyframe = buffer[4] != 0;
+	if (!keyframe && currentFrame != frame-1) return false;
+
+	for (int i=0; i<3*vertCount; i++){
+		long long value;
+		p = getVarint(p, end, &value);
+		if (!p) return false;
+		currentQuantized[i] = (int)(keyframe ? value : currentQuantized[i] + value);
+	}
+	if (end - p < 4*(long long)currentFields.size()) return false;
+	for (int i=0; i<(int)currentFields.size(); i++, p+=4) getLE(&currentFields[i], p, 4);
+
+	currentFrame = frame;
+	return true;
+}
+
+bool CVX_MeshReader::readFrame(int frame, std::vector<float>* vertices, std::vector<float>* quadFields)
+{
+	if (frame < 0 || frame >= frameCount()) return false;
+
+	//continue from the frame already decoded if it is on the way, otherwise start from the closest preceding keyframe
+	int start = frame - frame%keyframeInterval;
+	if (currentFrame >= start && currentFrame <= frame) start = currentFrame+1;
+	for (int i=start; i<=frame; i++){
+		if (!decodeFrame(i)){currentFrame = -1; return false;}
+	}
+
+	if (vertices){
+		vertices->resize(3*vertCount);
+		for (int i=0; i<3*vertCount; i++) (*vertices)[i] = (float)(currentQuantized[i]*quantum);
+	}
+	if (quadFields) *quadFields = currentFields;
+	return true;
+}
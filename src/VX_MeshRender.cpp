@@ -15,6 +15,13 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 //for file output
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+#include <unordered_map>
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
 
 #ifdef USE_OPEN_GL
 	#ifdef QT_GUI_LIB
@@ -40,89 +47,113 @@ CVX_Voxel::voxelCorner CwLookup[6][4] = {
 	{CVX_Voxel::NNN, CVX_Voxel::NPN, CVX_Voxel::PPN, CVX_Voxel::PNN}  //linkDirection::Z_NEG
 };
 
-CVX_MeshRender::CVX_MeshRender(CVoxelyze* voxelyzeInstance)
+//binary file formats are little endian
+static bool hostIsBigEndian() {unsigned int one = 1; return *(unsigned char*)&one == 0;}
+static const bool bigEndianHost = hostIsBigEndian();
+static inline void putLE32(char* dest, const void* value) {memcpy(dest, value, 4); if (bigEndianHost){std::swap(dest[0], dest[3]); std::swap(dest[1], dest[2]);}}
+static inline void putLE16(char* dest, const void* value) {memcpy(dest, value, 2); if (bigEndianHost) std::swap(dest[0], dest[1]);}
+static inline void putLE32Array(char* dest, const void* values, size_t count) {if (bigEndianHost) for (size_t i=0; i<count; i++) putLE32(dest+4*i, (const char*)values+4*i); else if (count) memcpy(dest, values, 4*count);}
+static inline int colorLevel(float color, int maxLevel) {return color <= 0 ? 0 : (color >= 1 ? maxLevel : (int)(color*maxLevel+0.5f));}
+static const int triangleCorners[2][3] = {{0,1,2}, {2,3,0}}; //each quad as two triangles (same as glDraw())
+
+static bool writeFile(const char* filePath, const std::vector<char>& buffer)
+{
+	std::ofstream ofile(filePath, std::ios::binary);
+	if (!ofile) return false;
+	if (!buffer.empty()) ofile.write(&buffer[0], buffer.size());
+	return ofile.good();
+}
+
+CVX_MeshRender::CVX_MeshRender(CVoxelyze* voxelyzeInstance, bool mergeFaces)
 {
 	vx = voxelyzeInstance;
+	merge = mergeFaces;
+	topology = 0;
+	dirtyFirst = dirtyCount = 0;
+	generateMesh();
+}
+
+void CVX_MeshRender::setFaceMerging(bool mergeFaces)
+{
+	if (mergeFaces == merge) return;
+	merge = mergeFaces;
 	generateMesh();
 }
 
+//packs a lattice location into a single sortable key (z slowest) for hash lookups. Indices must be within +/-2^20
+static const int latticeOffset = 1<<20;
+static inline long long latticeKey(int x, int y, int z) {return ((long long)(z+latticeOffset)<<42) | ((long long)(y+latticeOffset)<<21) | (long long)(x+latticeOffset);}
+static inline int latticeIndex(const std::unordered_map<long long, int>& map, int x, int y, int z) {std::unordered_map<long long, int>::const_iterator it = map.find(latticeKey(x, y, z)); return it == map.end() ? -1 : it->second;}
+
 void CVX_MeshRender::generateMesh()
 {
 	vertices.clear();
-	vertexLinks.clear();
+	vertexCorners.clear();
 	quads.clear();
 	quadColors.clear();
 	quadVoxIndices.clear();
 	quadNormals.clear();
 	lines.clear();
 
-	int minX = vx->indexMinX();
-	int sizeX = vx->indexMaxX()-minX+1;
-	int minY = vx->indexMinY();
-	int sizeY = vx->indexMaxY()-minY+1;
-	int minZ = vx->indexMinZ();
-	int sizeZ = vx->indexMaxZ()-minZ+1;
-
-	CArray3D<int> vIndMap; //maps
-	vIndMap.setDefaultValue(-1);
-	vIndMap.resize(sizeX+1, sizeY+1, sizeZ+1, minX, minY, minZ);
-	int vertexCounter = 0;
-	
-	//for each possible voxel location: (fill in vertices)
+	//only occupied locations are stored so that time and memory scale with the voxels and surface, not the bounding box
 	int vCount = vx->voxelCount();
+	std::unordered_map<long long, int> voxIndMap; //index of the voxel at each location
+	voxIndMap.reserve(vCount);
 	for (int k=0; k<vCount; k++){
 		CVX_Voxel* pV = vx->voxel(k);
-		int x=pV->indexX(), y=pV->indexY(), z=pV->indexZ();
-
-		Index3D thisVox(x, y, z);
-		for (int i=0; i<6; i++){ //for each direction that a quad face could exist
-			if (pV->adjacentVoxel((CVX_Voxel::linkDirection)i)) continue;
-			for (int j=0; j<4; j++){ //for each corner of the (exposed) face in this direction
-				CVX_Voxel::voxelCorner thisCorner = CwLookup[i][j];
-				Index3D thisVertInd3D = thisVox + Index3D(thisCorner&(1<<2)?1:0, thisCorner&(1<<1)?1:0, thisCorner&(1<<0)?1:0);
-				int thisInd = vIndMap[thisVertInd3D];
-
+		voxIndMap[latticeKey(pV->indexX(), pV->indexY(), pV->indexZ())] = k;
+	}
 
-				//if this vertec needs to be added, do it now!
-				if (thisInd == -1){ 
-					vIndMap[thisVertInd3D] = thisInd = vertexCounter++;
-					for (int i=0; i<3; i++) vertices.push_back(0); //will be set on first updateMesh()
+	std::unordered_map<long long, int> vIndMap; //index of the vertex at each lattice location
+	std::vector<long long> vertexKeys; //lattice location of each vertex
+	if (merge) generateMergedQuads(&vIndMap, &vertexKeys);
+	else {
+		//for each voxel: (fill in vertices)
+		for (int k=0; k<vCount; k++){
+			CVX_Voxel* pV = vx->voxel(k);
+			Index3D thisVox(pV->indexX(), pV->indexY(), pV->indexZ());
+			for (int i=0; i<6; i++){ //for each direction that a quad face could exist
+				if (pV->adjacentVoxel((CVX_Voxel::linkDirection)i)) continue;
+				Index3D quadCorners[4];
+				for (int j=0; j<4; j++){ //for each corner of the (exposed) face in this direction
+					CVX_Voxel::voxelCorner thisCorner = CwLookup[i][j];
+					quadCorners[j] = thisVox + Index3D(thisCorner&(1<<2)?1:0, thisCorner&(1<<1)?1:0, thisCorner&(1<<0)?1:0);
 				}
-
-				quads.push_back(thisInd); //add this vertices' contribution to the quad
+				addQuad(&vIndMap, &vertexKeys, quadCorners, k);
 			}
-			//quadLinks.push_back(pV);
-			quadVoxIndices.push_back(k);
 		}
 	}
 
-	//vertex links: do here to make it the right size all at once and avoid lots of expensive allocations
-	vertexLinks.resize(vertexCounter*8, NULL);
-	for (int z=minZ; z<minZ+sizeZ+1; z++){ //for each in vIndMap, now.
-		for (int y=minY; y<minY+sizeY+1; y++){
-			for (int x=minX; x<minX+sizeX+1; x++){
-				int thisInd = vIndMap[Index3D(x,y,z)];
-				if (thisInd == -1) continue;
-
-				//backwards links
-				for (int i=0; i<8; i++){ //check all 8 possible voxels that could be connected...
-					CVX_Voxel* pV = vx->voxel(x-(i&(1<<2)?1:0), y-(i&(1<<1)?1:0), z-(i&(1<<0)?1:0));
-					if (pV) vertexLinks[8*thisInd + i] = pV;
-				}
+	//vertex corners: do here to make it the right size all at once and avoid lots of expensive allocations
+	int vertexCounter = (int)vertexKeys.size();
+	vertexCorners.resize(vertexCounter*8, -1);
+	std::vector<std::pair<long long, int> > sortedVerts(vertexCounter); //visit in lattice order (x fastest) so lines are in a consistent order
+	for (int i=0; i<vertexCounter; i++) sortedVerts[i] = std::make_pair(vertexKeys[i], i);
+	std::sort(sortedVerts.begin(), sortedVerts.end());
+
+	for (int v=0; v<vertexCounter; v++){
+		long long key = sortedVerts[v].first;
+		int thisInd = sortedVerts[v].second;
+		int x = (int)(key & 0x1FFFFF) - latticeOffset, y = (int)((key>>21) & 0x1FFFFF) - latticeOffset, z = (int)(key>>42) - latticeOffset;
+
+		//backwards links
+		for (int i=0; i<8; i++){ //check all 8 possible voxels that could be connected...
+			int voxInd = latticeIndex(voxIndMap, x-(i&(1<<2)?1:0), y-(i&(1<<1)?1:0), z-(i&(1<<0)?1:0));
+			if (voxInd != -1) vertexCorners[8*thisInd + i] = 8*voxInd + i;
+		}
 
-				//lines
-				for (int i=0; i<3; i++){ //look in positive x, y, and z directions
-					int isX = (i==0?1:0), isY = (i==1?1:0), isZ = (i==2?1:0);
-					int p2Ind = vIndMap[Index3D(x+isX, y+isY, z+isZ)];
-					if (p2Ind != -1){ //for x: voxel(x,y,z) (x,y-1,z) (x,y-1,z-1) (x,y,z-1) -- y: voxel(x,y,z) (x-1,y,z) (x-1,y,z-1) (x,y,z-1) -- z: voxel(x,y,z) (x,y-1,z) (x-1,y-1,z) (x-1,y,z)
-						if (vx->voxel(x,			y,			z) ||
-							vx->voxel(x-isY,		y-isX-isZ,	z) ||
-							vx->voxel(x-isY-isZ,	y-isX-isZ,	z-isX-isY) ||
-							vx->voxel(x-isZ,		y,			z-isX-isY)) {
-							
-							lines.push_back(thisInd); lines.push_back(p2Ind);
-						}
-					}
+		//lines
+		if (merge) continue; //outlines of the merged quads instead (below)
+		for (int i=0; i<3; i++){ //look in positive x, y, and z directions
+			int isX = (i==0?1:0), isY = (i==1?1:0), isZ = (i==2?1:0);
+			int p2Ind = latticeIndex(vIndMap, x+isX, y+isY, z+isZ);
+			if (p2Ind != -1){ //for x: voxel(x,y,z) (x,y-1,z) (x,y-1,z-1) (x,y,z-1) -- y: voxel(x,y,z) (x-1,y,z) (x-1,y,z-1) (x,y,z-1) -- z: voxel(x,y,z) (x,y-1,z) (x-1,y-1,z) (x-1,y,z)
+				if (latticeIndex(voxIndMap, x,			y,			z) != -1 ||
+					latticeIndex(voxIndMap, x-isY,		y-isX-isZ,	z) != -1 ||
+					latticeIndex(voxIndMap, x-isY-isZ,	y-isX-isZ,	z-isX-isY) != -1 ||
+					latticeIndex(voxIndMap, x-isZ,		y,			z-isX-isY) != -1) {
+					
+					lines.push_back(thisInd); lines.push_back(p2Ind);
 				}
 			}
 		}
@@ -131,25 +162,191 @@ void CVX_MeshRender::generateMesh()
 	//the rest... allocate space, but updateMesh will fill them in.
 	int quadCount = quads.size()/4;
 
+	if (merge){ //each edge shared by two quads only once
+		std::vector<std::pair<int, int> > edges;
+		edges.reserve(quadCount*4);
+		for (int i=0; i<quadCount; i++){
+			for (int j=0; j<4; j++){
+				int v1 = quads[4*i+j], v2 = quads[4*i+(j+1)%4];
+				edges.push_back(v1<v2 ? std::make_pair(v1, v2) : std::make_pair(v2, v1));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+		lines.reserve(2*edges.size());
+		for (int i=0; i<(int)edges.size(); i++){lines.push_back(edges[i].first); lines.push_back(edges[i].second);}
+	}
+
 	quadColors.resize(quadCount*3);
 	quadNormals.resize(quadCount*3);
+	corners.resize(vCount*8);
+	voxelValues.resize(vCount);
+
+	//render buffers: four vertices per quad so each keeps its own flat normal and color
+	renderVertices.assign(quadCount*4*VERTEX_STRIDE, 0.0f);
+	renderIndices.resize(quadCount*6);
+	for (int i=0; i<quadCount; i++){
+		for (int t=0; t<2; t++) for (int c=0; c<3; c++) renderIndices[6*i + 3*t + c] = 4*i + triangleCorners[t][c];
+	}
+	topology++;
+	renderRebuilt = true;
 
 	updateMesh();
 }
 
+void CVX_MeshRender::addQuad(std::unordered_map<long long, int>* vIndMap, std::vector<long long>* vertexKeys, const Index3D* quadCorners, int voxIndex)
+{
+	for (int j=0; j<4; j++){
+		long long key = latticeKey(quadCorners[j].x, quadCorners[j].y, quadCorners[j].z);
+		std::pair<std::unordered_map<long long, int>::iterator, bool> result = vIndMap->insert(std::make_pair(key, (int)vertexKeys->size()));
+
+		//if this vertex needs to be added, do it now!
+		if (result.second){
+			vertexKeys->push_back(key);
+			for (int i=0; i<3; i++) vertices.push_back(0); //will be set on first updateMesh()
+		}
+
+		quads.push_back(result.first->second); //add this vertices' contribution to the quad
+	}
+	quadVoxIndices.push_back(voxIndex);
+}
+
+//an exposed voxel face for merging
+struct MeshFace {
+	long long key; //direction, slice, v, u (sorts in scanning order)
+	long long color;
+	int voxInd;
+	bool used;
+	bool operator<(const MeshFace& other) const {return key < other.key;}
+};
+
+static const int faceOffset = 1<<19;
+static inline long long faceKey(int dir, int slice, int u, int v) {return ((long long)dir<<60) | ((long long)(slice+faceOffset)<<40) | ((long long)(v+faceOffset)<<20) | (long long)(u+faceOffset);}
+
+void CVX_MeshRender::generateMergedQuads(std::unordered_map<long long, int>* vIndMap, std::vector<long long>* vertexKeys)
+{
+	//gather the exposed faces, keyed by their location within each slice of each direction
+	std::vector<MeshFace> faces;
+	int vCount = vx->voxelCount();
+	for (int k=0; k<vCount; k++){
+		CVX_Voxel* pV = vx->voxel(k);
+		int ind[3] = {pV->indexX(), pV->indexY(), pV->indexZ()};
+		CVX_Material* pMat = pV->material();
+		long long color = (long long)(pMat->red()+1)<<27 | (long long)(pMat->green()+1)<<18 | (long long)(pMat->blue()+1)<<9 | (long long)(pMat->alpha()+1); //9 bits each to include unspecified (-1)
+		for (int dir=0; dir<6; dir++){ //for each direction that a quad face could exist
+			if (pV->adjacentVoxel((CVX_Voxel::linkDirection)dir)) continue;
+			int a = dir/2, u = (a+1)%3, v = (a+2)%3; //normal axis and the two in-plane axes
+			MeshFace face = {faceKey(dir, ind[a], ind[u], ind[v]), color, k, false};
+			faces.push_back(face);
+		}
+	}
+	std::sort(faces.begin(), faces.end());
+
+	std::unordered_map<long long, int> faceMap; //index into faces of each face key
+	faceMap.reserve(faces.size());
+	for (int i=0; i<(int)faces.size(); i++) faceMap[faces[i].key] = i;
+
+	//greedily grow the largest rectangle of same colored faces from each remaining face
+	for (int f=0; f<(int)faces.size(); f++){
+		if (faces[f].used) continue;
+		long long key = faces[f].key, color = faces[f].color;
+		int dir = (int)(key>>60), s = (int)((key>>40) & 0xFFFFF) - faceOffset, j = (int)((key>>20) & 0xFFFFF) - faceOffset, i = (int)(key & 0xFFFFF) - faceOffset;
+		int a = dir/2, u = (a+1)%3, v = (a+2)%3;
+
+		std::vector<int> rect(1, f); //faces covered so far
+		int w=1, h=1;
+		for (;; w++){
+			std::unordered_map<long long, int>::iterator it = faceMap.find(faceKey(dir, s, i+w, j));
+			if (it == faceMap.end() || faces[it->second].used || faces[it->second].color != color) break;
+			rect.push_back(it->second);
+		}
+		for (;; h++){
+			int rowStart = (int)rect.size();
+			for (int k=0; k<w; k++){
+				std::unordered_map<long long, int>::iterator it = faceMap.find(faceKey(dir, s, i+k, j+h));
+				if (it == faceMap.end() || faces[it->second].used || faces[it->second].color != color) break;
+				rect.push_back(it->second);
+			}
+			if ((int)rect.size() - rowStart != w){rect.resize(rowStart); break;}
+		}
+		for (int k=0; k<(int)rect.size(); k++) faces[rect[k]].used = true;
+
+		Index3D quadCorners[4];
+		for (int c=0; c<4; c++){ //corners in the same order as a single voxel face
+			CVX_Voxel::voxelCorner thisCorner = CwLookup[dir][c];
+			int bit[3] = {thisCorner&(1<<2)?1:0, thisCorner&(1<<1)?1:0, thisCorner&(1<<0)?1:0};
+			int ind[3];
+			ind[a] = s+bit[a]; ind[u] = i+(bit[u]?w:0); ind[v] = j+(bit[v]?h:0);
+			quadCorners[c] = Index3D(ind[0], ind[1], ind[2]);
+		}
+		addQuad(vIndMap, vertexKeys, quadCorners, faces[f].voxInd);
+	}
+}
+
 //updates all the modal properties: offsets, quadColors, quadNormals.
 void CVX_MeshRender::updateMesh(viewColoring colorScheme, CVoxelyze::stateInfoType stateType)
 {
-	//location
+	dirtyFirst = dirtyCount = 0;
 	int vCount = vertices.size()/3;
 	if (vCount == 0) return;
+
+	//one pass over the voxels: corner positions and the range of the colored state
+	int voxCount = (int)voxelValues.size();
+	bool linkState = (stateType == CVoxelyze::STRAIN_ENERGY || stateType == CVoxelyze::ENG_STRESS || stateType == CVoxelyze::ENG_STRAIN);
+	float minVal = FLT_MAX, maxVal = -FLT_MAX;
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+	{
+		float threadMin = FLT_MAX, threadMax = -FLT_MAX;
+#ifdef USE_OMP
+#pragma omp for
+#endif
+		for (int i=0; i<voxCount; i++){
+			CVX_Voxel* pV = vx->voxel(i);
+			pV->cornerPositions(&corners[8*i]);
+			if (colorScheme != STATE_INFO) continue;
+
+			float thisVal = 0;
+			switch (stateType) {
+			case CVoxelyze::KINETIC_ENERGY: thisVal = pV->kineticEnergy(); break;
+			case CVoxelyze::STRAIN_ENERGY: case CVoxelyze::ENG_STRAIN: case CVoxelyze::ENG_STRESS: thisVal = linkMaxColorValue(pV, stateType); break;
+			case CVoxelyze::DISPLACEMENT: thisVal = pV->displacementMagnitude(); break;
+			case CVoxelyze::PRESSURE: thisVal = pV->pressure(); break;
+			default: thisVal = 0;
+			}
+			voxelValues[i] = thisVal;
+			if (thisVal < threadMin) threadMin = thisVal;
+			if (thisVal > threadMax) threadMax = thisVal;
+		}
+#ifdef USE_OMP
+#pragma omp critical
+#endif
+		{
+			if (threadMin < minVal) minVal = threadMin;
+			if (threadMax > maxVal) maxVal = threadMax;
+		}
+	}
+
+	if (colorScheme == STATE_INFO){
+		if (linkState && maxVal == -FLT_MAX) maxVal = 0; //no links
+		if (stateType == CVoxelyze::PRESSURE){ //pressure max and min are equal pos/neg
+			maxVal = maxVal>-minVal ? maxVal : -minVal;
+			minVal = -maxVal;
+		}
+	}
+
+	//location: average of the corners of each voxel touching the vertex
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
 	for (int i=0; i<vCount; i++){ //for each vertex...
 		Vec3D<float> avgPos;
 		int avgCount = 0;
 		for (int j=0; j<8; j++){
-			CVX_Voxel* pV = vertexLinks[8*i+j];
-			if (pV){
-				avgPos += pV->cornerPosition((CVX_Voxel::voxelCorner)j);
+			int corner = vertexCorners[8*i+j];
+			if (corner != -1){
+				avgPos += corners[corner];
 				avgCount++;
 			}
 		}
@@ -159,62 +356,85 @@ void CVX_MeshRender::updateMesh(viewColoring colorScheme, CVoxelyze::stateInfoTy
 		vertices[3*i+2] = avgPos.z;
 	}
 
-	//Find a maximum if necessary:
-	float minVal = 0, maxVal = 0;
-	if (colorScheme == STATE_INFO){
-		maxVal = vx->stateInfo(stateType, CVoxelyze::MAX);
-		minVal = vx->stateInfo(stateType, CVoxelyze::MIN);
-		if (stateType == CVoxelyze::PRESSURE){ //pressure max and min are equal pos/neg
-			maxVal = maxVal>-minVal ? maxVal : -minVal;
-			minVal = -maxVal;
-		}
-
-	}
-
 	//color + normals (for now just pick three vertices, assuming it will be very close to flat...)
 	int qCount = quads.size()/4;
 	if (qCount == 0) return;
-	for (int i=0; i<qCount; i++){
-		Vec3D<float> v[4];
-		for (int j=0; j<4; j++) v[j] = Vec3D<float>(vertices[3*quads[4*i+j]], vertices[3*quads[4*i+j]+1], vertices[3*quads[4*i+j]+2]);
-		Vec3D<float> n = ((v[1]-v[0]).Cross(v[3]-v[0]));
-		n.Normalize(); //necessary? try glEnable(GL_NORMALIZE)
-		quadNormals[i*3] = n.x;
-		quadNormals[i*3+1] = n.y;
-		quadNormals[i*3+2] = n.z;
-
-		float r=1.0f, g=1.0f, b=1.0f;
-		float jetValue = -1.0f;
-		switch (colorScheme){
-			case MATERIAL:
-				r = ((float)vx->voxel(quadVoxIndices[i])->material()->red())/255.0f;
-				g = ((float)vx->voxel(quadVoxIndices[i])->material()->green())/255.0f;
-				b = ((float)vx->voxel(quadVoxIndices[i])->material()->blue())/255.0f;
-				break;
-			case FAILURE:
-				if (vx->voxel(quadVoxIndices[i])->isFailed()){g=0.0f; b=0.0f;}
-				else if (vx->voxel(quadVoxIndices[i])->isYielded()){b=0.0f;}
+	int firstChanged = qCount, lastChanged = -1; //range of quads whose render vertices changed
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+	{
+		int threadFirst = qCount, threadLast = -1;
+#ifdef USE_OMP
+#pragma omp for
+#endif
+		for (int i=0; i<qCount; i++){
+			Vec3D<float> v[4];
+			for (int j=0; j<4; j++) v[j] = Vec3D<float>(vertices[3*quads[4*i+j]], vertices[3*quads[4*i+j]+1], vertices[3*quads[4*i+j]+2]);
+			Vec3D<float> n = ((v[1]-v[0]).Cross(v[3]-v[0]));
+			n.Normalize(); //necessary? try glEnable(GL_NORMALIZE)
+			quadNormals[i*3] = n.x;
+			quadNormals[i*3+1] = n.y;
+			quadNormals[i*3+2] = n.z;
+
+			float r=1.0f, g=1.0f, b=1.0f;
+			float jetValue = -1.0f;
+			switch (colorScheme){
+				case MATERIAL:
+					r = ((float)vx->voxel(quadVoxIndices[i])->material()->red())/255.0f;
+					g = ((float)vx->voxel(quadVoxIndices[i])->material()->green())/255.0f;
+					b = ((float)vx->voxel(quadVoxIndices[i])->material()->blue())/255.0f;
+					break;
+				case FAILURE:
+					if (vx->voxel(quadVoxIndices[i])->isFailed()){g=0.0f; b=0.0f;}
+					else if (vx->voxel(quadVoxIndices[i])->isYielded()){b=0.0f;}
+					break;
+				case STATE_INFO:
+					switch (stateType) {
+					case CVoxelyze::KINETIC_ENERGY: case CVoxelyze::STRAIN_ENERGY: case CVoxelyze::ENG_STRAIN: case CVoxelyze::ENG_STRESS: case CVoxelyze::DISPLACEMENT: jetValue = voxelValues[quadVoxIndices[i]]/maxVal; break;
+					case CVoxelyze::PRESSURE: jetValue = 0.5-voxelValues[quadVoxIndices[i]]/(2*maxVal); break;
+					default: jetValue = 0;
+					}
 				break;
-			case STATE_INFO:
-				switch (stateType) {
-				case CVoxelyze::KINETIC_ENERGY: jetValue = vx->voxel(quadVoxIndices[i])->kineticEnergy()/maxVal; break;
-				case CVoxelyze::STRAIN_ENERGY: case CVoxelyze::ENG_STRAIN: case CVoxelyze::ENG_STRESS: jetValue = linkMaxColorValue(vx->voxel(quadVoxIndices[i]), stateType) / maxVal; break;
-				case CVoxelyze::DISPLACEMENT: jetValue = vx->voxel(quadVoxIndices[i])->displacementMagnitude()/maxVal; break;
-				case CVoxelyze::PRESSURE: jetValue = 0.5-vx->voxel(quadVoxIndices[i])->pressure()/(2*maxVal); break;
-				default: jetValue = 0;
+			}
+
+			if (jetValue != -1.0f){
+				r = jetMapR(jetValue);
+				g = jetMapG(jetValue);
+				b = jetMapB(jetValue);
+			}
+
+			quadColors[i*3] = r;
+			quadColors[i*3+1] = g;
+			quadColors[i*3+2] = b;
+
+			//interleaved render vertices
+			bool changed = false;
+			float* pRender = &renderVertices[4*VERTEX_STRIDE*i];
+			for (int j=0; j<4; j++){
+				float thisVert[VERTEX_STRIDE] = {v[j].x, v[j].y, v[j].z, n.x, n.y, n.z, r, g, b};
+				for (int k=0; k<VERTEX_STRIDE; k++, pRender++){
+					if (*pRender != thisVert[k]){*pRender = thisVert[k]; changed = true;}
 				}
-			break;
+			}
+			if (changed){
+				if (i < threadFirst) threadFirst = i;
+				threadLast = i;
+			}
 		}
-
-		if (jetValue != -1.0f){
-			r = jetMapR(jetValue);
-			g = jetMapG(jetValue);
-			b = jetMapB(jetValue);
+#ifdef USE_OMP
+#pragma omp critical
+#endif
+		{
+			if (threadFirst < firstChanged) firstChanged = threadFirst;
+			if (threadLast > lastChanged) lastChanged = threadLast;
 		}
+	}
 
-		quadColors[i*3] = r;
-		quadColors[i*3+1] = g;
-		quadColors[i*3+2] = b;
+	if (renderRebuilt){firstChanged = 0; lastChanged = qCount-1; renderRebuilt = false;}
+	if (lastChanged >= firstChanged){
+		dirtyFirst = 4*firstChanged;
+		dirtyCount = 4*(lastChanged-firstChanged+1);
 	}
 }
 float CVX_MeshRender::linkMaxColorValue(CVX_Voxel* pV, CVoxelyze::stateInfoType coloring)
@@ -252,42 +472,186 @@ void CVX_MeshRender::saveObj(const char* filePath)
 	ofile.close();
 }
 
+bool CVX_MeshRender::saveStl(const char* filePath)
+{
+	int qCount = quads.size()/4;
+	unsigned int triCount = 2*qCount;
+	std::vector<char> buffer(84 + 50*(size_t)triCount, 0); //80 byte header, triangle count, 50 bytes per triangle
+	const char* header = "Binary STL generated by Voxelyze";
+	memcpy(&buffer[0], header, strlen(header));
+	putLE32(&buffer[80], &triCount);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<qCount; i++){
+		unsigned short color = 0x8000 | colorLevel(quadColors[3*i+2], 31) | colorLevel(quadColors[3*i+1], 31)<<5 | colorLevel(quadColors[3*i], 31)<<10; //valid bit, then 5 bits each of blue, green, red
+		for (int t=0; t<2; t++){
+			char* pTri = &buffer[84 + 50*(size_t)(2*i+t)];
+			putLE32Array(pTri, &quadNormals[3*i], 3);
+			for (int c=0; c<3; c++) putLE32Array(pTri + 12 + 12*c, &vertices[3*quads[4*i+triangleCorners[t][c]]], 3);
+			putLE16(pTri + 48, &color);
+		}
+	}
+
+	return writeFile(filePath, buffer);
+}
+
+bool CVX_MeshRender::savePly(const char* filePath)
+{
+	int vCount = vertices.size()/3, qCount = quads.size()/4;
+	std::ostringstream header;
+	header << "ply\nformat binary_little_endian 1.0\ncomment Generated by Voxelyze\n";
+	header << "element vertex " << vCount << "\nproperty float x\nproperty float y\nproperty float z\n";
+	header << "element face " << qCount << "\nproperty list uchar int vertex_indices\nproperty uchar red\nproperty uchar green\nproperty uchar blue\nproperty float nx\nproperty float ny\nproperty float nz\nend_header\n";
+	std::string headerString = header.str();
+
+	const int faceSize = 1 + 4*4 + 3 + 3*4;
+	size_t vertexStart = headerString.size(), faceStart = vertexStart + 12*(size_t)vCount;
+	std::vector<char> buffer(faceStart + faceSize*(size_t)qCount);
+	memcpy(&buffer[0], headerString.c_str(), headerString.size());
+	putLE32Array(&buffer[vertexStart], vertices.empty() ? NULL : &vertices[0], 3*vCount);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<qCount; i++){
+		char* pFace = &buffer[faceStart + faceSize*(size_t)i];
+		pFace[0] = 4;
+		putLE32Array(pFace+1, &quads[4*i], 4);
+		for (int c=0; c<3; c++) pFace[17+c] = (char)colorLevel(quadColors[3*i+c], 255);
+		putLE32Array(pFace+20, &quadNormals[3*i], 3);
+	}
+
+	return writeFile(filePath, buffer);
+}
+
+bool CVX_MeshRender::saveGlb(const char* filePath)
+{
+	int qCount = quads.size()/4;
+	if (qCount == 0) return false;
+
+	//binary buffer: positions, normals and colors of 4 vertices per quad, then 6 triangle indices per quad
+	int glVertCount = 4*qCount, indexCount = 6*qCount;
+	size_t attributeSize = 12*(size_t)glVertCount, indexSize = 4*(size_t)indexCount;
+	size_t binSize = 3*attributeSize + indexSize; //always a multiple of 4
+
+	float minPos[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, maxPos[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX}; //required for positions
+	for (int i=0; i<(int)vertices.size(); i++){
+		if (vertices[i] < minPos[i%3]) minPos[i%3] = vertices[i];
+		if (vertices[i] > maxPos[i%3]) maxPos[i%3] = vertices[i];
+	}
+
+	//json chunk
+	rapidjson::StringBuffer json;
+	rapidjson::Writer<rapidjson::StringBuffer> w(json);
+	w.StartObject();
+	w.String("asset"); w.StartObject(); w.String("version"); w.String("2.0"); w.String("generator"); w.String("Voxelyze"); w.EndObject();
+	w.String("scene"); w.Int(0);
+	w.String("scenes"); w.StartArray(); w.StartObject(); w.String("nodes"); w.StartArray(); w.Int(0); w.EndArray(); w.EndObject(); w.EndArray();
+	w.String("nodes"); w.StartArray(); w.StartObject(); w.String("mesh"); w.Int(0); w.EndObject(); w.EndArray();
+	w.String("meshes"); w.StartArray(); w.StartObject(); w.String("primitives"); w.StartArray(); w.StartObject();
+	w.String("attributes"); w.StartObject(); w.String("POSITION"); w.Int(0); w.String("NORMAL"); w.Int(1); w.String("COLOR_0"); w.Int(2); w.EndObject();
+	w.String("indices"); w.Int(3);
+	w.String("mode"); w.Int(4); //triangles
+	w.EndObject(); w.EndArray(); w.EndObject(); w.EndArray();
+	w.String("buffers"); w.StartArray(); w.StartObject(); w.String("byteLength"); w.Uint64(binSize); w.EndObject(); w.EndArray();
+
+	w.String("bufferViews"); w.StartArray();
+	for (int v=0; v<4; v++){
+		w.StartObject();
+		w.String("buffer"); w.Int(0);
+		w.String("byteOffset"); w.Uint64(v*attributeSize);
+		w.String("byteLength"); w.Uint64(v<3 ? attributeSize : indexSize);
+		w.String("target"); w.Int(v<3 ? 34962 : 34963); //ARRAY_BUFFER, ELEMENT_ARRAY_BUFFER
+		w.EndObject();
+	}
+	w.EndArray();
+
+	w.String("accessors"); w.StartArray();
+	for (int v=0; v<4; v++){
+		w.StartObject();
+		w.String("bufferView"); w.Int(v);
+		w.String("componentType"); w.Int(v<3 ? 5126 : 5125); //FLOAT, UNSIGNED_INT
+		w.String("count"); w.Int(v<3 ? glVertCount : indexCount);
+		w.String("type"); w.String(v<3 ? "VEC3" : "SCALAR");
+		if (v == 0){
+			w.String("min"); w.StartArray(); for (int k=0; k<3; k++) w.Double(minPos[k]); w.EndArray();
+			w.String("max"); w.StartArray(); for (int k=0; k<3; k++) w.Double(maxPos[k]); w.EndArray();
+		}
+		w.EndObject();
+	}
+	w.EndArray();
+	w.EndObject();
+
+	size_t jsonSize = (json.GetSize()+3)/4*4; //padded with spaces
+	size_t totalSize = 12 + 8 + jsonSize + 8 + binSize;
+	std::vector<char> buffer(totalSize, ' ');
+	unsigned int header[5] = {0x46546C67, 2, (unsigned int)totalSize, (unsigned int)jsonSize, 0x4E4F534A}; //"glTF", version, length, then the json chunk length and type
+	putLE32Array(&buffer[0], header, 5);
+	memcpy(&buffer[20], json.GetString(), json.GetSize());
+	unsigned int binHeader[2] = {(unsigned int)binSize, 0x004E4942}; //"BIN"
+	putLE32Array(&buffer[20+jsonSize], binHeader, 2);
+
+	char* pBin = &buffer[28+jsonSize];
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<qCount; i++){
+		for (int j=0; j<4; j++){
+			size_t vertOffset = 12*(size_t)(4*i+j);
+			putLE32Array(pBin + vertOffset, &vertices[3*quads[4*i+j]], 3);
+			putLE32Array(pBin + attributeSize + vertOffset, &quadNormals[3*i], 3);
+			putLE32Array(pBin + 2*attributeSize + vertOffset, &quadColors[3*i], 3);
+		}
+		unsigned int indices[6];
+		for (int t=0; t<2; t++) for (int c=0; c<3; c++) indices[3*t+c] = 4*i + triangleCorners[t][c];
+		putLE32Array(pBin + 3*attributeSize + 24*(size_t)i, indices, 6);
+	}
+
+	return writeFile(filePath, buffer);
+}
+
 void CVX_MeshRender::glDraw()
 {
 #ifdef USE_OPEN_GL
 
 	//quads
 	int qCount = quads.size()/4;
-	for (int i=0; i<qCount; i++) {
-		glNormal3d(quadNormals[i*3], quadNormals[i*3+1], quadNormals[i*3+2]);
-		glColor3d(quadColors[i*3], quadColors[i*3+1], quadColors[i*3+2]);
-		glLoadName(quadVoxIndices[i]); //to enable picking
-
-		glBegin(GL_TRIANGLES);
-		glVertex3d(vertices[3*quads[4*i]],   vertices[3*quads[4*i]+1],   vertices[3*quads[4*i]+2]);
-		glVertex3d(vertices[3*quads[4*i+1]], vertices[3*quads[4*i+1]+1], vertices[3*quads[4*i+1]+2]);
-		glVertex3d(vertices[3*quads[4*i+2]], vertices[3*quads[4*i+2]+1], vertices[3*quads[4*i+2]+2]);
-
-		glVertex3d(vertices[3*quads[4*i+2]], vertices[3*quads[4*i+2]+1], vertices[3*quads[4*i+2]+2]);
-		glVertex3d(vertices[3*quads[4*i+3]], vertices[3*quads[4*i+3]+1], vertices[3*quads[4*i+3]+2]);
-		glVertex3d(vertices[3*quads[4*i]],   vertices[3*quads[4*i]+1],   vertices[3*quads[4*i]+2]);
-		glEnd();
+	if (qCount > 0){
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, VERTEX_STRIDE*sizeof(float), &renderVertices[POSITION_OFFSET]);
+		glNormalPointer(GL_FLOAT, VERTEX_STRIDE*sizeof(float), &renderVertices[NORMAL_OFFSET]);
+		glColorPointer(3, GL_FLOAT, VERTEX_STRIDE*sizeof(float), &renderVertices[COLOR_OFFSET]);
+
+		GLint renderMode;
+		glGetIntegerv(GL_RENDER_MODE, &renderMode);
+		if (renderMode == GL_SELECT){ //one name per quad to enable picking
+			for (int i=0; i<qCount; i++){
+				glLoadName(quadVoxIndices[i]);
+				glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, &renderIndices[6*i]);
+			}
+		}
+		else glDrawElements(GL_TRIANGLES, 6*qCount, GL_UNSIGNED_INT, &renderIndices[0]);
 
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glDisableClientState(GL_COLOR_ARRAY);
 	}
 
 	//lines
-	glLineWidth(1.0);
-	glBegin(GL_LINES);
-	glColor3d(0, 0, 0); //black lines...
-
 	int lCount = lines.size()/2;
-	for (int i=0; i<lCount; i++) {
-		glVertex3d(vertices[3*lines[2*i]], vertices[3*lines[2*i]+1], vertices[3*lines[2*i]+2]);
-		glVertex3d(vertices[3*lines[2*i+1]], vertices[3*lines[2*i+1]+1], vertices[3*lines[2*i+1]+2]);
+	if (lCount > 0){
+		glLineWidth(1.0);
+		glColor3d(0, 0, 0); //black lines...
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, &vertices[0]);
+		glDrawElements(GL_LINES, 2*lCount, GL_UNSIGNED_INT, &lines[0]);
 	}
-	glEnd();
-
+	glDisableClientState(GL_VERTEX_ARRAY);
 
 #endif
 }
 
+
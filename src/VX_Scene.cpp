@@ -0,0 +1,266 @@
+/*******************************************************************************
+Copyright (c) 2015, Jonathan Hiller
+To cite academic use of Voxelyze: Jonathan Hiller and Hod Lipson "Dynamic Simulation of Soft Multimaterial 3D-Printed Objects" Soft Robotics. March 2014, 1(1): 88-101.
+Available at http://online.liebertpub.com/doi/pdfplus/10.1089/soro.2013.0010
+
+This file is part of Voxelyze.
+Voxelyze is free software: you can redistribute it and/or modify it under the terms of the GNU Lesser General Public License as published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+Voxelyze is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
+*******************************************************************************/
+
+#include "VX_Scene.h"
+#include "Voxelyze.h"
+#include "VX_Collision.h"
+#include <cmath>
+#include <algorithm>
+
+#define GRID_BITS 21 //bits per axis in a packed grid cell key
+#define GRID_OFFSET (1<<(GRID_BITS-1))
+
+CVX_Scene::CVX_Scene()
+{
+	contactsStale = true;
+}
+
+CVX_Scene::~CVX_Scene()
+{
+	clear();
+}
+
+void CVX_Scene::clear()
+{
+	releaseContacts();
+	for (std::vector<sceneBody>::iterator it=bodies.begin(); it != bodies.end(); it++){
+		clearSceneForces(it->pVx, true);
+	}
+	bodies.clear();
+	grid.clear();
+	contactsStale = true;
+}
+
+bool CVX_Scene::addBody(CVoxelyze* body, const Vec3D<double>& origin)
+{
+	if (!body || bodyIndex(body) != -1) return false;
+
+	sceneBody newBody;
+	newBody.pVx = body;
+	newBody.origin = origin;
+	newBody.topology = body->topologyCount;
+	bodies.push_back(newBody);
+
+	contactsStale = true;
+	return true;
+}
+
+bool CVX_Scene::removeBody(CVoxelyze* body)
+{
+	int index = bodyIndex(body);
+	if (index == -1) return false;
+
+	releaseContacts(); //contact body indices are invalidated by the erase below
+	clearSceneForces(body, true);
+	bodies.erase(bodies.begin()+index);
+	grid.clear();
+
+	contactsStale = true;
+	return true;
+}
+
+bool CVX_Scene::setBodyOrigin(CVoxelyze* body, const Vec3D<double>& origin)
+{
+	int index = bodyIndex(body);
+	if (index == -1) return false;
+
+	bodies[index].origin = origin;
+	contactsStale = true; //frame offsets of existing contacts are now wrong
+	return true;
+}
+
+Vec3D<double> CVX_Scene::bodyOrigin(CVoxelyze* body) const
+{
+	int index = bodyIndex(body);
+	if (index == -1) return Vec3D<double>();
+	return bodies[index].origin;
+}
+
+int CVX_Scene::bodyIndex(const CVoxelyze* body) const
+{
+	for (int i=0; i<(int)bodies.size(); i++){
+		if (bodies[i].pVx == body) return i;
+	}
+	return -1;
+}
+
+bool CVX_Scene::doTimeStep(float dt)
+{
+	if (dt==0) return true;
+	else if (dt<0) dt = recommendedTimeStep();
+
+	updateContacts();
+
+	bool Diverged = false;
+	for (std::vector<sceneBody>::iterator it=bodies.begin(); it != bodies.end(); it++){
+		if (!it->pVx->doTimeStep(dt)) Diverged = true;
+	}
+
+	return !Diverged;
+}
+
+float CVX_Scene::recommendedTimeStep() const
+{
+	float minStep = 0.0f;
+	for (std::vector<sceneBody>::const_iterator it=bodies.begin(); it != bodies.end(); it++){
+		float thisStep = it->pVx->recommendedTimeStep();
+		if (thisStep > 0 && (minStep == 0 || thisStep < minStep)) minStep = thisStep;
+	}
+	return minStep;
+}
+
+float CVX_Scene::watchRadius() const
+{
+	float maxRadius = 0.0f;
+	for (std::vector<sceneBody>::const_iterator it=bodies.begin(); it != bodies.end(); it++){
+		CVoxelyze* pVx = it->pVx;
+		float thisRadius = (float)(pVx->voxSize*(2*pVx->boundingRadius+pVx->watchDistance));
+		if (thisRadius > maxRadius) maxRadius = thisRadius;
+	}
+	return maxRadius;
+}
+
+void CVX_Scene::updateContacts()
+{
+	bool stale = contactsStale;
+	for (std::vector<sceneBody>::iterator it=bodies.begin(); it != bodies.end(); it++){
+		if (it->topology != it->pVx->topologyCount) stale = true; //voxel pointers in the grid may be dangling
+	}
+
+	//check if any surface voxels have moved far enough to make contacts stale
+	if (!stale){
+		int gridCount = grid.size();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<gridCount; i++){
+			gridEntry& e = grid[i];
+			CVoxelyze* pVx = bodies[e.body].pVx;
+			double recalcDist = pVx->voxSize*pVx->watchDistance/2;
+			if ((bodies[e.body].origin + e.pV->pos - e.pos).Length2() > recalcDist*recalcDist){
+				stale = true;
+			}
+		}
+	}
+
+	if (stale) regenerateContacts();
+
+	//update the forces!
+	int contactCount = contactsList.size();
+	for (int i=0; i<contactCount; i++){
+		*contactsList[i]->voxel1()->sceneForce = Vec3D<double>();
+		*contactsList[i]->voxel2()->sceneForce = Vec3D<double>();
+	}
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<contactCount; i++){
+		contactsList[i]->updateContactForce();
+	}
+
+	for (int i=0; i<contactCount; i++){ //serial: a voxel may be part of many contacts
+		CVX_Collision* pCol = contactsList[i];
+		*pCol->voxel1()->sceneForce -= (Vec3D<double>)pCol->contactForce(pCol->voxel1());
+		*pCol->voxel2()->sceneForce -= (Vec3D<double>)pCol->contactForce(pCol->voxel2());
+	}
+}
+
+void CVX_Scene::regenerateContacts()
+{
+	releaseContacts();
+
+	for (std::vector<sceneBody>::iterator it=bodies.begin(); it != bodies.end(); it++){
+		if (it->topology != it->pVx->topologyCount){ //released contacts could not touch this body's voxels
+			clearSceneForces(it->pVx, false);
+			it->topology = it->pVx->topologyCount;
+		}
+	}
+
+	//bin the surface voxels of every body by scene position
+	float radius = watchRadius();
+	if (radius <= 0) radius = 1.0f;
+	double invCell = 1.0/radius;
+	double threshRadiusSq = (double)radius*radius;
+
+	grid.clear();
+	for (int b=0; b<(int)bodies.size(); b++){
+		const std::vector<CVX_Voxel*>* surface = bodies[b].pVx->surfaceVoxelList();
+		for (std::vector<CVX_Voxel*>::const_iterator it=surface->begin(); it != surface->end(); it++){
+			gridEntry e;
+			e.body = b;
+			e.pV = *it;
+			e.pos = bodies[b].origin + (*it)->pos;
+			long long cx = (long long)std::floor(e.pos.x*invCell) + GRID_OFFSET;
+			long long cy = (long long)std::floor(e.pos.y*invCell) + GRID_OFFSET;
+			long long cz = (long long)std::floor(e.pos.z*invCell) + GRID_OFFSET;
+			e.cell = (cx << (2*GRID_BITS)) | (cy << GRID_BITS) | cz;
+			grid.push_back(e);
+		}
+	}
+	std::sort(grid.begin(), grid.end());
+
+	//check the 27 neighboring cells of each voxel for voxels of higher-indexed bodies
+	gridEntry key;
+	for (std::vector<gridEntry>::iterator it=grid.begin(); it != grid.end(); it++){
+		for (int dx=-1; dx<=1; dx++){
+			for (int dy=-1; dy<=1; dy++){
+				for (int dz=-1; dz<=1; dz++){
+					key.cell = it->cell + dx*(1LL << (2*GRID_BITS)) + dy*(1LL << GRID_BITS) + dz;
+					key.body = it->body+1;
+					std::vector<gridEntry>::iterator jt = std::lower_bound(grid.begin(), grid.end(), key);
+
+					for (; jt != grid.end() && jt->cell == key.cell; jt++){
+						if ((it->pos - jt->pos).Length2() > threshRadiusSq) continue;
+
+						CVX_Collision* pCol = new CVX_Collision(it->pV, jt->pV, bodies[jt->body].origin - bodies[it->body].origin);
+						contactsList.push_back(pCol);
+						contactBodies.push_back(it->body);
+						contactBodies.push_back(jt->body);
+						if (!it->pV->sceneForce) it->pV->sceneForce = new Vec3D<double>;
+						if (!jt->pV->sceneForce) jt->pV->sceneForce = new Vec3D<double>;
+					}
+				}
+			}
+		}
+	}
+
+	contactsStale = false; //good to go!
+}
+
+void CVX_Scene::releaseContacts()
+{
+	for (int i=0; i<(int)contactsList.size(); i++){
+		for (int j=0; j<2; j++){
+			const sceneBody& b = bodies[contactBodies[2*i+j]];
+			if (b.topology != b.pVx->topologyCount) continue; //this voxel may no longer exist
+			CVX_Voxel* pV = j==0 ? contactsList[i]->voxel1() : contactsList[i]->voxel2();
+			*pV->sceneForce = Vec3D<double>();
+		}
+		delete contactsList[i];
+	}
+	contactsList.clear();
+	contactBodies.clear();
+}
+
+void CVX_Scene::clearSceneForces(CVoxelyze* body, bool deallocate)
+{
+	const std::vector<CVX_Voxel*>* voxels = body->voxelList();
+	for (std::vector<CVX_Voxel*>::const_iterator it=voxels->begin(); it != voxels->end(); it++){
+		CVX_Voxel* pV = *it;
+		if (!pV->sceneForce) continue;
+		if (deallocate){
+			delete pV->sceneForce;
+			pV->sceneForce = NULL;
+		}
+		else *pV->sceneForce = Vec3D<double>();
+	}
+}
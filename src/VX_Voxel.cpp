@@ -12,6 +12,7 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 #include "VX_Voxel.h"
 #include "VX_Material.h"
 #include "VX_Link.h"
+#include "VX_Heightfield.h"
 #include <algorithm> //for std::find
 
 
@@ -28,10 +29,15 @@ CVX_Voxel::CVX_Voxel(CVX_MaterialVoxel* material, short indexX, short indexY, sh
 	iy = indexY;
 	iz = indexZ;
 	ext=NULL;
+	extPool=NULL;
 	boolStates = 0;
 	lastColWatchPosition=NULL;
 	colWatch=NULL;
 	nearby=NULL;
+	sceneForce=NULL;
+	terrain=NULL;
+	surfaceIndex=-1;
+	listIndex=-1;
 
 	reset();
 }
@@ -41,7 +47,11 @@ CVX_Voxel::~CVX_Voxel(void)
 	if (lastColWatchPosition) delete lastColWatchPosition;
 	if (colWatch) delete colWatch;
 	if (nearby) delete nearby;
-	if (ext) delete ext;
+	if (sceneForce) delete sceneForce;
+	if (ext){
+		if (extPool){ext->~CVX_External(); extPool->release(ext);}
+		else delete ext;
+	}
 }
 
 void CVX_Voxel::reset()
@@ -143,6 +153,26 @@ Vec3D<float> CVX_Voxel::cornerPosition(voxelCorner corner) const
 	return (Vec3D<float>)pos + orient.RotateVec3D(cornerOffset(corner));
 }
 
+void CVX_Voxel::cornerPositions(Vec3D<float>* corners) const
+{
+	//strained half size on each side of each axis, as in cornerOffset()
+	double strains[3][2]; //[axis][negative, positive]
+	for (int i=0; i<3; i++){
+		for (int side=0; side<2; side++){
+			bool posLink = side==1;
+			CVX_Link* pL = links[2*i + (posLink?0:1)];
+			if (pL && !pL->isFailed()) strains[i][side] = (1 + pL->axialStrain(posLink))*(posLink?1:-1);
+			else strains[i][side] = posLink?1.0:-1.0;
+		}
+	}
+
+	Vec3D<double> halfSize = 0.5*baseSize();
+	for (int c=0; c<8; c++){
+		Vec3D<float> offset = halfSize.Scale(Vec3D<>(strains[0][c&(1<<2)?1:0], strains[1][c&(1<<1)?1:0], strains[2][c&(1<<0)?1:0]));
+		corners[c] = (Vec3D<float>)pos + orient.RotateVec3D(offset);
+	}
+}
+
 Vec3D<float> CVX_Voxel::cornerOffset(voxelCorner corner) const
 {
 	Vec3D<> strains;
@@ -174,8 +204,10 @@ void CVX_Voxel::timeStep(float dt)
 	//Translation
 	Vec3D<double> curForce = force();
 	Vec3D<double> fricForce = curForce;
+	Vec3D<double> floorNormal;
+	float floorPen = -1.0f;
 
-	if (isFloorEnabled()) floorForce(dt, &curForce); //floor force needs dt to calculate threshold to "stop" a slow voxel into static friction.
+	if (isFloorEnabled()) floorPen = floorForce(dt, &curForce, &floorNormal); //floor force needs dt to calculate threshold to "stop" a slow voxel into static friction.
 
 	fricForce = curForce - fricForce;
 
@@ -185,15 +217,20 @@ void CVX_Voxel::timeStep(float dt)
 	Vec3D<double> translate(linMom*(dt*mat->_massInverse)); //movement of the voxel this timestep
 
 //	we need to check for friction conditions here (after calculating the translation) and stop things accordingly
-	if (isFloorEnabled() && floorPenetration() >= 0){ //we must catch a slowing voxel here since it all boils down to needing access to the dt of this timestep.
-		double work = fricForce.x*translate.x + fricForce.y*translate.y; //F dot disp
-		double hKe = 0.5*mat->_massInverse*(linMom.x*linMom.x + linMom.y*linMom.y); //horizontal kinetic energy
+	if (isFloorEnabled() && floorPen >= 0){ //we must catch a slowing voxel here since it all boils down to needing access to the dt of this timestep.
+		//components tangent to the floor (horizontal for a flat floor)
+		Vec3D<double> tanFric = fricForce - floorNormal*fricForce.Dot(floorNormal);
+		Vec3D<double> tanMom = linMom - floorNormal*linMom.Dot(floorNormal);
+		Vec3D<double> tanTranslate = translate - floorNormal*translate.Dot(floorNormal);
+
+		double work = tanFric.Dot(tanTranslate); //F dot disp
+		double hKe = 0.5*mat->_massInverse*tanMom.Length2(); //horizontal kinetic energy
 
 		if(hKe + work <= 0) setFloorStaticFriction(true); //this checks for a change of direction according to the work-energy principle
 
 		if (isFloorStaticFriction()){ //if we're in a state of static friction, zero out all horizontal motion
-			linMom.x = linMom.y = 0;
-			translate.x = translate.y = 0;
+			linMom -= tanMom;
+			translate -= tanTranslate;
 		}
 	}
 	else setFloorStaticFriction(false);
@@ -207,30 +244,33 @@ void CVX_Voxel::timeStep(float dt)
 
 	orient = Quat3D<>(angMom*(dt*mat->_momentInertiaInverse))*orient; //update the orientation
 
-	if (ext){
-		double size = mat->nominalSize();
-		if (ext->isFixed(X_TRANSLATE)) {pos.x = ix*size + ext->translation().x; linMom.x=0;}
-		if (ext->isFixed(Y_TRANSLATE)) {pos.y = iy*size + ext->translation().y; linMom.y=0;}
-		if (ext->isFixed(Z_TRANSLATE)) {pos.z = iz*size + ext->translation().z; linMom.z=0;}
-		if (ext->isFixedAnyRotation()){ //if any rotation fixed, all are fixed
-			if (ext->isFixedAllRotation()){
-				orient = ext->rotationQuat();
-				angMom = Vec3D<double>();
-			}
-			else { //partial fixes: slow!
-				Vec3D<double> tmpRotVec = orient.ToRotationVector();
-				if (ext->isFixed(X_ROTATE)){ tmpRotVec.x=0; angMom.x=0;}
-				if (ext->isFixed(Y_ROTATE)){ tmpRotVec.y=0; angMom.y=0;}
-				if (ext->isFixed(Z_ROTATE)){ tmpRotVec.z=0; angMom.z=0;}
-				orient.FromRotationVector(tmpRotVec);
-			}
-		}
-	}
-
+	enforceFixed();
 
 	poissonsStrainInvalid = true;
 }
 
+void CVX_Voxel::enforceFixed()
+{
+	if (!ext) return;
+	double size = mat->nominalSize();
+	if (ext->isFixed(X_TRANSLATE)) {pos.x = ix*size + ext->translation().x; linMom.x=0;}
+	if (ext->isFixed(Y_TRANSLATE)) {pos.y = iy*size + ext->translation().y; linMom.y=0;}
+	if (ext->isFixed(Z_TRANSLATE)) {pos.z = iz*size + ext->translation().z; linMom.z=0;}
+	if (ext->isFixedAnyRotation()){ //if any rotation fixed, all are fixed
+		if (ext->isFixedAllRotation()){
+			orient = ext->rotationQuat();
+			angMom = Vec3D<double>();
+		}
+		else { //partial fixes: slow!
+			Vec3D<double> tmpRotVec = orient.ToRotationVector();
+			if (ext->isFixed(X_ROTATE)){ tmpRotVec.x=0; angMom.x=0;}
+			if (ext->isFixed(Y_ROTATE)){ tmpRotVec.y=0; angMom.y=0;}
+			if (ext->isFixed(Z_ROTATE)){ tmpRotVec.z=0; angMom.z=0;}
+			orient.FromRotationVector(tmpRotVec);
+		}
+	}
+}
+
 Vec3D<double> CVX_Voxel::force()
 {
 	//forces from internal bonds
@@ -251,6 +291,7 @@ Vec3D<double> CVX_Voxel::force()
 			totalForce -= (*it)->contactForce(this);
 		}
 	}
+	if (sceneForce) totalForce += *sceneForce; //contacts with other bodies
 
 	return totalForce;
 }
@@ -271,20 +312,40 @@ Vec3D<double> CVX_Voxel::moment()
 }
 
 
-void CVX_Voxel::floorForce(float dt, Vec3D<double>* pTotalForce)
+float CVX_Voxel::floorPenetration() const
+{
+	Vec3D<double> normal;
+	return floorContact(&normal);
+}
+
+float CVX_Voxel::floorContact(Vec3D<double>* pNormal) const
+{
+	if (!terrain){ //flat floor at z=0
+		*pNormal = Vec3D<double>(0,0,1);
+		return (float)(baseSizeAverage()/2 - mat->nominalSize()/2 - pos.z);
+	}
+
+	double height;
+	terrain->sample(pos.x, pos.y, &height, pNormal);
+	return (float)(baseSizeAverage()/2 - mat->nominalSize()/2 - (pos.z-height)*pNormal->z); //distance from the plane tangent to the terrain below us
+}
+
+float CVX_Voxel::floorForce(float dt, Vec3D<double>* pTotalForce, Vec3D<double>* pNormal)
 {
-	float CurPenetration = floorPenetration(); //for now use the average.
+	float CurPenetration = floorContact(pNormal); //for now use the average.
 
 	if (CurPenetration>=0){ 
 		Vec3D<double> vel = velocity();
-		Vec3D<double> horizontalVel(vel.x, vel.y, 0);
+		double normalVel = vel.Dot(*pNormal);
+		Vec3D<double> horizontalVel = vel - *pNormal*normalVel; //tangent to the floor
 		
 		float normalForce = mat->penetrationStiffness()*CurPenetration;
-		pTotalForce->z += normalForce - mat->collisionDampingTranslateC()*vel.z; //in the z direction: k*x-C*v - spring and damping
+		*pTotalForce += *pNormal*(normalForce - mat->collisionDampingTranslateC()*normalVel); //in the normal direction: k*x-C*v - spring and damping
 
 		if (isFloorStaticFriction()){ //If this voxel is currently in static friction mode (no lateral motion) 
-			assert(horizontalVel.Length2() == 0);
-			float surfaceForceSq = (float)(pTotalForce->x*pTotalForce->x + pTotalForce->y*pTotalForce->y); //use squares to avoid a square root
+			assert(terrain || horizontalVel.Length2() == 0); //on sloped terrain the normal changes as we move, so tangential velocity is only approximately zero
+			Vec3D<double> surfaceForce = *pTotalForce - *pNormal*pTotalForce->Dot(*pNormal);
+			float surfaceForceSq = (float)surfaceForce.Length2(); //use squares to avoid a square root
 			float frictionForceSq = (mat->muStatic*normalForce)*(mat->muStatic*normalForce);
 		
 			if (surfaceForceSq > frictionForceSq) setFloorStaticFriction(false); //if we're breaking static friction, leave the forces as they currently have been calculated to initiate motion this time step
@@ -295,6 +356,7 @@ void CVX_Voxel::floorForce(float dt, Vec3D<double>* pTotalForce)
 	}
 	else setFloorStaticFriction(false);
 
+	return CurPenetration;
 }
 
 Vec3D<float> CVX_Voxel::strain(bool poissonsStrain) const
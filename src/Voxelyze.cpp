@@ -16,6 +16,7 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 #include "VX_Voxel.h"
 #include "VX_Link.h"
 #include "VX_LinearSolver.h"
+#include "VX_Heightfield.h"
 #include <unordered_map>
 #include <fstream>
 #include <sstream>
@@ -27,6 +28,9 @@ See <http://www.opensource.org/licenses/lgpl-3.0.html> for license details.
 
 CVoxelyze::CVoxelyze(double voxelSize)
 {
+	topologyCount = 0;
+	pTerrain = NULL;
+	pLinearSolver = NULL;
 	clear();
 	voxSize = voxelSize <= 0 ? DEFAULT_VOXEL_SIZE : voxelSize;
 }
@@ -42,6 +46,8 @@ CVoxelyze& CVoxelyze::operator=(CVoxelyze& VIn)
 	setAmbientTemperature(VIn.ambientTemperature(), true);
 	setGravity(VIn.gravity());
 	enableFloor(VIn.isFloorEnabled());
+	if (VIn.terrain()) setTerrain(*VIn.terrain());
+	else clearTerrain();
 	enableCollisions(VIn.isCollisionsEnabled());
 
 	//add all materials, map from VIn material to this material
@@ -49,10 +55,12 @@ CVoxelyze& CVoxelyze::operator=(CVoxelyze& VIn)
 	for (int i=0; i<VIn.materialCount(); i++) matMap[VIn.material(i)] = addMaterial(*(VIn.material(i)));
 
 	//for each voxel in VIn, call setVoxel here...
+	voxelPool.reserve(VIn.voxelCount());
+	linkPool.reserve(VIn.linkCount());
 	for (int i=0; i<VIn.voxelCount(); i++){
 		CVX_Voxel* pVIn = VIn.voxel(i);
 		CVX_Voxel* pVOut = setVoxel(matMap[pVIn->material()], pVIn->indexX(), pVIn->indexY(), pVIn->indexZ());
-		*pVOut->external() = *pVIn->external();
+		if (pVIn->externalExists()) *pVOut->external() = *pVIn->external(); //a missing external is the same as an empty one
 	}
 	return *this;
 }
@@ -125,9 +133,10 @@ bool CVoxelyze::readJSON(rapidjson::Value& vxl)
 			if (z>maxZ) maxZ=z;
 		}
 
-		voxels.resize(maxX-minX, maxY-minY, maxZ-minZ, minX, minY, minZ);
+		voxels.reserve(Index3D(minX, minY, minZ), Index3D(maxX, maxY, maxZ));
 		voxelsList.reserve(v.Size()/4);
-		for (int i=0; i<3; i++) links[i].resize(maxX-minX+1, maxY-minY+1, maxZ-minZ+1, minX-1, minY-1, minZ-1);
+		voxelPool.reserve(v.Size()/4);
+		for (int i=0; i<3; i++) links[i].reserve(Index3D(minX-1, minY-1, minZ-1), Index3D(maxX, maxY, maxZ)); //negative direction links are indexed one below their voxel
 
 		//add 'em!
 		for (int i=0; i<(int)v.Size()/4; i++) addVoxel(voxelMats[v[i*4+3].GetInt()], v[4*i].GetInt(), v[4*i+1].GetInt(), v[4*i+2].GetInt());
@@ -240,12 +249,163 @@ bool CVoxelyze::writeJSON(rapidjson::PrettyWriter<rapidjson::StringBuffer>& w)
 	return true;
 }
 
-bool CVoxelyze::doLinearSolve() //linearizes at current point and solves
+bool CVoxelyze::doLinearSolve(CVX_LinearSolver::solverType solver) //linearizes at current point and solves
 {
-	CVX_LinearSolver solver(this);
-	solver.solve();
+	return linearSolver()->solve(solver);
+}
 
-	return true;
+std::future<bool> CVoxelyze::doLinearSolveAsync(CVX_LinearSolver::solverType solver)
+{
+	return linearSolver()->solveAsync(solver);
+}
+
+bool CVoxelyze::doLinearSolve(std::vector<CVX_LoadCase>& loadCases, CVX_LinearSolver::solverType solver)
+{
+	return linearSolver()->solve(loadCases, solver);
+}
+
+bool CVoxelyze::doNonlinearSolve(int loadSteps, CVX_LinearSolver::solverType solver)
+{
+	return linearSolver()->solveNonlinear(loadSteps, solver);
+}
+
+bool CVoxelyze::doModalAnalysis(int modeCount, bool modeShapes, CVX_LinearSolver::solverType solver)
+{
+	return linearSolver()->solveModes(modeCount, modeShapes, solver);
+}
+
+bool CVoxelyze::doRelaxationSolve(float tolerance, int maxIterations, int* pIterations)
+{
+	if (pIterations) *pIterations = 0;
+	int voxCount = voxelsList.size(), linkCount = linksList.size();
+	if (voxCount == 0) return true;
+
+	//Fictitious masses: with a unit pseudo time step the explicit update is stable if each mass is at least a quarter of the summed magnitude of its rows in the stiffness matrix. Half is used to leave room for nonlinear stiffening.
+	std::vector<double> massT(voxCount, 0.0), massR(voxCount, 0.0);
+	for (int i=0; i<voxCount; i++){
+		CVX_Voxel* pV = voxelsList[i];
+		for (int j=0; j<6; j++){
+			CVX_Link* pL = pV->links[j];
+			if (!pL) continue;
+			massT[i] += std::max(pL->a1(), pL->b1()+pL->b2()); //row sums are 2*a1 (axial) or 2*(b1+b2) (bending)
+			massR[i] += 0.5*std::max(2*pL->a2(), 3*pL->b3()+2*pL->b2()); //row sums are 2*a2 (torsion) or 3*b3+2*b2 (bending)
+		}
+		if (massT[i] == 0) massT[i] = massR[i] = 1.0; //unconnected
+		pV->haltMotion();
+		pV->enforceFixed();
+		pV->poissonsStrainInvalid = true;
+	}
+
+	//Nonlinear materials remember their largest strain to unload elastically. The pseudo dynamics overshoot on the way to equilibrium, so each iteration starts again from the history at the start: the result is the equilibrium reached by loading monotonically from the current state.
+	std::vector<float> maxStrain(linkCount), strainOffset(linkCount);
+	for (int i=0; i<linkCount; i++){
+		maxStrain[i] = linksList[i]->maxStrain;
+		strainOffset[i] = linksList[i]->strainOffset;
+	}
+
+	std::vector<Vec3D<double> > velT(voxCount), velR(voxCount), resT(voxCount), resR(voxCount);
+	double refForce = -1; //convergence is measured relative to this
+	double kePrev = 0;
+	bool restart = true; //velocities are at rest: take a half step
+	bool converged = false;
+
+	int iteration = 0;
+	for (; iteration<maxIterations; iteration++){
+		bool Diverged = false;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<linkCount; i++){
+			linksList[i]->maxStrain = maxStrain[i];
+			linksList[i]->strainOffset = strainOffset[i];
+			linksList[i]->setBoolState(CVX_Link::LOCAL_VELOCITY_VALID, false); //pseudo time steps must not be mistaken for motion by the internal damping
+			linksList[i]->updateForces();
+			if (linksList[i]->axialStrain() > 100) Diverged = true;
+		}
+		if (Diverged) break;
+		if (collisions) updateCollisions();
+
+		//out of balance forces on the free degrees of freedom (the voxels never have momentum, so there is no damping)
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<voxCount; i++){
+			CVX_Voxel* pV = voxelsList[i];
+			resT[i] = pV->force();
+			resR[i] = pV->moment();
+			if (!pV->ext) continue;
+			CVX_External* pE = pV->ext;
+			if (pE->isFixed(X_TRANSLATE)) resT[i].x = 0;
+			if (pE->isFixed(Y_TRANSLATE)) resT[i].y = 0;
+			if (pE->isFixed(Z_TRANSLATE)) resT[i].z = 0;
+			if (pE->isFixed(X_ROTATE) || pE->isFixedAllRotation()) resR[i].x = 0;
+			if (pE->isFixed(Y_ROTATE) || pE->isFixedAllRotation()) resR[i].y = 0;
+			if (pE->isFixed(Z_ROTATE) || pE->isFixedAllRotation()) resR[i].z = 0;
+		}
+
+		double maxF = 0, maxM = 0;
+		for (int i=0; i<voxCount; i++){
+			maxF = std::max(maxF, resT[i].Length());
+			maxM = std::max(maxM, resR[i].Length());
+		}
+		if (refForce < 0){ //scale of the forces in the structure at the start: the imbalance, the applied loads or the forces carried by the links
+			refForce = std::max(maxF, maxM/voxSize);
+			for (int i=0; i<voxCount; i++){
+				CVX_Voxel* pV = voxelsList[i];
+				refForce = std::max(refForce, (double)fabs(pV->mat->gravityForce()));
+				if (pV->ext) refForce = std::max(refForce, std::max((double)pV->ext->force().Length(), pV->ext->moment().Length()/voxSize));
+			}
+			for (int i=0; i<linkCount; i++) refForce = std::max(refForce, linksList[i]->force(false).Length());
+		}
+		if (maxF <= tolerance*refForce && maxM <= tolerance*refForce*voxSize){
+			converged = true;
+			break;
+		}
+
+		//leapfrog update of the pseudo velocities
+		double step = restart ? 0.5 : 1.0, ke = 0;
+		for (int i=0; i<voxCount; i++){
+			ke += massT[i]*(velT[i] + resT[i]*(step/massT[i])).Length2();
+			ke += massR[i]*(velR[i] + resR[i]*(step/massR[i])).Length2();
+		}
+
+		//kinetic damping: once the kinetic energy falls the voxels have passed a peak half a step ago. Move back to it and restart from rest.
+		bool backUp = !restart && ke < kePrev;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+		for (int i=0; i<voxCount; i++){
+			CVX_Voxel* pV = voxelsList[i];
+			Vec3D<double> translate, rotate;
+			if (backUp){
+				translate = velT[i]*-0.5;
+				rotate = velR[i]*-0.5;
+				velT[i] = velR[i] = Vec3D<double>(0,0,0);
+			}
+			else {
+				velT[i] += resT[i]*(step/massT[i]);
+				velR[i] += resR[i]*(step/massR[i]);
+				translate = velT[i];
+				rotate = velR[i];
+			}
+			pV->pos += translate;
+			pV->orient = Quat3D<>(rotate)*pV->orient;
+			pV->enforceFixed();
+			pV->poissonsStrainInvalid = true;
+		}
+		kePrev = backUp ? 0 : ke;
+		restart = backUp;
+	}
+
+	for (int i=0; i<linkCount; i++) linksList[i]->setBoolState(CVX_Link::LOCAL_VELOCITY_VALID, false); //nor the jump from the last one by the next doTimeStep()
+	if (pIterations) *pIterations = iteration;
+	return converged;
+}
+
+CVX_LinearSolver* CVoxelyze::linearSolver()
+{
+	if (!pLinearSolver) pLinearSolver = new CVX_LinearSolver(this);
+	return pLinearSolver;
 }
 
 bool CVoxelyze::doTimeStep(float dt)
@@ -310,6 +470,17 @@ float CVoxelyze::recommendedTimeStep() const
 	else return 1.0f/(6.283185f*sqrt(MaxFreq2)); //the optimal timestep is to advance one radian of the highest natural frequency
 }
 
+float CVoxelyze::stableTimeStep()
+{
+	if (!linearSolver()->solveModes(0)) return recommendedTimeStep();
+	double omega = 6.283185307179586*linearSolver()->highestFrequency; //rad/sec
+	if (omega <= 0) return recommendedTimeStep();
+
+	//The explicit update of a single damped mode is stable up to dt = 2/omega*(sqrt(1+zeta^2)-zeta), or dt^2*omega^2 + 2*dt*(2*zeta*omega) < 4. The highest frequency and the highest damping rate (2*zeta*omega) of the whole structure bound both terms for every mode at once.
+	double zeta = 0.5*linearSolver()->highestDamping/omega;
+	return (float)(0.9*2.0/omega*(sqrt(1.0+zeta*zeta)-zeta)); //with a margin for stiffening under large deformations
+}
+
 void CVoxelyze::resetTime()
 {
 	currentTime=0.0f;
@@ -323,14 +494,18 @@ void CVoxelyze::resetTime()
 void CVoxelyze::clear() //deallocates and returns everything to defaults (except voxel size)
 {
 	//delete and remove links
-	for (std::vector<CVX_Link*>::iterator it = linksList.begin(); it!=linksList.end(); it++) delete *it;
+	for (std::vector<CVX_Link*>::iterator it = linksList.begin(); it!=linksList.end(); it++) (*it)->~CVX_Link();
 	for (int i=0; i<3; i++)	links[i].clear();
 	linksList.clear();
+	linkPool.clear(); //frees all link storage at once
 
 	//delete and remove voxels
-	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it!=voxelsList.end(); it++) delete *it;
+	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it!=voxelsList.end(); it++) (*it)->~CVX_Voxel();
 	voxelsList.clear();
+	surfaceVoxelsList.clear();
 	voxels.clear();
+	voxelPool.clear();
+	externalPool.clear();
 
 	//delete and remove materials
 	for (std::vector<CVX_MaterialVoxel*>::iterator it = voxelMats.begin(); it!=voxelMats.end(); it++) delete *it;
@@ -345,10 +520,13 @@ void CVoxelyze::clear() //deallocates and returns everything to defaults (except
 	grav = 0.0f;
 	floor = false;
 	collisions = false;
+	if (pTerrain){delete pTerrain; pTerrain = NULL;}
+	if (pLinearSolver){delete pLinearSolver; pLinearSolver = NULL;}
 
 	clearCollisions();
 	collisionsStale = true;
 	nearbyStale = true;
+	topologyCount++;
 
 	boundingRadius = 0.75f;
 	watchDistance = 1.0f;
@@ -387,17 +565,24 @@ bool CVoxelyze::removeMaterial(CVX_Material* toRemove)
 	if (!exists(pMat)) return false;
 
 	//remove all voxels that use this material
-	for (int k=indexMinZ(); k<=indexMaxZ(); k++){
-		for (int j=indexMinY(); j<=indexMaxY(); j++){
-			for (int i=indexMinX(); i<=indexMaxX(); i++){
-				if (voxels(i, j, k)->material() == pMat) removeVoxel(i, j, k);
-			}
+	std::vector<CVX_Voxel*> matVoxels;
+	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it != voxelsList.end(); it++){
+		if ((*it)->material() == pMat) matVoxels.push_back(*it);
+	}
+	removeVoxels(matVoxels);
+
+	//and any combined link materials made from it (no links use them anymore)
+	for (std::list<CVX_MaterialLink*>::iterator it = linkMats.begin(); it != linkMats.end();){
+		if ((*it)->vox1Mat == pMat || (*it)->vox2Mat == pMat){
+			delete *it;
+			it = linkMats.erase(it);
 		}
+		else it++;
 	}
 
 	//remove the material
 	delete pMat;
-	for (int i=0; i<materialCount(); i++) if (voxelMats[i] == pMat) voxelMats.erase(voxelMats.begin()+i);
+	voxelMats.erase(std::find(voxelMats.begin(), voxelMats.end(), pMat));
 	assert(!exists(pMat)); //the material should no longer exist.
 
 	return true;
@@ -407,14 +592,10 @@ bool CVoxelyze::replaceMaterial(CVX_Material* replaceMe, CVX_Material* replaceWi
 {
 	if (!exists((CVX_MaterialVoxel*)replaceMe) || !exists((CVX_MaterialVoxel*)replaceWith)) return false;
 	
-	//switch all voxel references
-	for (int iz=indexMinZ(); iz<=indexMaxZ(); iz++){
-		for (int iy=indexMinY(); iy<=indexMaxY(); iy++){
-			for (int ix=indexMinX(); ix<=indexMaxX(); ix++){
-				CVX_Voxel* pV = voxel(ix, iy, iz);
-				if (pV->material() == (CVX_MaterialVoxel*)replaceMe) setVoxel(replaceWith, ix, iy, iz);
-			}
-		}
+	//switch all voxel references (replacing a material leaves the voxel list unchanged)
+	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it != voxelsList.end(); it++){
+		CVX_Voxel* pV = *it;
+		if (pV->material() == (CVX_MaterialVoxel*)replaceMe) setVoxel(replaceWith, pV->ix, pV->iy, pV->iz);
 	}
 	return true;
 }
@@ -436,18 +617,91 @@ CVX_Voxel* CVoxelyze::setVoxel(CVX_Material* material, int xIndex, int yIndex, i
 	}
 }
 
+bool CVoxelyze::setVoxels(const int* materialIndices, int xCount, int yCount, int zCount, int xOffset, int yOffset, int zOffset)
+{
+	if (materialIndices == NULL || xCount <= 0 || yCount <= 0 || zCount <= 0 || (long long)xCount*yCount*zCount > INT_MAX) return false;
+
+	//run length encode the grid (all negative indices are empty) and build from the runs
+	int cellCount = xCount*yCount*zCount;
+	std::vector<int> runs;
+	for (int i=0; i<cellCount; ){
+		int thisMat = materialIndices[i] < 0 ? -1 : materialIndices[i], runStart = i;
+		while (i<cellCount && (materialIndices[i] < 0 ? -1 : materialIndices[i]) == thisMat) i++;
+		runs.push_back(thisMat);
+		runs.push_back(i-runStart);
+	}
+	return setVoxelRuns(&runs[0], (int)runs.size()/2, xCount, yCount, zCount, xOffset, yOffset, zOffset);
+}
+
+bool CVoxelyze::setVoxelRuns(const int* runs, int runCount, int xCount, int yCount, int zCount, int xOffset, int yOffset, int zOffset)
+{
+	if ((runs == NULL && runCount != 0) || runCount < 0 || xCount <= 0 || yCount <= 0 || zCount <= 0 || (long long)xCount*yCount*zCount > INT_MAX) return false;
+
+	//check everything before changing anything
+	long long cellTotal = 0;
+	int filledCount = 0, matCount = (int)voxelMats.size();
+	for (int r=0; r<runCount; r++){
+		if (runs[2*r] >= matCount || runs[2*r+1] < 0) return false;
+		cellTotal += runs[2*r+1];
+		if (cellTotal > (long long)xCount*yCount*zCount) return false;
+		if (runs[2*r] >= 0) filledCount += runs[2*r+1];
+	}
+	if (cellTotal != (long long)xCount*yCount*zCount) return false;
+
+	//allocate the whole block at once. Negative direction links sit one index below their voxel.
+	Index3D minIndex(xOffset, yOffset, zOffset), maxIndex(xOffset+xCount-1, yOffset+yCount-1, zOffset+zCount-1);
+	if (!voxels.reserve(minIndex, maxIndex)) return false;
+	for (int i=0; i<3; i++) if (!links[i].reserve(minIndex-Index3D(1,1,1), maxIndex)) return false;
+
+	int firstNew = (int)voxelsList.size();
+	try {
+		voxelsList.reserve(firstNew + filledCount);
+		voxelPool.reserve(filledCount);
+		linksList.reserve(linksList.size() + 3*(size_t)filledCount);
+
+		//create all the voxels (existing voxels just change material)
+		int cell = 0, xyCount = xCount*yCount;
+		for (int r=0; r<runCount; r++){
+			int thisMat = runs[2*r], runEnd = cell + runs[2*r+1];
+			if (thisMat < 0){cell = runEnd; continue;}
+			for (; cell<runEnd; cell++){
+				int x = xOffset + cell%xCount, y = yOffset + (cell/xCount)%yCount, z = zOffset + cell/xyCount;
+				if (voxels(x, y, z)) replaceVoxel(voxelMats[thisMat], x, y, z);
+				else createVoxel(voxelMats[thisMat], x, y, z);
+			}
+		}
+		nearbyStale = collisionsStale = true;
+		topologyCount++;
+
+		//then one linear pass to link each new voxel to all its neighbors
+		int voxCount = (int)voxelsList.size();
+		for (int i=firstNew; i<voxCount; i++){
+			CVX_Voxel* pV = voxelsList[i];
+			for (int j=0; j<6; j++){ //from X_POS to Z_NEG (0-5 enums)
+				CVX_Voxel::linkDirection direction = (CVX_Voxel::linkDirection)j;
+				if (pV->link(direction)) continue; //already linked from the other side
+				CVX_Voxel* pNeighbor = voxels(pV->ix+xIndexVoxelOffset(direction), pV->iy+yIndexVoxelOffset(direction), pV->iz+zIndexVoxelOffset(direction));
+				if (pNeighbor == NULL) continue;
+				createLink(pV, direction, pNeighbor);
+				if (pNeighbor->surfaceIndex != -1) updateSurfaceList(pNeighbor); //an existing voxel may now be interior
+			}
+		}
+		for (int i=firstNew; i<voxCount; i++) updateSurfaceList(voxelsList[i]);
+	}
+	catch (std::bad_alloc&){
+		return false;
+	}
+	return true;
+}
+
 CVX_Voxel* CVoxelyze::addVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex, int yIndex, int zIndex) //creates a new voxel if there isn't one here. Otherwise
 {
 	try {
 		nearbyStale = collisionsStale = true;
+		topologyCount++;
 
-		CVX_Voxel* pV = new CVX_Voxel(newVoxelMaterial, xIndex, yIndex, zIndex);
-		voxels.addValue(xIndex, yIndex, zIndex, pV); //add to the array
-		voxelsList.push_back(pV);
-		pV->pos = Vec3D<double>(xIndex*voxSize, yIndex*voxSize, zIndex*voxSize); //set initial voxel location (extrapolate?)
-		pV->enableFloor(floor);
-		pV->setTemperature(ambientTemp); //add it at environment temperature
-		pV->enableCollisions(collisions);
+		CVX_Voxel* pV = createVoxel(newVoxelMaterial, xIndex, yIndex, zIndex);
+		updateSurfaceList(pV); //no links yet, so always starts on the surface
 
 		//add any possible links utilizing this voxel
 		for (int i=0; i<6; i++){ //from X_POS to Z_NEG (0-5 enums)
@@ -460,26 +714,64 @@ CVX_Voxel* CVoxelyze::addVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex,
 	}
 }
 
+CVX_Voxel* CVoxelyze::createVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex, int yIndex, int zIndex)
+{
+	CVX_Voxel* pV = new (voxelPool.allocate()) CVX_Voxel(newVoxelMaterial, xIndex, yIndex, zIndex);
+	pV->extPool = &externalPool;
+	voxels.addValue(xIndex, yIndex, zIndex, pV); //add to the array
+	pV->listIndex = voxelsList.size();
+	voxelsList.push_back(pV);
+	pV->pos = Vec3D<double>(xIndex*voxSize, yIndex*voxSize, zIndex*voxSize); //set initial voxel location (extrapolate?)
+	pV->enableFloor(floor);
+	pV->terrain = pTerrain;
+	pV->setTemperature(ambientTemp); //add it at environment temperature
+	pV->enableCollisions(collisions);
+	return pV;
+}
 
 void CVoxelyze::removeVoxel(int xIndex, int yIndex, int zIndex)
 {
 	nearbyStale = collisionsStale = true;
 
-	const CVX_Voxel* pV = voxel(xIndex, yIndex, zIndex);
+	CVX_Voxel* pV = voxel(xIndex, yIndex, zIndex);
 	if (pV==NULL) return; //no voxel exists here.
-	delete pV;
-	voxels.removeValue(xIndex, yIndex, zIndex); //remove from the array
-	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it!=voxelsList.end(); it++){ //remove from the list
-		if (*it == pV) voxelsList.erase(it);
-	}
-
-	//make sure no references are left in the list This should be compiled away in release
-	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it!=voxelsList.end(); it++) assert(*it != pV); 
+	topologyCount++;
 
 	//remove any links to this voxel
 	for (int i=0; i<6; i++){ //from X_POS to Z_NEG (0-5 enums)
 		removeLink(xIndex, yIndex, zIndex, (CVX_Voxel::linkDirection)i); 
 	}
+
+	removeFromSurfaceList(pV);
+	voxels.removeValue(xIndex, yIndex, zIndex); //remove from the array
+
+	//swap with the last voxel and pop to keep this O(1)
+	assert(voxelsList[pV->listIndex] == pV);
+	CVX_Voxel* pLast = voxelsList.back();
+	voxelsList[pV->listIndex] = pLast;
+	pLast->listIndex = pV->listIndex;
+	voxelsList.pop_back();
+	pV->~CVX_Voxel();
+	voxelPool.release(pV);
+}
+
+int CVoxelyze::removeVoxels(const std::vector<CVX_Voxel*>& toRemove)
+{
+	//look up all positions first so that repeated or foreign handles are never dereferenced after a deletion
+	std::vector<Index3D> positions;
+	positions.reserve(toRemove.size());
+	for (std::vector<CVX_Voxel*>::const_iterator it = toRemove.begin(); it != toRemove.end(); it++){
+		CVX_Voxel* pV = *it;
+		if (pV && pV->listIndex >= 0 && pV->listIndex < (int)voxelsList.size() && voxelsList[pV->listIndex] == pV) positions.push_back(Index3D(pV->ix, pV->iy, pV->iz));
+	}
+
+	int removed = 0;
+	for (std::vector<Index3D>::iterator it = positions.begin(); it != positions.end(); it++){
+		if (voxels(it->x, it->y, it->z) == NULL) continue; //repeated handle, already removed
+		removeVoxel(it->x, it->y, it->z);
+		removed++;
+	}
+	return removed;
 }
 
 void CVoxelyze::replaceVoxel(CVX_MaterialVoxel* newVoxelMaterial, int xIndex, int yIndex, int zIndex)
@@ -521,17 +813,27 @@ CVX_Link* CVoxelyze::addLink(int xIndex, int yIndex, int zIndex, CVX_Voxel::link
 
 	//make the link and add it to the array+list
 	try {
-		CVX_MaterialLink* mat = combinedMaterial(voxel1->material(), voxel2->material());
-		pL = new CVX_Link(voxel1, voxel2, mat); //, direction);	//make the new link (change to both materials, etc.
-		linksList.push_back(pL);							//add to the list
-		links[CVX_Voxel::toAxis(direction)].addValue(
-			xIndex + xIndexLinkOffset(direction),
-			yIndex + yIndexLinkOffset(direction),
-			zIndex + zIndexLinkOffset(direction), pL);
+		pL = createLink(voxel1, direction, voxel2);
 	}
 	catch (std::bad_alloc&){
 		return NULL;
 	}
+	updateSurfaceList(voxel1);
+	updateSurfaceList(voxel2);
+	return pL;
+}
+
+CVX_Link* CVoxelyze::createLink(CVX_Voxel* voxel1, CVX_Voxel::linkDirection direction, CVX_Voxel* voxel2)
+{
+	CVX_MaterialLink* mat = combinedMaterial(voxel1->material(), voxel2->material());
+	CVX_Link* pL = new (linkPool.allocate()) CVX_Link(voxel1, voxel2, mat); //, direction);	//make the new link (change to both materials, etc.
+	pL->listIndex = linksList.size();
+	linksList.push_back(pL);							//add to the list
+	links[CVX_Voxel::toAxis(direction)].addValue(
+		voxel1->ix + xIndexLinkOffset(direction),
+		voxel1->iy + yIndexLinkOffset(direction),
+		voxel1->iz + zIndexLinkOffset(direction), pL);
+
 	//Add reference to this link to the relevant voxels
 	voxel1->addLinkInfo(direction, pL);
 	voxel2->addLinkInfo(CVX_Voxel::toOpposite(direction), pL);
@@ -549,31 +851,61 @@ void CVoxelyze::removeLink(int xIndex, int yIndex, int zIndex, CVX_Voxel::linkDi
 		yIndex + yIndexLinkOffset(direction),
 		zIndex + zIndexLinkOffset(direction)); 
 
-	//remove the reference in the list
-	for (std::vector<CVX_Link*>::iterator it = linksList.begin(); it!=linksList.end(); it++){ //remove from the list
-		if (*it == pL){
-			linksList.erase(it);
-			break;
-		}
-	}
-	
-	//make sure no references are left in the list. This should be compiled away in release
-	for (std::vector<CVX_Link*>::iterator it = linksList.begin(); it!=linksList.end(); it++) assert(*it != pL); 
+	//remove the reference in the list by swapping with the last link and popping to keep this O(1)
+	assert(linksList[pL->listIndex] == pL);
+	CVX_Link* pLast = linksList.back();
+	linksList[pL->listIndex] = pLast;
+	pLast->listIndex = pL->listIndex;
+	linksList.pop_back();
 
 	//remove the reference to this link from one voxel (if it exists)
 	CVX_Voxel* voxel1 = voxels(xIndex, yIndex, zIndex);
-	if (voxel1) voxel1->removeLinkInfo(direction);
+	if (voxel1){
+		voxel1->removeLinkInfo(direction);
+		updateSurfaceList(voxel1);
+	}
 
 	//remove the reference to this link from the other voxel (if it exists)
 	CVX_Voxel* voxel2 = voxels(
 		xIndex+xIndexVoxelOffset(direction),
 		yIndex+yIndexVoxelOffset(direction),
 		zIndex+zIndexVoxelOffset(direction));
-	if (voxel2) voxel2->removeLinkInfo(CVX_Voxel::toOpposite(direction));
+	if (voxel2){
+		voxel2->removeLinkInfo(CVX_Voxel::toOpposite(direction));
+		updateSurfaceList(voxel2);
+	}
+
+	pL->~CVX_Link();
+	linkPool.release(pL);
+}
+
 
-	delete pL;
+void CVoxelyze::updateSurfaceList(CVX_Voxel* pV)
+{
+	bool inList = (pV->surfaceIndex != -1);
+	if (pV->isSurface() == inList) return; //already up to date
+
+	if (!inList){ //newly exposed
+		pV->surfaceIndex = surfaceVoxelsList.size();
+		surfaceVoxelsList.push_back(pV);
+	}
+	else { //newly interior
+		removeFromSurfaceList(pV);
+		if (pV->colWatch) pV->colWatch->clear(); //interior voxels never collide. (clearCollisions() only visits surface voxels)
+	}
 }
 
+void CVoxelyze::removeFromSurfaceList(CVX_Voxel* pV)
+{
+	if (pV->surfaceIndex == -1) return; //not in the list
+
+	//swap with the last surface voxel and pop to keep this O(1)
+	CVX_Voxel* pLast = surfaceVoxelsList.back();
+	surfaceVoxelsList[pV->surfaceIndex] = pLast;
+	pLast->surfaceIndex = pV->surfaceIndex;
+	surfaceVoxelsList.pop_back();
+	pV->surfaceIndex = -1;
+}
 
 bool CVoxelyze::exists(const CVX_MaterialVoxel* toCheck)
 {
@@ -609,6 +941,24 @@ void CVoxelyze::enableFloor(bool enabled)
 	}
 }
 
+void CVoxelyze::setTerrain(const CVX_Heightfield& terrain)
+{
+	CVX_Heightfield* pNewTerrain = new CVX_Heightfield(terrain); //copy first in case terrain is our own
+	if (pTerrain) delete pTerrain;
+	pTerrain = pNewTerrain;
+	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it != voxelsList.end(); it++){
+		(*it)->terrain = pTerrain;
+	}
+}
+
+void CVoxelyze::clearTerrain()
+{
+	for (std::vector<CVX_Voxel*>::iterator it = voxelsList.begin(); it != voxelsList.end(); it++){
+		(*it)->terrain = NULL;
+	}
+	if (pTerrain){delete pTerrain; pTerrain = NULL;}
+}
+
 void CVoxelyze::enableCollisions(bool enabled)
 {
 	if (collisions == enabled) return; //if not changing state
@@ -673,24 +1023,24 @@ void CVoxelyze::updateCollisions()
 	float watchRadiusMm = (float)(voxSize*watchRadiusVx); //outer radius to track all voxels within
 	float recalcDist = (float)(voxSize*watchDistance/2); //if the voxel moves further than this radius, recalc! //1/2 the allowabl, accounting for 0.5x radius of the voxel iself
 
-	//if voxels have been added/removed, regenerate everybody's nearby list
+	//if voxels have been added/removed, regenerate everybody's nearby list (only surface voxels ever collide)
 	if (nearbyStale){
-		for (std::vector<CVX_Voxel*>::iterator it=voxelsList.begin(); it != voxelsList.end(); it++){
+		for (std::vector<CVX_Voxel*>::iterator it=surfaceVoxelsList.begin(); it != surfaceVoxelsList.end(); it++){
 			(*it)->generateNearby(watchRadiusVx*2, false);
 		}
 		nearbyStale = false;
 		collisionsStale = true;
 	}
 
-	//check if any voxels have moved far enough to make collisions stale
-	int voxCount = voxelsList.size();
+	//check if any surface voxels have moved far enough to make collisions stale
+	int surfCount = surfaceVoxelsList.size();
 
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-	for (int i=0; i<voxCount; i++){
-		CVX_Voxel* pV = voxelsList[i]; //(*it);
-		if (pV->isSurface() && (pV->pos - *pV->lastColWatchPosition).Length2() > recalcDist*recalcDist){
+	for (int i=0; i<surfCount; i++){
+		CVX_Voxel* pV = surfaceVoxelsList[i];
+		if ((pV->pos - *pV->lastColWatchPosition).Length2() > recalcDist*recalcDist){
 			collisionsStale = true;
 		}
 	}
@@ -716,8 +1066,8 @@ void CVoxelyze::clearCollisions()
 	}
 	collisionsList.clear();
 
-	for (std::vector<CVX_Voxel*>::iterator it=voxelsList.begin(); it != voxelsList.end(); it++){
-		(*it)->colWatch->clear();
+	for (std::vector<CVX_Voxel*>::iterator it=surfaceVoxelsList.begin(); it != surfaceVoxelsList.end(); it++){ //interior voxels are cleared as they leave the surface list
+		if ((*it)->colWatch) (*it)->colWatch->clear();
 	}
 }
 
@@ -726,16 +1076,14 @@ void CVoxelyze::regenerateCollisions(float threshRadiusSq)
 {
 	clearCollisions();
 
-	//check each combo of voxels and add a collision where necessary
-	for (std::vector<CVX_Voxel*>::iterator it=voxelsList.begin(); it != voxelsList.end(); it++){
+	//check each combo of surface voxels and add a collision where necessary
+	for (std::vector<CVX_Voxel*>::iterator it=surfaceVoxelsList.begin(); it != surfaceVoxelsList.end(); it++){
 		CVX_Voxel* pV1 = *it;
-		if (pV1->isInterior()) continue; //don't care about interior voxels here.
 		*pV1->lastColWatchPosition = (Vec3D<float>)pV1->pos; //remember where collisions were last calculated at
 
-		for (std::vector<CVX_Voxel*>::iterator jt=it+1; jt != voxelsList.end(); jt++){
+		for (std::vector<CVX_Voxel*>::iterator jt=it+1; jt != surfaceVoxelsList.end(); jt++){
 			CVX_Voxel* pV2 = *jt;
-			if (pV2->isInterior() || //don't care about interior voxels here.
-				(pV1->pos-pV2->pos).Length2() > threshRadiusSq || //discard anything outside the watch radius
+			if ((pV1->pos-pV2->pos).Length2() > threshRadiusSq || //discard anything outside the watch radius
 				std::find(pV1->nearby->begin(), pV1->nearby->end(), pV2) != pV1->nearby->end()) //discard if in the connected lattice array
 				continue;
 
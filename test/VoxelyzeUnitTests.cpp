@@ -6,6 +6,12 @@
 #include "tVX_MaterialVoxel.h"
 #include "tVX_Voxel.h"
 #include "tVoxelyze.h"
+#include "tVX_Scene.h"
+#include "tVX_Heightfield.h"
+#include "tVX_LinearSolver.h"
+#include "tVX_MeshRender.h"
+#include "tVX_MeshRecorder.h"
+#include "tObjectPool.h"
 
 
 int main(int argc, char** argv)
@@ -73,3 +73,162 @@ TEST(Array3D, All){
 	//large allocation failure
 	assert(!T2.resize(Index3D(1000,1000,1000)));
 }
+
+TEST(Array3D, bounds){
+	CArray3D<int> A;
+	A.setDefaultValue(-1);
+	A.addValue(2, 3, 4, 1);
+	EXPECT_EQ(A.minIndices(), Index3D(2,3,4));
+	EXPECT_EQ(A.maxIndices(), Index3D(2,3,4));
+
+	A.addValue(-5, 3, 10, 2);
+	A.addValue(0, 7, 4, 3);
+	A.addValue(0, 7, 4, 4); //overwrite
+	EXPECT_EQ(A.minIndices(), Index3D(-5,3,4));
+	EXPECT_EQ(A.maxIndices(), Index3D(2,7,10));
+
+	//bounds shrink only when a boundary slab empties
+	A.removeValue(0, 7, 4);
+	EXPECT_EQ(A.minIndices(), Index3D(-5,3,4));
+	EXPECT_EQ(A.maxIndices(), Index3D(2,3,10));
+	A.removeValue(-5, 3, 10);
+	EXPECT_EQ(A.minIndices(), Index3D(2,3,4));
+	EXPECT_EQ(A.maxIndices(), Index3D(2,3,4));
+	A.removeValue(-5, 3, 10); //already removed
+	EXPECT_EQ(A.minIndices(), Index3D(2,3,4));
+
+	//survives reallocation
+	A.addValue(40, -30, 4, 5);
+	EXPECT_EQ(A.minIndices(), Index3D(2,-30,4));
+	EXPECT_EQ(A.maxIndices(), Index3D(40,3,4));
+	A.removeValue(40, -30, 4);
+	EXPECT_EQ(A.maxIndices(), Index3D(2,3,4));
+
+	//a value set through a reference (within the allocated area) is picked up when removed
+	A.addValue(6, 6, 6, 6);
+	A[Index3D(3,3,5)] = 7;
+	A.removeValue(3, 3, 5);
+	EXPECT_EQ(A.minIndices(), Index3D(2,3,4));
+	EXPECT_EQ(A.maxIndices(), Index3D(6,6,6));
+
+	//values that become the default are no longer elements
+	A.setDefaultValue(6);
+	EXPECT_EQ(A.maxIndices(), Index3D(2,3,4));
+
+	A.removeValue(2, 3, 4);
+	EXPECT_EQ(A.minIndices(), Index3D(INT_MAX,INT_MAX,INT_MAX));
+	EXPECT_EQ(A.maxIndices(), Index3D(INT_MIN,INT_MIN,INT_MIN));
+
+	//matches a brute force scan through random additions and removals
+	CArray3D<int> B;
+	srand(1);
+	for (int n=0; n<5000; n++){
+		Index3D ind(rand()%20-10, rand()%15, rand()%10-20);
+		if (rand()%3) B.removeValue(ind);
+		else B.addValue(ind, 1);
+	}
+	Index3D bMin(INT_MAX,INT_MAX,INT_MAX), bMax(INT_MIN,INT_MIN,INT_MIN);
+	for (int k=-25; k<-5; k++) for (int j=-5; j<20; j++) for (int i=-15; i<15; i++){
+		if (B.at(i,j,k) == 0) continue;
+		if (i < bMin.x) bMin.x = i; if (i > bMax.x) bMax.x = i;
+		if (j < bMin.y) bMin.y = j; if (j > bMax.y) bMax.y = j;
+		if (k < bMin.z) bMin.z = k; if (k > bMax.z) bMax.z = k;
+	}
+	EXPECT_EQ(B.minIndices(), bMin);
+	EXPECT_EQ(B.maxIndices(), bMax);
+}
+
+TEST(Array3D, paged){
+	//a paged array behaves exactly like a dense one
+	CArray3D<int> Dense;
+	CArray3D<int, 2> Paged;
+	Dense.setDefaultValue(-1);
+	Paged.setDefaultValue(-1);
+	srand(2);
+	for (int n=0; n<20000; n++){
+		Index3D ind(rand()%40-25, rand()%30, rand()%20-40);
+		if (rand()%2){Dense.removeValue(ind); Paged.removeValue(ind);}
+		else {int v = rand()%100; EXPECT_TRUE(Dense.addValue(ind, v)); EXPECT_TRUE(Paged.addValue(ind, v));}
+
+		if (n%1000 == 0){
+			EXPECT_EQ(Dense.minIndices(), Paged.minIndices());
+			EXPECT_EQ(Dense.maxIndices(), Paged.maxIndices());
+		}
+	}
+	for (int k=-45; k<-15; k++) for (int j=-5; j<35; j++) for (int i=-30; i<20; i++) ASSERT_EQ(Dense(i,j,k), Paged(i,j,k));
+
+	CArray3D<int, 2> Copy = Paged;
+	EXPECT_EQ(Copy.at(Paged.minIndices()), Paged.at(Paged.minIndices()));
+	EXPECT_TRUE(Copy.shrink_to_fit());
+	EXPECT_EQ(Copy.minIndices(), Dense.minIndices());
+	EXPECT_EQ(Copy.maxIndices(), Dense.maxIndices());
+	for (int k=-45; k<-15; k++) for (int j=-5; j<35; j++) for (int i=-30; i<20; i++) ASSERT_EQ(Dense(i,j,k), Copy(i,j,k));
+
+	//resize discards whole bricks outside the new area
+	Paged.resize(Index3D(4,4,4), Index3D(-4,0,-24));
+	for (int k=-24; k<-20; k++) for (int j=0; j<4; j++) for (int i=-4; i<0; i++) EXPECT_EQ(Dense(i,j,k), Paged(i,j,k));
+	EXPECT_EQ(Paged(10, 10, -30), -1);
+
+	//memory only scales with the occupied bricks
+	CArray3D<int, 4> Sparse;
+	Sparse.addValue(0, 0, 0, 1);
+	Sparse.addValue(1000, 1000, 1000, 2);
+	Sparse.addValue(-1000, 500, 0, 3);
+	EXPECT_EQ(Sparse(1000, 1000, 1000), 2);
+	EXPECT_EQ(Sparse(-1000, 500, 0), 3);
+	EXPECT_EQ(Sparse(999, 1000, 1000), 0);
+	EXPECT_EQ(Sparse.minIndices(), Index3D(-1000,0,0));
+	EXPECT_EQ(Sparse.maxIndices(), Index3D(1000,1000,1000));
+	EXPECT_LT(Sparse.memoryUsage(), (size_t)(16*1024*1024));
+
+	Sparse.removeValue(1000, 1000, 1000);
+	Sparse.removeValue(-1000, 500, 0);
+	EXPECT_EQ(Sparse.maxIndices(), Index3D(0,0,0));
+	Sparse.addValue(1000, 1000, 999, 4); //reuses a released brick
+	EXPECT_EQ(Sparse(1000, 1000, 999), 4);
+	EXPECT_EQ(Sparse(1000, 1000, 1000), 0);
+}
+
+TEST(Array3D, reserve){
+	//row copies keep every element through growing, shifting and cropping resizes
+	CArray3D<int> A;
+	for (int k=-3; k<4; k++) for (int j=-2; j<5; j++) for (int i=-4; i<6; i++) A.addValue(i, j, k, 1 + (i+10) + 100*(j+10) + 10000*(k+10));
+	EXPECT_TRUE(A.resize(Index3D(20,11,9), Index3D(-7,-3,-5)));
+	EXPECT_TRUE(A.resize(Index3D(6,4,5), Index3D(-1,0,-2))); //crops to i -1..4, j 0..3, k -2..2
+	for (int k=-4; k<5; k++) for (int j=-3; j<6; j++) for (int i=-5; i<7; i++){
+		bool kept = i>=-1 && i<=4 && j>=0 && j<=3 && k>=-2 && k<=2;
+		EXPECT_EQ(A.at(i, j, k), kept ? 1 + (i+10) + 100*(j+10) + 10000*(k+10) : 0);
+	}
+	EXPECT_EQ(A.minIndices(), Index3D(-1,0,-2));
+	EXPECT_EQ(A.maxIndices(), Index3D(4,3,2));
+
+	//reserve allocates the bounds once, so adding within them never reallocates
+	CArray3D<int> B;
+	B.addValue(50, 50, 50, 1);
+	EXPECT_TRUE(B.reserve(Index3D(-10,-20,-30), Index3D(9,19,29)));
+	size_t reserved = B.memoryUsage();
+	EXPECT_GE(reserved, (size_t)(61*71*81)*sizeof(int));
+	for (int k=-30; k<30; k++) for (int j=-20; j<20; j++) for (int i=-10; i<10; i++) B.addValue(i, j, k, 2);
+	EXPECT_EQ(B.memoryUsage(), reserved);
+	EXPECT_EQ(B.at(50, 50, 50), 1); //existing area is kept
+	EXPECT_EQ(B.at(-10, 19, -30), 2);
+	EXPECT_EQ(B.minIndices(), Index3D(-10,-20,-30));
+	EXPECT_EQ(B.maxIndices(), Index3D(50,50,50));
+	EXPECT_TRUE(B.reserve(Index3D(0,0,0), Index3D(1,1,1))); //never shrinks
+	EXPECT_EQ(B.memoryUsage(), reserved);
+	EXPECT_TRUE(B.reserve(Index3D(1,1,1), Index3D(0,0,0))); //empty bounds are ignored
+
+	//paged mode only reserves the brick directory
+	CArray3D<int, 3> P;
+	EXPECT_TRUE(P.reserve(Index3D(-100,-100,-100), Index3D(99,99,99)));
+	EXPECT_LT(P.memoryUsage(), (size_t)(200*200*200)*sizeof(int)/100);
+	P.addValue(-100, 99, 0, 3);
+	EXPECT_EQ(P.at(-100, 99, 0), 3);
+	EXPECT_EQ(P.minIndices(), Index3D(-100,99,0));
+
+	//growing one index at a time past a thin allocation
+	CArray3D<int> C;
+	for (int i=0; i<1000; i++) EXPECT_TRUE(C.addValue(i, 0, 0, i+1));
+	for (int i=0; i<1000; i++) EXPECT_EQ(C.at(i, 0, 0), i+1);
+	EXPECT_EQ(C.maxIndices(), Index3D(999,0,0));
+}
@@ -0,0 +1,96 @@
+#include "../include/ObjectPool.h"
+#include "../include/Voxelyze.h"
+
+struct PoolTester {
+	PoolTester(int v) : value(v), check(v*3) {liveObjects++;}
+	~PoolTester() {liveObjects--;}
+	int value;
+	double check;
+	static int liveObjects;
+};
+int PoolTester::liveObjects = 0;
+
+TEST(CObjectPool, All){
+	CObjectPool<PoolTester, 64> Pool;
+	EXPECT_EQ(Pool.size(), 0);
+	EXPECT_EQ(Pool.memoryUsage(), (size_t)0);
+
+	//objects allocated together are contiguous and never move
+	std::vector<PoolTester*> objects;
+	for (int i=0; i<1000; i++) objects.push_back(new (Pool.allocate()) PoolTester(i));
+	EXPECT_EQ(Pool.size(), 1000);
+	EXPECT_EQ(PoolTester::liveObjects, 1000);
+	EXPECT_EQ(objects[1]-objects[0], 1);
+	EXPECT_EQ(objects[999]-objects[998], 1); //well into the largest blocks
+	for (int i=0; i<1000; i++){
+		EXPECT_EQ(objects[i]->value, i);
+		EXPECT_EQ(objects[i]->check, 3.0*i);
+	}
+	size_t used = Pool.memoryUsage();
+	EXPECT_GE(used, 1000*sizeof(PoolTester));
+
+	//released storage is reused before the pool grows
+	for (int i=0; i<1000; i+=2){
+		objects[i]->~PoolTester();
+		Pool.release(objects[i]);
+	}
+	Pool.release(NULL);
+	EXPECT_EQ(Pool.size(), 500);
+	EXPECT_EQ(PoolTester::liveObjects, 500);
+	for (int i=0; i<1000; i+=2) objects[i] = new (Pool.allocate()) PoolTester(-i);
+	EXPECT_EQ(Pool.memoryUsage(), used);
+	for (int i=0; i<1000; i++) EXPECT_EQ(objects[i]->value, i%2 ? i : -i);
+
+	//reserve makes room for many objects at once
+	Pool.reserve(5000);
+	size_t reserved = Pool.memoryUsage();
+	EXPECT_GE(reserved, used + 4000*sizeof(PoolTester));
+	for (int i=0; i<5000; i++) objects.push_back(new (Pool.allocate()) PoolTester(i));
+	EXPECT_EQ(Pool.memoryUsage(), reserved);
+	EXPECT_EQ(objects[1000+4999]->value, 4999);
+	EXPECT_EQ(objects[1000+4999]-objects[1000+4998], 1);
+
+	for (size_t i=0; i<objects.size(); i++) objects[i]->~PoolTester();
+	EXPECT_EQ(PoolTester::liveObjects, 0);
+	Pool.clear();
+	EXPECT_EQ(Pool.size(), 0);
+	EXPECT_EQ(Pool.memoryUsage(), (size_t)0);
+	PoolTester* pAgain = new (Pool.allocate()) PoolTester(7);
+	EXPECT_EQ(pAgain->value, 7);
+	pAgain->~PoolTester();
+	Pool.release(pAgain);
+}
+
+TEST(CVoxelyze, pooledObjects){
+	//voxels, links and externals come from the pools and are recycled
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<10; i++) Sim.setVoxel(pMat, i, 0, 0);
+	CVX_Voxel* pV = Sim.voxel(9, 0, 0);
+	CVX_External* pE = pV->external();
+	pE->setForce(1.0f, 0, 0);
+	EXPECT_EQ(Sim.voxel(1,0,0)-Sim.voxel(0,0,0), 1);
+
+	Sim.setVoxel(NULL, 9, 0, 0);
+	CVX_Voxel* pNew = Sim.setVoxel(pMat, 0, 1, 0);
+	EXPECT_EQ(pNew, pV); //storage was reused
+	EXPECT_FALSE(pNew->externalExists());
+	EXPECT_EQ(pNew->external(), pE);
+	EXPECT_EQ(pNew->external()->force().x, 0.0f); //but freshly constructed
+	EXPECT_EQ(Sim.linkCount(), 8+1);
+
+	//copies keep externals only where they exist
+	Sim.voxel(3,0,0)->external()->setFixedAll();
+	CVoxelyze Copy(Sim);
+	EXPECT_EQ(Copy.voxelCount(), 10);
+	EXPECT_EQ(Copy.linkCount(), 9);
+	EXPECT_TRUE(Copy.voxel(3,0,0)->externalExists());
+	EXPECT_TRUE(Copy.voxel(3,0,0)->external()->isFixedAll());
+	EXPECT_FALSE(Copy.voxel(4,0,0)->externalExists());
+
+	Sim.clear();
+	EXPECT_EQ(Sim.voxelCount(), 0);
+	pMat = Sim.addMaterial(1e6f, 1e3f);
+	Sim.setVoxel(pMat, 0, 0, 0);
+	EXPECT_EQ(Sim.voxelCount(), 1);
+}
@@ -0,0 +1,107 @@
+#include "../include/VX_Heightfield.h"
+#include "../include/Voxelyze.h"
+
+TEST(CVX_Heightfield, interpolation)
+{
+	CVX_Heightfield Flat;
+	EXPECT_EQ(Flat.height(5.0, -3.0), 0.0);
+	EXPECT_EQ(Flat.normal(5.0, -3.0).z, 1.0);
+
+	CVX_Heightfield T(3, 2, 0.5, 1.0, 2.0);
+	EXPECT_EQ(T.xCount(), 3);
+	EXPECT_EQ(T.yCount(), 2);
+	T.setHeight(1, 0, 1.0f);
+	T.setHeight(2, 1, 2.0f);
+	EXPECT_EQ(T.height(1, 0), 1.0f);
+
+	//nodes
+	EXPECT_NEAR(T.height(1.0, 2.0), 0.0, 1e-12);
+	EXPECT_NEAR(T.height(1.5, 2.0), 1.0, 1e-12);
+	EXPECT_NEAR(T.height(2.0, 2.5), 2.0, 1e-12);
+
+	//bilinear
+	EXPECT_NEAR(T.height(1.25, 2.0), 0.5, 1e-12);
+	EXPECT_NEAR(T.height(1.75, 2.25), 0.25*1.0 + 0.25*2.0, 1e-12);
+
+	//extended beyond the edges
+	EXPECT_NEAR(T.height(10.0, 2.5), 2.0, 1e-12);
+	EXPECT_NEAR(T.height(1.5, -10.0), 1.0, 1e-12);
+	EXPECT_EQ(T.normal(10.0, 10.0).z, 1.0);
+
+	//normal where the surface rises at 2 (m/m) in X and falls at 1 (m/m) in Y
+	Vec3D<double> n = T.normal(1.25, 2.0);
+	EXPECT_NEAR(n.x, -2.0/sqrt(6.0), 1e-12);
+	EXPECT_NEAR(n.y, 1.0/sqrt(6.0), 1e-12);
+	EXPECT_NEAR(n.z, 1.0/sqrt(6.0), 1e-12);
+}
+
+TEST(CVoxelyze, terrainFlat)
+{
+	//a flat heightfield must give exactly the same result as the plain floor
+	CVoxelyze A(0.001), B(0.001);
+	CVoxelyze* sims[2] = {&A, &B};
+	CVX_Voxel* pV[2];
+	for (int i=0; i<2; i++){
+		sims[i]->enableFloor();
+		sims[i]->setGravity();
+		CVX_Material* pMat = sims[i]->addMaterial(1e6, 1e3);
+		pMat->setStaticFriction(1.0f);
+		pMat->setKineticFriction(0.5f);
+		pV[i] = sims[i]->setVoxel(pMat, 0, 0, 1);
+		pV[i]->external()->setForce(5e-6f, 2e-6f, 0);
+	}
+	B.setTerrain(CVX_Heightfield(4, 4, 0.001, -0.002, -0.002));
+	EXPECT_TRUE(B.terrain() != NULL);
+
+	float ts = A.recommendedTimeStep();
+	for (int i=0; i<500; i++){
+		A.doTimeStep(ts);
+		B.doTimeStep(ts);
+	}
+	EXPECT_EQ(pV[0]->position().x, pV[1]->position().x);
+	EXPECT_EQ(pV[0]->position().y, pV[1]->position().y);
+	EXPECT_EQ(pV[0]->position().z, pV[1]->position().z);
+	EXPECT_EQ(pV[0]->isFloorStaticFriction(), pV[1]->isFloorStaticFriction());
+
+	B.clearTerrain();
+	EXPECT_TRUE(B.terrain() == NULL);
+}
+
+TEST(CVoxelyze, terrain)
+{
+	double vSize = 0.001;
+	CVoxelyze Sim(vSize);
+	Sim.enableFloor();
+	Sim.setGravity();
+	CVX_Material* pMat = Sim.addMaterial(1e6, 1e3);
+	pMat->setCollisionDamping(1.0f);
+	pMat->setStaticFriction(0.0f);
+	pMat->setKineticFriction(0.0f);
+	CVX_Voxel* pV = Sim.setVoxel(pMat, 0, 0, 4);
+
+	//raised plateau: voxel settles on top of it
+	CVX_Heightfield Plateau(2, 2, 0.01, -0.005, -0.005);
+	for (int i=0; i<2; i++) for (int j=0; j<2; j++) Plateau.setHeight(i, j, 0.002f);
+	Sim.setTerrain(Plateau);
+	float ts = Sim.recommendedTimeStep();
+	for (int i=0; i<10000; i++) Sim.doTimeStep(ts);
+	EXPECT_NEAR(pV->position().z, 0.002, 0.00005);
+	EXPECT_NEAR(pV->position().x, 0.0, 1e-9);
+
+	//frictionless slope rising in X: voxel slides downhill
+	CVX_Heightfield Slope(3, 3, 0.01, -0.01, -0.01);
+	for (int i=0; i<3; i++) for (int j=0; j<3; j++) Slope.setHeight(i, j, (float)(0.002 + 0.2*0.01*(i-1)));
+	Sim.setTerrain(Slope);
+	for (int i=0; i<2000; i++) Sim.doTimeStep(ts);
+	EXPECT_LT(pV->position().x, -1e-5);
+	EXPECT_NEAR(pV->position().y, 0.0, 1e-9);
+	EXPECT_NEAR(pV->position().z, Slope.height(pV->position().x, 0.0), 0.0001);
+
+	//with enough friction it stays put
+	pMat->setStaticFriction(1.0f);
+	pMat->setKineticFriction(0.8f);
+	for (int i=0; i<2000; i++) Sim.doTimeStep(ts);
+	double xStuck = pV->position().x;
+	for (int i=0; i<500; i++) Sim.doTimeStep(ts);
+	EXPECT_NEAR(pV->position().x, xStuck, 1e-9);
+}
@@ -0,0 +1,524 @@
+#include "../include/VX_LinearSolver.h"
+#include "../include/Voxelyze.h"
+
+TEST(CVX_LinearSolver, cantileverCG)
+{
+	//tip loaded cantilever: chained beam elements are exact for a point load at the tip
+	double vSize = 0.001;
+	float E = 1e6f;
+	int n = 10;
+	float force = -1e-3f;
+
+	CVX_LinearSolver::solverType types[4] = {CVX_LinearSolver::CG_JACOBI, CVX_LinearSolver::CG_BLOCK_JACOBI, CVX_LinearSolver::CG_MULTIGRID, CVX_LinearSolver::DIRECT};
+	for (int t=0; t<4; t++){
+		CVoxelyze Sim(vSize);
+		CVX_Material* pMat = Sim.addMaterial(E, 1e3f);
+		for (int i=0; i<n; i++) Sim.setVoxel(pMat, i, 0, 0);
+		Sim.voxel(0,0,0)->external()->setFixedAll();
+		Sim.voxel(n-1,0,0)->external()->setForce(0, force/2, force);
+
+		EXPECT_TRUE(Sim.doLinearSolve(types[t]));
+
+		double L = (n-1)*vSize;
+		double EI = E*vSize*vSize*vSize*vSize/12.0;
+		Vec3D<double> tip = Sim.voxel(n-1,0,0)->displacement();
+		EXPECT_NEAR(tip.z, force*L*L*L/(3*EI), 1e-5*fabs(force*L*L*L/(3*EI)));
+		EXPECT_NEAR(tip.y, force/2*L*L*L/(3*EI), 1e-5*fabs(force*L*L*L/(3*EI)));
+		EXPECT_NEAR(tip.x, 0.0, 1e-12);
+		EXPECT_NEAR(Sim.voxel(n-1,0,0)->angularDisplacementMagnitude(), sqrt(1.25)*fabs(force)*L*L/(2*EI), 1e-4);
+		EXPECT_EQ(Sim.voxel(0,0,0)->displacementMagnitude(), 0.0f);
+	}
+}
+
+TEST(CVX_LinearSolver, matchesDynamicEquilibrium)
+{
+	//all three link axes, loads in all directions and a prescribed displacement
+	double vSize = 0.001;
+	CVoxelyze Lin(vSize), Dyn(vSize);
+	CVoxelyze* sims[2] = {&Lin, &Dyn};
+	for (int s=0; s<2; s++){
+		CVX_Material* pMat = sims[s]->addMaterial(1e6f, 1e3f);
+		pMat->setGlobalDamping(0.5f);
+		for (int i=0; i<3; i++) for (int j=0; j<2; j++) for (int k=0; k<4; k++) sims[s]->setVoxel(pMat, i, j, k);
+		for (int i=0; i<3; i++) for (int j=0; j<2; j++) sims[s]->voxel(i,j,0)->external()->setFixedAll();
+		sims[s]->voxel(2,0,0)->external()->setDisplacement(Z_TRANSLATE, 2e-6);
+		sims[s]->voxel(2,1,3)->external()->setForce(1e-3f, -2e-3f, 3e-3f);
+		sims[s]->voxel(0,0,3)->external()->setMoment(0, 0, 1e-6f);
+	}
+
+	ASSERT_TRUE(Lin.doLinearSolve(CVX_LinearSolver::CG_BLOCK_JACOBI));
+
+	float ts = Dyn.recommendedTimeStep();
+	for (int i=0; i<40000; i++) Dyn.doTimeStep(ts);
+
+	double maxDisp = 0;
+	for (int i=0; i<Lin.voxelCount(); i++) maxDisp = std::max(maxDisp, (double)Lin.voxel(i)->displacementMagnitude());
+	for (int i=0; i<Lin.voxelCount(); i++){
+		Vec3D<double> d1 = Lin.voxel(i)->displacement(), d2 = Dyn.voxel(i)->displacement();
+		EXPECT_NEAR(d1.x, d2.x, 0.02*maxDisp);
+		EXPECT_NEAR(d1.y, d2.y, 0.02*maxDisp);
+		EXPECT_NEAR(d1.z, d2.z, 0.02*maxDisp);
+	}
+}
+
+TEST(CVX_LinearSolver, multigrid)
+{
+	//irregular block with fixed and prescribed degrees of freedom: multigrid must agree with block jacobi in far fewer iterations
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<24; i++) for (int j=0; j<5; j++) for (int k=0; k<7; k++) if (i<12 || k<4) Sim.setVoxel(pMat, i, j, k);
+	for (int j=0; j<5; j++) for (int k=0; k<7; k++){
+		Sim.voxel(0,j,k)->external()->setFixedAll();
+		Sim.voxel(23,j,k%4)->external()->setForce(1e-4f, 0, -1e-3f);
+	}
+	Sim.voxel(0,2,6)->external()->setDisplacement(Z_TRANSLATE, 1e-5);
+	Sim.voxel(11,4,6)->external()->setMoment(0, 1e-6f, 0);
+
+	CVX_LinearSolver BlockJacobi(&Sim), Multigrid(&Sim);
+	ASSERT_TRUE(BlockJacobi.solve(CVX_LinearSolver::CG_BLOCK_JACOBI));
+	std::vector<Vec3D<double> > d(Sim.voxelCount());
+	for (int i=0; i<Sim.voxelCount(); i++) d[i] = Sim.voxel(i)->displacement();
+
+	ASSERT_TRUE(Multigrid.solve(CVX_LinearSolver::CG_MULTIGRID));
+	EXPECT_GT(Multigrid.multigridLevels, 1);
+	EXPECT_LT(4*Multigrid.iterations, BlockJacobi.iterations);
+	EXPECT_LE(Multigrid.relativeResidual, Multigrid.tolerance);
+
+	double maxDisp = 0;
+	for (int i=0; i<Sim.voxelCount(); i++) maxDisp = std::max(maxDisp, d[i].Length());
+	for (int i=0; i<Sim.voxelCount(); i++){
+		EXPECT_NEAR(Sim.voxel(i)->displacement().x, d[i].x, 1e-6*maxDisp);
+		EXPECT_NEAR(Sim.voxel(i)->displacement().y, d[i].y, 1e-6*maxDisp);
+		EXPECT_NEAR(Sim.voxel(i)->displacement().z, d[i].z, 1e-6*maxDisp);
+	}
+	EXPECT_NEAR(Sim.voxel(0,2,6)->displacement().z, 1e-5, 1e-12);
+}
+
+TEST(CVX_LinearSolver, direct)
+{
+	//the direct solver must agree with conjugate gradient on an irregular structure with several separators
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	CVX_Material* pStiff = Sim.addMaterial(1e9f, 1e3f); //badly conditioned
+	for (int i=0; i<20; i++) for (int j=0; j<4; j++) for (int k=0; k<6; k++) if (i<10 || k<3) Sim.setVoxel((i+j)%3 ? pMat : pStiff, i, j, k);
+	for (int j=0; j<4; j++) for (int k=0; k<6; k++) Sim.voxel(0,j,k)->external()->setFixedAll();
+	Sim.voxel(19,3,2)->external()->setForce(1e-4f, 0, -1e-3f);
+	Sim.voxel(9,0,5)->external()->setMoment(0, 1e-6f, 0);
+	Sim.voxel(0,1,5)->external()->setDisplacement(Y_TRANSLATE, 1e-6);
+
+	CVX_LinearSolver Iterative(&Sim), Direct(&Sim);
+	Iterative.tolerance = 1e-12;
+	ASSERT_TRUE(Iterative.solve(CVX_LinearSolver::CG_MULTIGRID));
+	std::vector<Vec3D<double> > d(Sim.voxelCount());
+	for (int i=0; i<Sim.voxelCount(); i++) d[i] = Sim.voxel(i)->displacement();
+
+	ASSERT_TRUE(Direct.solve(CVX_LinearSolver::DIRECT));
+	double maxDisp = 0;
+	for (int i=0; i<Sim.voxelCount(); i++) maxDisp = std::max(maxDisp, d[i].Length());
+	for (int i=0; i<Sim.voxelCount(); i++){
+		EXPECT_NEAR(Sim.voxel(i)->displacement().x, d[i].x, 1e-6*maxDisp);
+		EXPECT_NEAR(Sim.voxel(i)->displacement().y, d[i].y, 1e-6*maxDisp);
+		EXPECT_NEAR(Sim.voxel(i)->displacement().z, d[i].z, 1e-6*maxDisp);
+	}
+	EXPECT_NEAR(Sim.voxel(0,1,5)->displacement().y, 1e-6, 1e-15);
+
+	//doubled loads reuse the factorization
+	double zTip = Sim.voxel(19,3,2)->displacement().z;
+	Sim.voxel(19,3,2)->external()->setForce(2e-4f, 0, -2e-3f);
+	Sim.voxel(9,0,5)->external()->setMoment(0, 2e-6f, 0);
+	Sim.voxel(0,1,5)->external()->setDisplacement(Y_TRANSLATE, 2e-6);
+	ASSERT_TRUE(Direct.solve(CVX_LinearSolver::DIRECT));
+	EXPECT_EQ(Direct.factorizationCount, 1);
+	EXPECT_NEAR(Sim.voxel(19,3,2)->displacement().z, 2*zTip, 1e-9*fabs(zTip));
+
+	//nothing fixed: singular
+	for (int j=0; j<4; j++) for (int k=0; k<6; k++) Sim.voxel(0,j,k)->external()->setFixedAll(false);
+	EXPECT_FALSE(Direct.solve(CVX_LinearSolver::DIRECT));
+	EXPECT_FALSE(Direct.errorMsg.empty());
+}
+
+TEST(CVX_LinearSolver, reuse)
+{
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	CVX_Material* pStiff = Sim.addMaterial(2e6f, 1e3f);
+	for (int i=0; i<8; i++) for (int k=0; k<3; k++) Sim.setVoxel(pMat, i, 0, k);
+	for (int k=0; k<3; k++) Sim.voxel(0,0,k)->external()->setFixedAll();
+	CVX_Voxel* pTip = Sim.voxel(7,0,2);
+	CVX_LinearSolver* pSolver = Sim.linearSolver();
+
+	pTip->external()->setForce(0, 0, -1e-3f);
+	ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_MULTIGRID));
+	double z1 = pTip->displacement().z;
+	EXPECT_EQ(pSolver->analysisCount, 1);
+	EXPECT_EQ(pSolver->factorizationCount, 1);
+
+	//new load only: reuses everything and stays linear
+	pTip->external()->setForce(0, 0, -2e-3f);
+	ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_MULTIGRID));
+	EXPECT_NEAR(pTip->displacement().z, 2*z1, 1e-6*fabs(z1));
+	EXPECT_EQ(pSolver->analysisCount, 1);
+	EXPECT_EQ(pSolver->factorizationCount, 1);
+
+	//stiffer material everywhere: same structure, new factorization
+	Sim.replaceMaterial(pMat, pStiff);
+	ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_MULTIGRID));
+	EXPECT_NEAR(pTip->displacement().z, z1, 1e-6*fabs(z1));
+	EXPECT_EQ(pSolver->analysisCount, 1);
+	EXPECT_EQ(pSolver->factorizationCount, 2);
+
+	//a different solver needs its own preconditioner
+	ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_BLOCK_JACOBI));
+	EXPECT_NEAR(pTip->displacement().z, z1, 1e-6*fabs(z1));
+	EXPECT_EQ(pSolver->factorizationCount, 3);
+
+	//new voxel: everything is rebuilt
+	Sim.setVoxel(pStiff, 8, 0, 2)->external()->setForce(0, 0, -1e-3f);
+	ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_BLOCK_JACOBI));
+	EXPECT_LT(pTip->displacement().z, z1);
+	EXPECT_EQ(pSolver->analysisCount, 2);
+	EXPECT_EQ(pSolver->factorizationCount, 4);
+	EXPECT_EQ(Sim.linearSolver(), pSolver);
+}
+
+TEST(CVX_LinearSolver, noPardiso)
+{
+#ifndef PARDISO_5
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	Sim.setVoxel(pMat, 0, 0, 0)->external()->setFixedAll();
+	Sim.setVoxel(pMat, 1, 0, 0)->external()->setForce(0, 0, -1e-3f);
+	EXPECT_FALSE(Sim.doLinearSolve(CVX_LinearSolver::PARDISO));
+	EXPECT_TRUE(Sim.doLinearSolve());
+#endif
+}
+
+TEST(CVX_LinearSolver, loadCases)
+{
+	//several load cases with one preconditioner must match separate solves and leave the voxels alone
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<6; i++) for (int j=0; j<2; j++) for (int k=0; k<3; k++) Sim.setVoxel(pMat, i, j, k);
+	for (int j=0; j<2; j++) for (int k=0; k<3; k++) Sim.voxel(0,j,k)->external()->setFixedAll();
+	CVX_Voxel* pTip = Sim.voxel(5,1,2);
+	CVX_Voxel* pBase = Sim.voxel(0,0,2);
+
+	std::vector<CVX_LoadCase> cases(3);
+	cases[0].setForce(pTip, 0, 0, -1e-3f);
+	cases[1].setForce(pTip, 2e-3f, 1e-3f, 0);
+	cases[1].setMoment(Sim.voxel(3,0,1), 0, 1e-6f, 0);
+	cases[2].setDisplacement(pBase, Z_TRANSLATE, 1e-5);
+	cases[2].setForce(pBase, 0, 0, 1.0f); //fixed: ignored
+	EXPECT_EQ(cases[1].loadCount(), 2);
+	EXPECT_FALSE(cases[0].isSolved());
+	EXPECT_EQ(cases[0].displacement(0).Length(), 0.0); //no results yet
+	EXPECT_EQ(cases[0].angularDisplacement(0).Length(), 0.0);
+
+	CVX_LinearSolver* pSolver = Sim.linearSolver();
+	ASSERT_TRUE(Sim.doLinearSolve(cases, CVX_LinearSolver::CG_MULTIGRID));
+	EXPECT_EQ(pSolver->factorizationCount, 1);
+	for (int c=0; c<3; c++) EXPECT_TRUE(cases[c].isSolved());
+	EXPECT_EQ(cases[0].displacement(Sim.voxelCount()).Length(), 0.0); //out of range
+	EXPECT_EQ(cases[0].angularDisplacement(-1).Length(), 0.0);
+	for (int i=0; i<Sim.voxelCount(); i++) EXPECT_EQ(Sim.voxel(i)->displacementMagnitude(), 0.0f);
+
+	//the same loads one at a time through the externals
+	for (int c=0; c<3; c++){
+		for (int i=0; i<Sim.voxelCount(); i++){
+			CVX_External* pE = Sim.voxel(i)->external();
+			pE->setForce(0, 0, 0);
+			pE->setMoment(0, 0, 0);
+			if (pE->isFixedAll()) pE->setFixedAll();
+		}
+		if (c==0) pTip->external()->setForce(0, 0, -1e-3f);
+		if (c==1){
+			pTip->external()->setForce(2e-3f, 1e-3f, 0);
+			Sim.voxel(3,0,1)->external()->setMoment(0, 1e-6f, 0);
+		}
+		if (c==2) pBase->external()->setDisplacement(Z_TRANSLATE, 1e-5);
+		ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_MULTIGRID));
+
+		double maxDisp = 0;
+		for (int i=0; i<Sim.voxelCount(); i++) maxDisp = std::max(maxDisp, Sim.voxel(i)->displacement().Length());
+		EXPECT_GT(maxDisp, 0.0);
+		for (int i=0; i<Sim.voxelCount(); i++){
+			Vec3D<double> d = Sim.voxel(i)->displacement(), dc = cases[c].displacement(i);
+			EXPECT_NEAR(dc.x, d.x, 1e-6*maxDisp);
+			EXPECT_NEAR(dc.y, d.y, 1e-6*maxDisp);
+			EXPECT_NEAR(dc.z, d.z, 1e-6*maxDisp);
+			EXPECT_NEAR(cases[c].angularDisplacement(i).Length(), Sim.voxel(i)->angularDisplacementMagnitude(), 1e-3*maxDisp);
+		}
+	}
+	EXPECT_EQ(pSolver->factorizationCount, 1); //fixed degrees of freedom and stiffness never changed
+}
+
+TEST(CVX_LinearSolver, nonlinear)
+{
+	//small loads: same as the linear solution
+	CVoxelyze Lin(0.001), Sim(0.001);
+	CVoxelyze* sims[2] = {&Lin, &Sim};
+	for (int s=0; s<2; s++){
+		CVX_Material* pMat = sims[s]->addMaterial(1e6f, 1e3f);
+		for (int i=0; i<10; i++) for (int k=0; k<2; k++) sims[s]->setVoxel(pMat, i, 0, k);
+		for (int k=0; k<2; k++) sims[s]->voxel(0,0,k)->external()->setFixedAll();
+		sims[s]->voxel(9,0,1)->external()->setForce(0, 2e-7f, -1e-6f);
+	}
+	ASSERT_TRUE(Lin.doLinearSolve(CVX_LinearSolver::DIRECT));
+	ASSERT_TRUE(Sim.doNonlinearSolve(1, CVX_LinearSolver::DIRECT));
+	EXPECT_LE(Sim.linearSolver()->newtonIterations, 3);
+	double tipZ = Lin.voxel(9,0,1)->displacement().z;
+	for (int i=0; i<Sim.voxelCount(); i++){
+		Vec3D<double> d1 = Lin.voxel(i)->displacement(), d2 = Sim.voxel(i)->displacement();
+		EXPECT_NEAR(d2.x, d1.x, 1e-3*fabs(tipZ));
+		EXPECT_NEAR(d2.y, d1.y, 1e-3*fabs(tipZ));
+		EXPECT_NEAR(d2.z, d1.z, 1e-3*fabs(tipZ));
+	}
+
+	//large deflection: the tip swings inwards, which the linear solution misses. Every solver reaches the same equilibrium as dynamic relaxation in tens of iterations.
+	CVoxelyze Relax(0.001);
+	CVX_Material* pMat = Relax.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<10; i++) Relax.setVoxel(pMat, i, 0, 0);
+	Relax.voxel(0,0,0)->external()->setFixedAll();
+	Relax.voxel(9,0,0)->external()->setForce(0, 0, -1e-3f);
+	ASSERT_TRUE(Relax.doRelaxationSolve(1e-7f, 1000000));
+	Vec3D<double> tip = Relax.voxel(9,0,0)->displacement();
+	EXPECT_LT(tip.x, -1e-4);
+
+	CVX_LinearSolver::solverType types[3] = {CVX_LinearSolver::CG_BLOCK_JACOBI, CVX_LinearSolver::CG_MULTIGRID, CVX_LinearSolver::DIRECT};
+	for (int t=0; t<3; t++){
+		ASSERT_TRUE(Relax.doNonlinearSolve(4, types[t]));
+		EXPECT_LT(Relax.linearSolver()->newtonIterations, 50);
+		EXPECT_LT((Relax.voxel(9,0,0)->displacement() - tip).Length(), 1e-5*tip.Length());
+		EXPECT_EQ(Relax.voxel(9,0,0)->velocityMagnitude(), 0.0f);
+	}
+	EXPECT_EQ(Relax.linearSolver()->analysisCount, 1); //every iteration shared the same structure
+
+	//too few iterations allowed
+	Relax.linearSolver()->maxNewtonIterations = 1;
+	EXPECT_FALSE(Relax.doNonlinearSolve(1, CVX_LinearSolver::DIRECT));
+	EXPECT_FALSE(Relax.linearSolver()->errorMsg.empty());
+}
+
+TEST(CVX_LinearSolver, nonlinearMaterial)
+{
+	//bar loaded well past yield: strain follows the bilinear curve
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	pMat->setModelBilinear(1e6f, 1e5f, 1e4f);
+	for (int i=0; i<5; i++) Sim.setVoxel(pMat, i, 0, 0);
+	Sim.voxel(0,0,0)->external()->setFixedAll();
+	Sim.voxel(4,0,0)->external()->setForce(2e-2f, 0, 0); //2e4 Pa
+
+	ASSERT_TRUE(Sim.doNonlinearSolve(5, CVX_LinearSolver::DIRECT));
+	EXPECT_LT(Sim.linearSolver()->newtonIterations, 10);
+	double strain = 1e4/1e6 + (2e4-1e4)/1e5;
+	EXPECT_NEAR(Sim.voxel(4,0,0)->displacement().x, 4*0.001*strain, 1e-5*4*0.001*strain);
+	EXPECT_NEAR(Sim.voxel(4,0,0)->displacement().y, 0.0, 1e-12);
+	EXPECT_TRUE(Sim.link(0)->isYielded());
+
+	//prescribed displacement past yield instead: uniform strain, and the links carry the stress of the curve
+	Sim.voxel(4,0,0)->external()->setForce(0, 0, 0);
+	Sim.voxel(4,0,0)->external()->setDisplacement(X_TRANSLATE, 4*0.001*0.05);
+	ASSERT_TRUE(Sim.doNonlinearSolve(5, CVX_LinearSolver::CG_MULTIGRID));
+	EXPECT_NEAR(Sim.voxel(2,0,0)->displacement().x, 2*0.001*0.05, 1e-9);
+	for (int i=0; i<Sim.linkCount(); i++) EXPECT_NEAR(Sim.link(i)->axialStress(), 1e4 + (0.05-0.01)*1e5, 1.0);
+}
+
+TEST(CVX_LinearSolver, modes)
+{
+	//cantilever: the first bending frequency matches beam theory (with the beam measured to the center of the fixed voxel's face), and is the same in Y and Z
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<20; i++) Sim.setVoxel(pMat, i, 0, 0);
+	Sim.voxel(0,0,0)->external()->setFixedAll();
+	CVX_LinearSolver* pSolver = Sim.linearSolver();
+
+	double L = 19.5*0.001, I = 1e-12/12, A = 1e-6;
+	double beamFreq = 1.875*1.875/(2*3.14159265358979*L*L)*sqrt(1e6*I/(1e3*A));
+	CVX_LinearSolver::solverType types[3] = {CVX_LinearSolver::CG_BLOCK_JACOBI, CVX_LinearSolver::CG_MULTIGRID, CVX_LinearSolver::DIRECT};
+	for (int t=0; t<3; t++){
+		ASSERT_TRUE(Sim.doModalAnalysis(4, true, types[t]));
+		ASSERT_EQ((int)pSolver->modeFrequencies.size(), 4);
+		EXPECT_NEAR(pSolver->modeFrequencies[0], beamFreq, 0.01*beamFreq);
+		EXPECT_NEAR(pSolver->modeFrequencies[1], pSolver->modeFrequencies[0], 1e-6*beamFreq);
+		EXPECT_NEAR(pSolver->modeFrequencies[2]/pSolver->modeFrequencies[0], 6.27, 0.1); //second bending mode
+		EXPECT_GT(pSolver->highestFrequency, 100*pSolver->modeFrequencies[3]);
+	}
+	EXPECT_EQ(Sim.voxel(19,0,0)->displacement().Length(), 0.0); //voxels untouched
+
+	//mode shapes are transverse and scaled to unit modal mass
+	for (int m=0; m<2; m++){
+		double modalMass = 0;
+		for (int i=0; i<20; i++){
+			CVX_MaterialVoxel* pVoxMat = Sim.voxel(i)->material();
+			modalMass += pVoxMat->mass()*pSolver->modeTranslation(m, i).Length2();
+			modalMass += pVoxMat->momentInertia()*pSolver->modeRotation(m, i).Length2();
+		}
+		EXPECT_NEAR(modalMass, 1.0, 1e-6);
+		EXPECT_EQ(pSolver->modeTranslation(m, 0).Length(), 0.0);
+		EXPECT_NEAR(pSolver->modeTranslation(m, 19).x, 0.0, 1e-6*pSolver->modeTranslation(m, 19).Length());
+	}
+	EXPECT_EQ(pSolver->modeTranslation(4, 19).Length(), 0.0); //out of range
+
+	//a free structure has six rigid body modes
+	CVoxelyze Free(0.001);
+	pMat = Free.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<2; i++) for (int j=0; j<2; j++) for (int k=0; k<2; k++) Free.setVoxel(pMat, i, j, k);
+	ASSERT_TRUE(Free.doModalAnalysis(7, false, CVX_LinearSolver::CG_MULTIGRID));
+	for (int m=0; m<6; m++) EXPECT_LT(Free.linearSolver()->modeFrequencies[m], 1e-3*Free.linearSolver()->modeFrequencies[6]);
+	EXPECT_GT(Free.linearSolver()->modeFrequencies[6], 1000.0);
+}
+
+TEST(CVX_LinearSolver, stableTimeStep)
+{
+	CVoxelyze Sim(0.001), Fast(0.001);
+	CVoxelyze* sims[2] = {&Sim, &Fast};
+	CVX_Material* mats[2];
+	for (int s=0; s<2; s++){
+		CVX_Material* pMat = mats[s] = sims[s]->addMaterial(1e6f, 1e3f);
+		pMat->setInternalDamping(0.0f);
+		for (int i=0; i<4; i++) for (int j=0; j<3; j++) for (int k=0; k<2; k++) sims[s]->setVoxel(pMat, i, j, k);
+		for (int j=0; j<3; j++) for (int k=0; k<2; k++) sims[s]->voxel(0,j,k)->external()->setFixedAll();
+		sims[s]->voxel(3,1,1)->external()->setForce(0, 0, -1e-4f);
+	}
+
+	//undamped, the explicit update is stable up to two radians of the highest frequency
+	float dt = Sim.stableTimeStep();
+	EXPECT_NEAR(dt*2*3.14159265358979*Sim.linearSolver()->highestFrequency, 1.8, 1e-4);
+	EXPECT_GT(dt, 2*Sim.recommendedTimeStep());
+	EXPECT_EQ(Sim.linearSolver()->highestDamping, 0.0);
+	for (int i=0; i<10000; i++) ASSERT_TRUE(Sim.doTimeStep(dt));
+	EXPECT_LT(Sim.voxel(3,1,1)->displacement().Length(), 0.001);
+
+	//and the bound is tight: a little past it without the margin blows up
+	bool diverged = false;
+	for (int i=0; i<10000 && !diverged; i++) diverged = !Fast.doTimeStep(dt/0.9f*1.2f) || Fast.voxel(3,1,1)->displacement().Length() > 0.001;
+	EXPECT_TRUE(diverged);
+
+	//damping lowers it
+	for (int s=0; s<2; s++) mats[s]->setInternalDamping(1.0f);
+	float dtDamped = Sim.stableTimeStep();
+	EXPECT_LT(dtDamped, 0.5f*dt);
+	for (int i=0; i<10000; i++) ASSERT_TRUE(Sim.doTimeStep(dtDamped));
+	ASSERT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::DIRECT));
+	double staticZ = Sim.voxel(3,1,1)->displacement().z;
+	Sim.resetTime();
+	for (int i=0; i<20000; i++) ASSERT_TRUE(Sim.doTimeStep(dtDamped));
+	EXPECT_NEAR(Sim.voxel(3,1,1)->displacement().z, staticZ, 0.01*fabs(staticZ));
+
+	//damped instability grows until the nonlinear links hold it, so look for it well above the static deflection
+	Fast.resetTime();
+	diverged = false;
+	for (int i=0; i<10000 && !diverged; i++) diverged = !Fast.doTimeStep(dtDamped/0.9f*1.2f) || Fast.voxel(3,1,1)->displacement().Length() > 10*fabs(staticZ);
+	EXPECT_TRUE(diverged);
+}
+
+TEST(CVX_LinearSolver, async)
+{
+	CVoxelyze Sim(0.001), Sync(0.001);
+	CVoxelyze* sims[2] = {&Sim, &Sync};
+	for (int s=0; s<2; s++){
+		CVX_Material* pMat = sims[s]->addMaterial(1e6f, 1e3f);
+		for (int i=0; i<10; i++) for (int j=0; j<4; j++) for (int k=0; k<4; k++) sims[s]->setVoxel(pMat, i, j, k);
+		for (int j=0; j<4; j++) for (int k=0; k<4; k++) sims[s]->voxel(0,j,k)->external()->setFixedAll();
+		sims[s]->voxel(9,0,3)->external()->setForce(0, 0, -1e-3f);
+	}
+	ASSERT_TRUE(Sync.doLinearSolve(CVX_LinearSolver::DIRECT));
+	CVX_LinearSolver* pSolver = Sim.linearSolver();
+
+	//cancelled from the worker thread at its first progress update: the voxels are left alone
+	int callbacks = 0;
+	pSolver->progressCallback = [&](float, const std::string&){if (callbacks++ == 0) pSolver->cancelFlag = true;};
+	std::future<bool> result = Sim.doLinearSolveAsync(CVX_LinearSolver::DIRECT);
+	EXPECT_FALSE(result.get());
+	EXPECT_EQ(callbacks, 1); //stopped at the next check
+	EXPECT_EQ(pSolver->errorMsg, "Solve cancelled.\n");
+	EXPECT_EQ(Sim.voxel(9,0,3)->displacement().Length(), 0.0);
+	pSolver->progressCallback = nullptr;
+
+	//runs to completion in the background
+	result = Sim.doLinearSolveAsync(CVX_LinearSolver::DIRECT);
+	while (result.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready){
+		EXPECT_GE(pSolver->progressTick, 0);
+		EXPECT_LE(pSolver->progressTick, pSolver->progressMaxTick);
+		EXPECT_FALSE(pSolver->progressMessage().empty());
+	}
+	EXPECT_TRUE(result.get());
+	EXPECT_EQ(pSolver->progressTick, pSolver->progressMaxTick);
+	EXPECT_EQ(pSolver->progressMessage(), "Done.");
+	EXPECT_EQ(Sim.voxel(9,0,3)->displacement().z, Sync.voxel(9,0,3)->displacement().z);
+
+	//a cancel left over from before does not stop the next solve
+	pSolver->cancelFlag = true;
+	EXPECT_TRUE(Sim.doLinearSolve(CVX_LinearSolver::CG_MULTIGRID));
+}
+
+//reaches into the solver for the assembled (pardiso) stiffness matrix
+class CVX_LinearSolverTest
+{
+public:
+	static bool assemble(CVX_LinearSolver* pSolver){
+		CVX_LinearSolver::solverType type = CVX_LinearSolver::PARDISO;
+		if (!pSolver->prepare(type)) return false;
+		pSolver->setupBoundaryConditions(NULL);
+		pSolver->calculatePattern();
+		pSolver->calculateA();
+		return true;
+	}
+	static int dof(CVX_LinearSolver* pSolver) {return pSolver->dof;}
+	static const std::vector<int>& ia(CVX_LinearSolver* pSolver) {return pSolver->ia;}
+	static const std::vector<int>& ja(CVX_LinearSolver* pSolver) {return pSolver->ja;}
+	static const std::vector<double>& a(CVX_LinearSolver* pSolver) {return pSolver->a;}
+	static void multiplyA(CVX_LinearSolver* pSolver, const std::vector<double>& in, std::vector<double>& out) {pSolver->multiplyA(in, out);}
+};
+
+TEST(CVX_LinearSolver, assembledMatrix)
+{
+	//two materials set in a scrambled order with a few voxels removed, so neighbors are far apart in the voxel list and rows have every number of higher-indexed links
+	CVoxelyze Sim(0.001);
+	CVX_Material* pSoft = Sim.addMaterial(1e6f, 1e3f);
+	CVX_Material* pStiff = Sim.addMaterial(5e6f, 2e3f);
+	pStiff->setPoissonsRatio(0.3f);
+	const int nx=5, ny=4, nz=3, count=nx*ny*nz;
+	for (int n=0; n<count; n++){
+		int k = (n*37)%count; //37 is coprime with 60, so every location once
+		int x = k%nx, y = (k/nx)%ny, z = k/(nx*ny);
+		Sim.setVoxel((x+y+z)%2 ? pStiff : pSoft, x, y, z);
+	}
+	Sim.setVoxel(NULL, 0, 0, 0);
+	Sim.setVoxel(NULL, 2, 1, 1);
+	Sim.setVoxel(NULL, 4, 3, 2);
+	ASSERT_EQ(Sim.voxelCount(), count-3);
+
+	CVX_LinearSolver* pSolver = Sim.linearSolver();
+	ASSERT_TRUE(CVX_LinearSolverTest::assemble(pSolver));
+	int dof = CVX_LinearSolverTest::dof(pSolver);
+	const std::vector<int>& ia = CVX_LinearSolverTest::ia(pSolver);
+	const std::vector<int>& ja = CVX_LinearSolverTest::ja(pSolver);
+	const std::vector<double>& a = CVX_LinearSolverTest::a(pSolver);
+	ASSERT_EQ(dof, 6*Sim.voxelCount());
+	ASSERT_EQ((int)ia.size(), dof+1);
+	ASSERT_EQ(ia[dof], (int)ja.size());
+
+	//upper triangle, diagonal first and columns ascending in every row
+	std::vector<double> K(dof*dof, 0.0);
+	for (int r=0; r<dof; r++){
+		ASSERT_LT(ia[r], ia[r+1]);
+		EXPECT_EQ(ja[ia[r]], r);
+		for (int k=ia[r]; k<ia[r+1]; k++){
+			if (k > ia[r]) EXPECT_GT(ja[k], ja[k-1]);
+			K[r*dof+ja[k]] = K[ja[k]*dof+r] = a[k];
+		}
+	}
+
+	//and the same matrix the matrix-free solvers apply
+	std::vector<double> unit(dof, 0.0), column(dof);
+	double maxK = 0;
+	for (int i=0; i<dof*dof; i++) maxK = std::max(maxK, fabs(K[i]));
+	for (int c=0; c<dof; c++){
+		unit[c] = 1.0;
+		CVX_LinearSolverTest::multiplyA(pSolver, unit, column);
+		unit[c] = 0.0;
+		for (int r=0; r<dof; r++) ASSERT_NEAR(K[r*dof+c], column[r], 1e-12*maxK) << "row " << r << " column " << c;
+	}
+}
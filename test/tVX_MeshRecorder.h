@@ -0,0 +1,86 @@
+#include "../include/VX_MeshRecorder.h"
+#include "../include/Voxelyze.h"
+#include <fstream>
+#include <cstdio>
+
+TEST(CVX_MeshRecorder, recordAndRead)
+{
+	CVoxelyze Sim(0.001);
+	Sim.setGravity();
+	Sim.enableFloor();
+	CVX_Material* pMat = Sim.addMaterial(1e6, 1e3);
+	for (int i=0; i<4; i++) for (int j=0; j<3; j++) Sim.setVoxel(pMat, i, j, 1);
+	CVX_MeshRender Mesh(&Sim);
+
+	double precision = 1e-7;
+	CVX_MeshRecorder Rec;
+	ASSERT_TRUE(Rec.open("tVX_MeshRecorder.vxm", Mesh, precision, 2, 4));
+
+	//record frames, keeping what was recorded and the obj size for comparison
+	std::vector<std::vector<float> > recorded, recordedFields;
+	size_t objBytes = 0;
+	float dt = Sim.recommendedTimeStep();
+	for (int f=0; f<11; f++){
+		for (int s=0; s<10; s++) Sim.doTimeStep(dt);
+		Mesh.updateMesh();
+		std::vector<float> fields(2*Mesh.quadList()->size()/4);
+		for (int i=0; i<(int)fields.size(); i++) fields[i] = f + 0.5f*i;
+
+		ASSERT_TRUE(Rec.recordFrame(Mesh, f*dt, &fields[0]));
+		recorded.push_back(*Mesh.vertexList());
+		recordedFields.push_back(fields);
+
+		Mesh.saveObj("tVX_MeshRecorder.obj");
+		std::ifstream obj("tVX_MeshRecorder.obj", std::ios::binary | std::ios::ate);
+		objBytes += (size_t)obj.tellg();
+	}
+	EXPECT_FALSE(Rec.recordFrame(Mesh, 0.0f)); //fields required
+	EXPECT_EQ(Rec.frameCount(), 11);
+	ASSERT_TRUE(Rec.close());
+
+	std::ifstream recFile("tVX_MeshRecorder.vxm", std::ios::binary | std::ios::ate);
+	size_t recBytes = (size_t)recFile.tellg();
+	recFile.close();
+	EXPECT_LT(recBytes, objBytes);
+
+	CVX_MeshReader Reader;
+	ASSERT_TRUE(Reader.open("tVX_MeshRecorder.vxm"));
+	EXPECT_EQ(Reader.frameCount(), 11);
+	EXPECT_EQ(Reader.vertexCount(), (int)Mesh.vertexList()->size()/3);
+	EXPECT_EQ(Reader.fieldCount(), 2);
+	EXPECT_EQ(Reader.precision(), precision);
+	EXPECT_TRUE(*Reader.quadList() == *Mesh.quadList());
+	EXPECT_TRUE(*Reader.lineList() == *Mesh.lineList());
+	EXPECT_EQ(Reader.frameTime(3), 3*dt);
+
+	//sequential, backwards and random access all decode within the quantization precision
+	int order[] = {0, 1, 2, 3, 4, 5, 10, 9, 7, 8, 6, 2};
+	std::vector<float> verts, fields;
+	for (int n=0; n<12; n++){
+		int f = order[n];
+		ASSERT_TRUE(Reader.readFrame(f, &verts, &fields));
+		ASSERT_EQ(verts.size(), recorded[f].size());
+		for (int i=0; i<(int)verts.size(); i++) ASSERT_NEAR(verts[i], recorded[f][i], 0.5*precision + 1e-9);
+		EXPECT_TRUE(fields == recordedFields[f]);
+	}
+	EXPECT_FALSE(Reader.readFrame(11, &verts));
+	Reader.close();
+
+	//a recording that was never closed (no index) is still readable
+	std::ifstream full("tVX_MeshRecorder.vxm", std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(full)), std::istreambuf_iterator<char>());
+	full.close();
+	size_t indexSize = 12*11 + 20;
+	std::ofstream truncated("tVX_MeshRecorder.vxm", std::ios::binary | std::ios::trunc);
+	truncated.write(&data[0], data.size() - indexSize - 10); //also cut into the last frame
+	truncated.close();
+
+	ASSERT_TRUE(Reader.open("tVX_MeshRecorder.vxm"));
+	EXPECT_EQ(Reader.frameCount(), 10);
+	ASSERT_TRUE(Reader.readFrame(9, &verts));
+	for (int i=0; i<(int)verts.size(); i++) ASSERT_NEAR(verts[i], recorded[9][i], 0.5*precision + 1e-9);
+	Reader.close();
+
+	remove("tVX_MeshRecorder.vxm");
+	remove("tVX_MeshRecorder.obj");
+}
@@ -0,0 +1,187 @@
+#include "../include/VX_MeshRender.h"
+#include "../include/Voxelyze.h"
+#include <fstream>
+#include <cstring>
+
+static std::vector<char> readMeshFile(const char* filePath)
+{
+	std::ifstream ifile(filePath, std::ios::binary);
+	return std::vector<char>((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+}
+
+static unsigned int readLE32(const std::vector<char>& data, size_t offset)
+{
+	const unsigned char* p = (const unsigned char*)&data[offset];
+	return p[0] | p[1]<<8 | p[2]<<16 | (unsigned int)p[3]<<24;
+}
+
+TEST(CVX_MeshRender, binaryExport)
+{
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6, 1e3);
+	pMat->setColor(255, 0, 0);
+	Sim.setVoxel(pMat, 0, 0, 0);
+	Sim.setVoxel(pMat, 1, 0, 0);
+	CVX_MeshRender Mesh(&Sim); //two voxels: 12 shared vertices, 10 exposed faces
+
+	//stl: 80 byte header, triangle count, 50 bytes per triangle
+	ASSERT_TRUE(Mesh.saveStl("tVX_MeshRender.stl"));
+	std::vector<char> stl = readMeshFile("tVX_MeshRender.stl");
+	ASSERT_EQ((int)stl.size(), 84 + 50*20);
+	EXPECT_EQ(readLE32(stl, 80), 20u);
+	unsigned short color = (unsigned char)stl[84+48] | (unsigned char)stl[84+49]<<8;
+	EXPECT_EQ(color, 0x8000 | 31<<10); //valid bit and full red
+
+	//ply: text header followed by 12 byte vertices and 32 byte quad faces
+	ASSERT_TRUE(Mesh.savePly("tVX_MeshRender.ply"));
+	std::vector<char> ply = readMeshFile("tVX_MeshRender.ply");
+	std::string plyText(ply.begin(), ply.end());
+	EXPECT_EQ(plyText.find("ply\nformat binary_little_endian 1.0\n"), 0u);
+	EXPECT_NE(plyText.find("element vertex 12\n"), std::string::npos);
+	EXPECT_NE(plyText.find("element face 10\n"), std::string::npos);
+	size_t headerEnd = plyText.find("end_header\n");
+	ASSERT_NE(headerEnd, std::string::npos);
+	headerEnd += strlen("end_header\n");
+	ASSERT_EQ(ply.size(), headerEnd + 12*12 + 32*10);
+	EXPECT_EQ(ply[headerEnd + 12*12], 4); //first face has four vertices
+	EXPECT_EQ((unsigned char)ply[headerEnd + 12*12 + 17], 255); //red
+
+	//glb: header and json chunk, then the binary chunk of positions, normals, colors (4 per quad) and indices (6 per quad)
+	ASSERT_TRUE(Mesh.saveGlb("tVX_MeshRender.glb"));
+	std::vector<char> glb = readMeshFile("tVX_MeshRender.glb");
+	ASSERT_GE((int)glb.size(), 28);
+	EXPECT_EQ(readLE32(glb, 0), 0x46546C67u);
+	EXPECT_EQ(readLE32(glb, 4), 2u);
+	EXPECT_EQ(readLE32(glb, 8), (unsigned int)glb.size());
+	unsigned int jsonSize = readLE32(glb, 12);
+	EXPECT_EQ(jsonSize%4, 0u);
+	EXPECT_EQ(readLE32(glb, 16), 0x4E4F534Au);
+	ASSERT_EQ(glb.size(), 20 + jsonSize + 8 + 3*12*40 + 4*60);
+	EXPECT_EQ(readLE32(glb, 20+jsonSize), (unsigned int)(3*12*40 + 4*60));
+	EXPECT_EQ(readLE32(glb, 24+jsonSize), 0x004E4942u);
+	std::string json(&glb[20], jsonSize);
+	EXPECT_NE(json.find("\"COLOR_0\""), std::string::npos);
+
+	remove("tVX_MeshRender.stl");
+	remove("tVX_MeshRender.ply");
+	remove("tVX_MeshRender.glb");
+
+	//nothing to draw
+	CVoxelyze Empty(0.001);
+	CVX_MeshRender EmptyMesh(&Empty);
+	EXPECT_FALSE(EmptyMesh.saveGlb("tVX_MeshRender.glb"));
+}
+
+TEST(CVX_MeshRender, faceMerging)
+{
+	CVoxelyze Sim(0.001);
+	Sim.setGravity();
+	CVX_Material* pRed = Sim.addMaterial(1e6, 1e3);
+	pRed->setColor(255, 0, 0);
+	CVX_Material* pBlue = Sim.addMaterial(1e6, 1e3);
+	pBlue->setColor(0, 0, 255);
+	for (int i=0; i<10; i++) for (int j=0; j<10; j++) Sim.setVoxel(i<5 ? pRed : pBlue, i, j, 0);
+	Sim.voxel(0, 0, 0)->external()->setFixedAll();
+
+	CVX_MeshRender Full(&Sim), Merged(&Sim, true);
+	EXPECT_FALSE(Full.isFaceMerging());
+	EXPECT_TRUE(Merged.isFaceMerging());
+	EXPECT_EQ((int)Full.quadList()->size()/4, 2*100 + 4*10);
+	EXPECT_EQ((int)Merged.quadList()->size()/4, 10); //top, bottom, +Y and -Y split by color, one on each X end
+	EXPECT_EQ((int)Merged.vertexList()->size()/3, 12);
+	EXPECT_EQ((int)Merged.lineList()->size()/2, 20);
+
+	//merged vertices are driven by the same deformed corners
+	float dt = Sim.recommendedTimeStep();
+	for (int i=0; i<200; i++) Sim.doTimeStep(dt);
+	Full.updateMesh();
+	Merged.updateMesh();
+	const std::vector<float>& fullVerts = *Full.vertexList();
+	const std::vector<float>& mergedVerts = *Merged.vertexList();
+	for (int i=0; i<(int)mergedVerts.size()/3; i++){
+		bool found = false;
+		for (int j=0; j<(int)fullVerts.size()/3 && !found; j++){
+			found = mergedVerts[3*i] == fullVerts[3*j] && mergedVerts[3*i+1] == fullVerts[3*j+1] && mergedVerts[3*i+2] == fullVerts[3*j+2];
+		}
+		EXPECT_TRUE(found);
+	}
+
+	//same color merges across materials
+	pBlue->setColor(255, 0, 0);
+	Merged.generateMesh();
+	EXPECT_EQ((int)Merged.quadList()->size()/4, 6);
+
+	Merged.setFaceMerging(false);
+	EXPECT_EQ(Merged.quadList()->size(), Full.quadList()->size());
+}
+
+TEST(CVX_MeshRender, sparse)
+{
+	//far apart voxels: the mesh only depends on the occupied locations
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6, 1e3);
+	Sim.setVoxel(pMat, -50, 0, 0);
+	Sim.setVoxel(pMat, 50, 60, -70);
+	Sim.setVoxel(pMat, 51, 60, -70);
+
+	for (int merge=0; merge<2; merge++){
+		CVX_MeshRender Mesh(&Sim, merge==1);
+		EXPECT_EQ((int)Mesh.vertexList()->size()/3, merge ? 8 + 8 : 8 + 12);
+		EXPECT_EQ((int)Mesh.quadList()->size()/4, merge ? 6 + 6 : 6 + 10);
+		EXPECT_EQ((int)Mesh.lineList()->size()/2, merge ? 12 + 12 : 12 + 20);
+		EXPECT_NEAR((*Mesh.vertexList())[0], -50*0.001, 0.001);
+	}
+}
+
+TEST(CVX_MeshRender, renderBuffers)
+{
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6, 1e3);
+	CVX_Material* pMat2 = Sim.addMaterial(1e6, 1e3);
+	for (int i=0; i<3; i++) Sim.setVoxel(i==2 ? pMat2 : pMat, i, 0, 0);
+	CVX_MeshRender Mesh(&Sim);
+
+	const std::vector<float>& render = *Mesh.renderVertexList();
+	const std::vector<unsigned int>& indices = *Mesh.renderIndexList();
+	const std::vector<int>& quads = *Mesh.quadList();
+	const std::vector<float>& verts = *Mesh.vertexList();
+	int qCount = (int)quads.size()/4;
+	ASSERT_EQ((int)render.size(), 4*qCount*CVX_MeshRender::VERTEX_STRIDE);
+	ASSERT_EQ((int)indices.size(), 6*qCount);
+	int topology = Mesh.topologyVersion();
+
+	//each quad's four vertices carry its positions and a shared unit normal
+	for (int i=0; i<qCount; i++){
+		for (int j=0; j<4; j++){
+			const float* pV = &render[(4*i+j)*CVX_MeshRender::VERTEX_STRIDE];
+			for (int k=0; k<3; k++) EXPECT_EQ(pV[CVX_MeshRender::POSITION_OFFSET+k], verts[3*quads[4*i+j]+k]);
+			const float* pN = pV + CVX_MeshRender::NORMAL_OFFSET;
+			EXPECT_NEAR(pN[0]*pN[0] + pN[1]*pN[1] + pN[2]*pN[2], 1.0f, 1e-5f);
+		}
+		for (int k=0; k<6; k++){
+			EXPECT_GE(indices[6*i+k], 4u*i);
+			EXPECT_LT(indices[6*i+k], 4u*i+4);
+		}
+	}
+
+	//everything is dirty after generating, nothing after an update without changes
+	int first, count;
+	Mesh.renderDirtyRange(&first, &count);
+	EXPECT_EQ(first, 0);
+	EXPECT_EQ(count, 4*qCount);
+	Mesh.updateMesh();
+	Mesh.renderDirtyRange(&first, &count);
+	EXPECT_EQ(count, 0);
+
+	//only the quads of the recolored voxel are dirty
+	pMat2->setColor(0, 255, 0);
+	Mesh.updateMesh();
+	Mesh.renderDirtyRange(&first, &count);
+	EXPECT_EQ(first, 4*(5+4)); //5 exposed faces of the first voxel, 4 of the second
+	EXPECT_EQ(count, 4*5);
+	EXPECT_EQ(render[first*CVX_MeshRender::VERTEX_STRIDE + CVX_MeshRender::COLOR_OFFSET + 1], 1.0f);
+	EXPECT_EQ(Mesh.topologyVersion(), topology);
+
+	Mesh.generateMesh();
+	EXPECT_EQ(Mesh.topologyVersion(), topology+1);
+}
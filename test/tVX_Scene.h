@@ -0,0 +1,87 @@
+#include "../include/VX_Scene.h"
+#include "../include/Voxelyze.h"
+#include "../include/VX_Collision.h"
+
+TEST(CVX_Scene, bodies)
+{
+	CVoxelyze A(0.001), B(0.001);
+	CVX_Scene Scene;
+
+	EXPECT_EQ(Scene.bodyCount(), 0);
+	EXPECT_TRUE(Scene.addBody(&A));
+	EXPECT_FALSE(Scene.addBody(&A)); //already added
+	EXPECT_FALSE(Scene.addBody(NULL));
+	EXPECT_TRUE(Scene.addBody(&B, Vec3D<double>(1.0, 0, 0)));
+	EXPECT_EQ(Scene.bodyCount(), 2);
+	EXPECT_EQ(Scene.body(1), &B);
+	EXPECT_EQ(Scene.bodyOrigin(&B).x, 1.0);
+
+	EXPECT_TRUE(Scene.setBodyOrigin(&B, Vec3D<double>(2.0, 0, 0)));
+	EXPECT_EQ(Scene.bodyOrigin(&B).x, 2.0);
+
+	EXPECT_TRUE(Scene.removeBody(&A));
+	EXPECT_FALSE(Scene.removeBody(&A));
+	EXPECT_EQ(Scene.bodyCount(), 1);
+	EXPECT_EQ(Scene.body(0), &B);
+}
+
+TEST(CVX_Scene, contacts)
+{
+	CVoxelyze A(0.001), B(0.001);
+	CVX_Material* pMatA = A.addMaterial(1000000, 1000);
+	CVX_Material* pMatB = B.addMaterial(1000000, 1000);
+	for (int i=0; i<3; i++) A.setVoxel(pMatA, i, 0, 0);
+	B.setVoxel(pMatB, 0, 0, 0);
+
+	CVX_Scene Scene;
+	Scene.addBody(&A);
+	Scene.addBody(&B, Vec3D<double>(0.1, 0, 0)); //far away
+	EXPECT_TRUE(Scene.doTimeStep());
+	EXPECT_EQ(Scene.contactList()->size(), 0);
+
+	Scene.setBodyOrigin(&B, Vec3D<double>(0.001, 0, 0.0012)); //right above the middle voxel of A
+	EXPECT_TRUE(Scene.doTimeStep());
+	EXPECT_EQ(Scene.contactList()->size(), 3);
+	for (int i=0; i<3; i++){
+		CVX_Collision* pCol = (*Scene.contactList())[i];
+		EXPECT_EQ(pCol->voxel2(), B.voxel(0,0,0)); //voxel1 is always from the first body
+		EXPECT_EQ(pCol->frameOffset().z, 0.0012);
+	}
+
+	//changing a body's voxels refreshes the contacts
+	B.setVoxel(pMatB, 1, 0, 0);
+	EXPECT_TRUE(Scene.doTimeStep());
+	EXPECT_GT(Scene.contactList()->size(), 3);
+	B.setVoxel(NULL, 1, 0, 0);
+	B.setVoxel(NULL, 0, 0, 0);
+	EXPECT_TRUE(Scene.doTimeStep());
+	EXPECT_EQ(Scene.contactList()->size(), 0);
+}
+
+TEST(CVX_Scene, resting)
+{
+	//a single voxel falls onto a fixed voxel of another body and comes to rest on top of it
+	CVoxelyze A(0.001), B(0.001);
+	CVX_Material* pMatA = A.addMaterial(1000000, 1000);
+	CVX_Material* pMatB = B.addMaterial(1000000, 1000);
+	pMatB->setCollisionDamping(1.0f);
+	A.setVoxel(pMatA, 0, 0, 0)->external()->setFixedAll();
+	CVX_Voxel* pV = B.setVoxel(pMatB, 0, 0, 0);
+	B.setGravity();
+
+	CVX_Scene Scene;
+	Scene.addBody(&A);
+	Scene.addBody(&B, Vec3D<double>(0, 0, 0.0015));
+
+	double minZ = 1.0;
+	for (int i=0; i<5000; i++){
+		ASSERT_TRUE(Scene.doTimeStep());
+		double z = Scene.bodyOrigin(&B).z + pV->position().z;
+		if (z < minZ) minZ = z;
+	}
+
+	double envelope = 2*CVX_Collision::envelopeRadius*0.001;
+	EXPECT_GT(minZ, 0.95*envelope); //never fell through
+	EXPECT_LT(minZ, 1.01*envelope); //did make contact
+	EXPECT_NEAR(A.voxel(0,0,0)->position().z, 0.0, 1e-12);
+}
@@ -1,4 +1,5 @@
 #include "../include/VX_Voxel.h"
+#include "../include/Voxelyze.h"
 
 TEST(CVX_Voxel, DefaultValues){
 	CVX_MaterialVoxel mat;
@@ -66,4 +67,24 @@ TEST(CVX_Voxel, setFixed)
 
 
 
-}
\ No newline at end of file
+}
+TEST(CVX_Voxel, cornerPositions)
+{
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	CVX_Voxel* pV = Sim.setVoxel(pMat, 1, 0, 0);
+	Sim.setVoxel(pMat, 0, 0, 0)->external()->setFixedAll();
+	Sim.setVoxel(pMat, 1, 1, 0);
+	pV->external()->setForce(2e-3f, 1e-3f, -1e-3f);
+	pV->external()->setMoment(0, 0, 1e-7f);
+	for (int i=0; i<200; i++) Sim.doTimeStep();
+
+	Vec3D<float> corners[8];
+	pV->cornerPositions(corners);
+	for (int c=0; c<8; c++){
+		Vec3D<float> expected = pV->cornerPosition((CVX_Voxel::voxelCorner)c);
+		EXPECT_EQ(corners[c].x, expected.x);
+		EXPECT_EQ(corners[c].y, expected.y);
+		EXPECT_EQ(corners[c].z, expected.z);
+	}
+}
@@ -1198,3 +1198,248 @@ TEST(CVoxelyze, collisions) //could be expanded significantly
 
 //timestep calc with wide varying density and stiffness
 
+
+TEST(CVoxelyze, surfaceVoxels)
+{
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat1 = Sim.addMaterial(1e6, 1e3);
+
+	for (int i=0; i<3; i++) for (int j=0; j<3; j++) for (int k=0; k<3; k++) Sim.setVoxel(pMat1, i, j, k);
+	EXPECT_EQ(27, Sim.voxelCount());
+	EXPECT_EQ(26, Sim.surfaceVoxelCount()); //center voxel is interior
+	for (int i=0; i<Sim.surfaceVoxelCount(); i++) EXPECT_TRUE((*Sim.surfaceVoxelList())[i]->isSurface());
+
+	Sim.setVoxel(NULL, 1, 1, 0); //expose the center voxel
+	EXPECT_EQ(26, Sim.surfaceVoxelCount());
+
+	Sim.setVoxel(pMat1, 1, 1, 0); //and cover it back up
+	EXPECT_EQ(26, Sim.surfaceVoxelCount());
+
+	Sim.setVoxel(NULL, 1, 1, 1); //remove the interior voxel directly
+	EXPECT_EQ(26, Sim.surfaceVoxelCount());
+
+	Sim.clear();
+	EXPECT_EQ(0, Sim.surfaceVoxelCount());
+}
+
+TEST(CVoxelyze, relaxation)
+{
+	//small loads: same equilibrium as the linear solution in far fewer iterations than damped dynamics would need
+	CVoxelyze Lin(0.001), Relax(0.001);
+	CVoxelyze* sims[2] = {&Lin, &Relax};
+	for (int s=0; s<2; s++){
+		CVX_Material* pMat = sims[s]->addMaterial(1e6f, 1e3f);
+		for (int i=0; i<10; i++) for (int k=0; k<2; k++) sims[s]->setVoxel(pMat, i, 0, k);
+		for (int k=0; k<2; k++) sims[s]->voxel(0,0,k)->external()->setFixedAll();
+		sims[s]->voxel(9,0,1)->external()->setForce(0, 2e-6f, -1e-5f);
+		sims[s]->voxel(0,0,1)->external()->setDisplacement(X_TRANSLATE, 1e-7);
+	}
+	ASSERT_TRUE(Lin.doLinearSolve(CVX_LinearSolver::CG_BLOCK_JACOBI));
+
+	int iterations = 0;
+	EXPECT_TRUE(Relax.doRelaxationSolve(1e-5f, 100000, &iterations));
+	EXPECT_GT(iterations, 0);
+	EXPECT_LT(iterations, 20000);
+	double tipZ = Lin.voxel(9,0,1)->displacement().z;
+	for (int i=0; i<Relax.voxelCount(); i++){
+		Vec3D<double> d1 = Lin.voxel(i)->displacement(), d2 = Relax.voxel(i)->displacement();
+		EXPECT_NEAR(d2.x, d1.x, 1e-3*fabs(tipZ));
+		EXPECT_NEAR(d2.y, d1.y, 1e-3*fabs(tipZ));
+		EXPECT_NEAR(d2.z, d1.z, 1e-3*fabs(tipZ));
+		EXPECT_EQ(Relax.voxel(i)->velocityMagnitude(), 0.0f);
+	}
+	EXPECT_EQ(Relax.voxel(0,0,1)->displacement().x, 1e-7);
+
+	//already in equilibrium
+	EXPECT_TRUE(Relax.doRelaxationSolve(1e-3f, 100000, &iterations));
+	EXPECT_EQ(iterations, 0);
+
+	//and the dynamic simulation carries on from rest
+	float ts = Relax.recommendedTimeStep();
+	for (int i=0; i<10; i++) EXPECT_TRUE(Relax.doTimeStep(ts));
+	EXPECT_NEAR(Relax.voxel(9,0,1)->displacement().z, tipZ, 1e-2*fabs(tipZ));
+}
+
+TEST(CVoxelyze, relaxationNonlinear)
+{
+	//bar loaded in tension well past yield: strain follows the bilinear curve, which the linear solver cannot
+	CVoxelyze Sim(0.001);
+	CVX_Material* pMat = Sim.addMaterial(1e6f, 1e3f);
+	pMat->setModelBilinear(1e6f, 1e5f, 1e4f);
+	for (int i=0; i<5; i++) Sim.setVoxel(pMat, i, 0, 0);
+	Sim.voxel(0,0,0)->external()->setFixedAll();
+	Sim.voxel(4,0,0)->external()->setForce(2e-2f, 0, 0); //2e4 Pa
+
+	EXPECT_TRUE(Sim.doRelaxationSolve(1e-5f));
+	double strain = 1e4/1e6 + (2e4-1e4)/1e5;
+	EXPECT_NEAR(Sim.voxel(4,0,0)->displacement().x, 4*0.001*strain, 1e-4*4*0.001*strain);
+	EXPECT_NEAR(Sim.voxel(4,0,0)->displacement().y, 0.0, 1e-12);
+
+	//too few iterations
+	Sim.voxel(4,0,0)->external()->setForce(3e-2f, 0, 0);
+	EXPECT_FALSE(Sim.doRelaxationSolve(1e-5f, 3));
+}
+
+TEST(CVoxelyze, setVoxels)
+{
+	//a random two material block built in bulk matches the same block built one voxel at a time
+	const int nx=7, ny=5, nz=4;
+	int grid[nx*ny*nz];
+	srand(48);
+	for (int i=0; i<nx*ny*nz; i++) grid[i] = rand()%3 - 1; //-1 (empty), 0 or 1
+
+	CVoxelyze A(0.001), B(0.001), C(0.001);
+	CVoxelyze* sims[3] = {&A, &B, &C};
+	for (int s=0; s<3; s++){
+		sims[s]->addMaterial(1e6f, 1e3f);
+		sims[s]->addMaterial(5e6f, 2e3f);
+		sims[s]->setGravity();
+		sims[s]->enableFloor();
+	}
+	for (int k=0; k<nz; k++) for (int j=0; j<ny; j++) for (int i=0; i<nx; i++){
+		int m = grid[i + nx*(j + ny*k)];
+		if (m >= 0) A.setVoxel(A.material(m), i-3, j, k+1);
+	}
+	EXPECT_TRUE(B.setVoxels(grid, nx, ny, nz, -3, 0, 1));
+
+	std::vector<int> runs; //equivalent runs, deliberately continuing across rows
+	for (int i=0; i<nx*ny*nz; i++){
+		if (i>0 && grid[i]==grid[i-1]) runs.back()++;
+		else {runs.push_back(grid[i]); runs.push_back(1);}
+	}
+	EXPECT_TRUE(C.setVoxelRuns(&runs[0], (int)runs.size()/2, nx, ny, nz, -3, 0, 1));
+
+	for (int s=1; s<3; s++){
+		EXPECT_EQ(sims[s]->voxelCount(), A.voxelCount());
+		EXPECT_EQ(sims[s]->linkCount(), A.linkCount());
+		EXPECT_EQ(sims[s]->surfaceVoxelCount(), A.surfaceVoxelCount());
+		EXPECT_EQ(sims[s]->indexMinX(), A.indexMinX());
+		EXPECT_EQ(sims[s]->indexMaxZ(), A.indexMaxZ());
+		for (int k=0; k<nz; k++) for (int j=0; j<ny; j++) for (int i=-3; i<nx-3; i++){
+			CVX_Voxel* pA = A.voxel(i, j, k+1), *pS = sims[s]->voxel(i, j, k+1);
+			ASSERT_EQ(pA == NULL, pS == NULL);
+			if (pA == NULL) continue;
+			EXPECT_EQ(pA->material()->youngsModulus(), pS->material()->youngsModulus());
+			for (int d=0; d<6; d++) EXPECT_EQ(pA->link((CVX_Voxel::linkDirection)d) == NULL, pS->link((CVX_Voxel::linkDirection)d) == NULL);
+		}
+	}
+
+	//and simulates identically
+	float ts = A.recommendedTimeStep();
+	for (int i=0; i<100; i++) for (int s=0; s<3; s++) sims[s]->doTimeStep(ts);
+	for (int i=0; i<A.voxelCount(); i++){
+		CVX_Voxel* pA = A.voxel(i);
+		EXPECT_EQ(pA->position().z, B.voxel(pA->indexX(), pA->indexY(), pA->indexZ())->position().z);
+		EXPECT_EQ(pA->position().z, C.voxel(pA->indexX(), pA->indexY(), pA->indexZ())->position().z);
+	}
+
+	//overlapping an existing model replaces voxels in place and links to the ones around it
+	CVoxelyze D(0.001);
+	CVX_Material* pSoft = D.addMaterial(1e6f, 1e3f);
+	D.addMaterial(5e6f, 2e3f);
+	for (int i=0; i<4; i++) for (int j=0; j<4; j++) for (int k=0; k<4; k++) D.setVoxel(pSoft, i, j, k);
+	CVX_Voxel* pKept = D.voxel(1,1,1);
+	int block[8] = {1, 1, 1, 1, 1, 1, 1, -1};
+	EXPECT_TRUE(D.setVoxels(block, 2, 2, 2, 1, 1, 3)); //z=3 overlaps, z=4 is new
+	EXPECT_EQ(D.voxelCount(), 64+3);
+	EXPECT_EQ(D.voxel(1,1,1), pKept);
+	EXPECT_EQ(D.voxel(1,1,3)->material()->youngsModulus(), 5e6f);
+	EXPECT_EQ(D.voxel(2,2,3)->material(), D.voxel(1,1,3)->material());
+	EXPECT_TRUE(D.voxel(2,2,4) == NULL); //-1 left it empty
+	EXPECT_TRUE(D.voxel(1,1,4)->link(CVX_Voxel::Z_NEG) != NULL);
+	EXPECT_TRUE(D.voxel(1,1,3)->link(CVX_Voxel::X_NEG) != NULL);
+	EXPECT_EQ(D.linkCount(), 3*4*4*3 + 3 + 2);
+	EXPECT_FALSE(D.voxel(1,1,3)->isSurface());
+
+	//invalid input changes nothing
+	int badMat[2] = {0, 2};
+	int shortRuns[2] = {0, 7};
+	EXPECT_FALSE(D.setVoxels(badMat, 2, 1, 1, 10, 10, 10));
+	EXPECT_FALSE(D.setVoxels(block, 0, 2, 2));
+	EXPECT_FALSE(D.setVoxelRuns(shortRuns, 1, 2, 2, 2, 10, 10, 10));
+	EXPECT_FALSE(D.setVoxelRuns(NULL, 1, 2, 2, 2));
+	EXPECT_EQ(D.voxelCount(), 64+3);
+	EXPECT_TRUE(D.voxel(10,10,10) == NULL);
+}
+
+TEST(CVoxelyze, removeVoxels)
+{
+	//removing a random set of voxels leaves the same model as building only the remaining ones
+	const int n=8;
+	CVoxelyze A(0.001);
+	CVX_Material* pMat = A.addMaterial(1e6f, 1e3f);
+	for (int k=0; k<n; k++) for (int j=0; j<n; j++) for (int i=0; i<n; i++) A.setVoxel(pMat, i, j, k);
+
+	srand(49);
+	std::vector<CVX_Voxel*> toRemove;
+	bool kept[n*n*n];
+	for (int i=0; i<n*n*n; i++){
+		CVX_Voxel* pV = A.voxel(i%n, (i/n)%n, i/(n*n));
+		kept[i] = rand()%2 == 0;
+		if (!kept[i]){
+			toRemove.push_back(pV);
+			if (rand()%4 == 0) toRemove.push_back(pV); //repeated handles are ignored
+		}
+	}
+	toRemove.push_back(NULL);
+	int removeCount = 0;
+	for (int i=0; i<n*n*n; i++) if (!kept[i]) removeCount++;
+	EXPECT_EQ(A.removeVoxels(toRemove), removeCount);
+
+	CVoxelyze B(0.001);
+	CVX_Material* pMatB = B.addMaterial(1e6f, 1e3f);
+	for (int i=0; i<n*n*n; i++) if (kept[i]) B.setVoxel(pMatB, i%n, (i/n)%n, i/(n*n));
+	EXPECT_EQ(A.voxelCount(), B.voxelCount());
+	EXPECT_EQ(A.linkCount(), B.linkCount());
+	EXPECT_EQ(A.surfaceVoxelCount(), B.surfaceVoxelCount());
+	for (int i=0; i<A.voxelCount(); i++){ //every listed voxel is where it says it is
+		CVX_Voxel* pV = A.voxel(i);
+		EXPECT_EQ(A.voxel(pV->indexX(), pV->indexY(), pV->indexZ()), pV);
+		EXPECT_TRUE(kept[pV->indexX() + n*(pV->indexY() + n*pV->indexZ())]);
+	}
+	for (int i=0; i<A.linkCount(); i++){ //and every listed link joins two existing voxels
+		CVX_Link* pL = A.link(i);
+		EXPECT_EQ(A.voxel(pL->voxel(true)->indexX(), pL->voxel(true)->indexY(), pL->voxel(true)->indexZ()), pL->voxel(true));
+		EXPECT_EQ(A.voxel(pL->voxel(false)->indexX(), pL->voxel(false)->indexY(), pL->voxel(false)->indexZ()), pL->voxel(false));
+	}
+
+	//single removals keep the lists in sync too
+	while (A.voxelCount() > 1){
+		CVX_Voxel* pV = A.voxel(A.voxelCount()/2);
+		A.setVoxel(NULL, pV->indexX(), pV->indexY(), pV->indexZ());
+	}
+	EXPECT_EQ(A.linkCount(), 0);
+	EXPECT_EQ(A.surfaceVoxelCount(), 1);
+}
+
+TEST(CVoxelyze, removeMaterial)
+{
+	//materials in a model with holes in it
+	CVoxelyze Sim(0.001);
+	CVX_Material* pSoft = Sim.addMaterial(1e6f, 1e3f);
+	CVX_Material* pStiff = Sim.addMaterial(1e7f, 1e3f);
+	CVX_Material* pOther = Sim.addMaterial(2e6f, 1e3f);
+	for (int i=0; i<6; i+=2) for (int j=0; j<3; j++) Sim.setVoxel(j==1 ? pStiff : pSoft, i, j, 0);
+	Sim.setVoxel(pSoft, 1, 0, 0);
+	EXPECT_EQ(Sim.voxelCount(), 10);
+	EXPECT_EQ(Sim.linkCount(), 6+2);
+
+	EXPECT_TRUE(Sim.replaceMaterial(pSoft, pOther));
+	EXPECT_EQ(Sim.voxel(1,0,0)->material()->youngsModulus(), 2e6f);
+	EXPECT_EQ(Sim.voxel(2,1,0)->material()->youngsModulus(), 1e7f);
+	EXPECT_EQ(Sim.linkCount(), 6+2);
+
+	EXPECT_TRUE(Sim.removeMaterial(pStiff));
+	EXPECT_EQ(Sim.materialCount(), 2);
+	EXPECT_EQ(Sim.voxelCount(), 7);
+	EXPECT_EQ(Sim.linkCount(), 2);
+	CVoxelyze Other(0.001);
+	EXPECT_FALSE(Sim.removeMaterial(Other.addMaterial(1e7f, 1e3f))); //not a material of this simulation
+	EXPECT_EQ(Sim.materialCount(), 2);
+
+	//a new material bridging to the remaining ones gets a fresh combined link material
+	CVX_Material* pNew = Sim.addMaterial(4e6f, 1e3f);
+	Sim.setVoxel(pNew, 0, 1, 0);
+	EXPECT_EQ(Sim.linkCount(), 4);
+	EXPECT_TRUE(Sim.voxel(0,1,0)->link(CVX_Voxel::Y_NEG) != NULL);
+}